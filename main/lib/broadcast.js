@@ -0,0 +1,132 @@
+import { nativeStreamOf } from './stream.js'
+import { logger } from './utils.js'
+
+const log = logger(`webtransport:broadcast(${process?.pid})`)
+
+/**
+ * @typedef {import('./types').BroadcastGroupInit} BroadcastGroupInit
+ * @typedef {import('./types').NativeBroadcastGroup} NativeBroadcastGroup
+ * @typedef {import('./types').NativeDatagramBroadcastGroup} NativeDatagramBroadcastGroup
+ * @typedef {import('./types').WebTransportSessionImpl} WebTransportSession
+ * @typedef {import('./dom').WebTransportSendStream} WebTransportSendStream
+ */
+
+/**
+ * @type {new (arg?: BroadcastGroupInit) => NativeBroadcastGroup}
+ */
+let Http3WTBroadcastGroup
+/**
+ * @type {new () => NativeDatagramBroadcastGroup}
+ */
+let Http3WTDatagramBroadcastGroup
+// @ts-ignore
+import('@fails-components/webtransport-transport-http3-quiche')
+  .then(
+    /**
+     * @type {import("./types").TransportHttp3Quiche}
+     */
+    (http3lib) => {
+      ;({ Http3WTBroadcastGroup, Http3WTDatagramBroadcastGroup } = http3lib)
+    }
+  )
+  .catch((error) => {
+    log('Problem loading http3-quiche transport', error)
+  })
+
+/**
+ * Writes the same chunk to many send streams, also of different sessions.
+ * The chunk is copied once inside the http/3 transport and shared by all
+ * streams, each stream keeps its send order and send group.
+ */
+export class BroadcastGroup {
+  /**
+   * @param {BroadcastGroupInit} [args]
+   */
+  constructor(args) {
+    if (!Http3WTBroadcastGroup) {
+      throw new Error('http/3 transport is not loaded, await quicheLoaded')
+    }
+    this.objint = new Http3WTBroadcastGroup(args)
+  }
+
+  /**
+   * @param {WebTransportSendStream} writable
+   * @returns {boolean} false, if it is not a http/3 stream or it is gone
+   */
+  add(writable) {
+    const objint = nativeStreamOf(writable)
+    if (!objint) return false
+    return this.objint.add(objint)
+  }
+
+  /**
+   * @param {WebTransportSendStream} writable
+   */
+  remove(writable) {
+    const objint = nativeStreamOf(writable)
+    if (objint) this.objint.remove(objint)
+  }
+
+  /**
+   * Never waits for slow streams, they buffer the chunk up to their high water
+   * marks or drop it, depending on the policy.
+   * @param {Uint8Array} chunk
+   * @returns {{written: number, dropped: number}} number of streams
+   */
+  write(chunk) {
+    return this.objint.write(chunk)
+  }
+
+  get size() {
+    return this.objint.getSize()
+  }
+}
+
+/**
+ * @param {WebTransportSession} session
+ */
+function nativeSessionOf(session) {
+  // @ts-ignore the client wraps the session
+  return (session.sessionint ?? session).objint
+}
+
+/**
+ * Sends the same datagram to many sessions in one call into the http/3
+ * transport, e.g. a state update to all players of a match.
+ */
+export class DatagramBroadcastGroup {
+  constructor() {
+    if (!Http3WTDatagramBroadcastGroup) {
+      throw new Error('http/3 transport is not loaded, await quicheLoaded')
+    }
+    this.objint = new Http3WTDatagramBroadcastGroup()
+  }
+
+  /**
+   * @param {WebTransportSession} session
+   * @returns {boolean} false, if it is not a connected http/3 session
+   */
+  add(session) {
+    return this.objint.add(nativeSessionOf(session))
+  }
+
+  /**
+   * @param {WebTransportSession} session
+   */
+  remove(session) {
+    this.objint.remove(nativeSessionOf(session))
+  }
+
+  /**
+   * @param {Uint8Array} chunk
+   * @returns {{sent: number, blocked: number, tooBig: number, dropped: number, failed: number}}
+   * number of sessions
+   */
+  write(chunk) {
+    return this.objint.write(chunk)
+  }
+
+  get size() {
+    return this.objint.getSize()
+  }
+}
@@ -31,6 +31,7 @@ export interface  WebTransportSendStreamStats {
 }
 
 export interface WebTransportSendGroup {
+  weight?: number
   getStats: () =>  Promise<WebTransportSendStreamStats>
 }
 
@@ -53,10 +54,13 @@ export interface WebTransportDatagramDuplexStream {
   createWritable: (options?:  WebTransportSendOptions) => WebTransportDatagramsWritable;
   readable: ReadableStream<Uint8Array>
   readonly maxDatagramSize: number
+  writeDatagrams?: (chunks: Uint8Array[] | Uint8Array, lengths?: Uint32Array | number[]) => Uint8Array
+  ondatagrams?: ((ring: Uint8Array, index: Uint32Array, count: number) => void) | null
   // incomingMaxAge?: number
-  // outgoingMaxAge?: number
+  outgoingMaxAge?: number | null
   // incomingHighWaterMark: number
-  // outgoingHighWaterMark: number
+  outgoingHighWaterMark?: number
+  outgoingDropPolicy?: 'oldest' | 'newest' // non standard
 }
 
 export interface WebTransportSendStream extends WritableStream<Uint8Array> {
@@ -102,7 +106,9 @@ export interface WebTransportOptions {
     * Nonstandard option - when a new connection is opened, how long to wait for the webtransport handshake to complete in ms before rejecting or switching to http2
     */
   webTransportConnectTimeout?: number
-  congestionControl?: WebTransportCongestionControl
+  // the algorithms are non standard, http/3 only
+  congestionControl?: WebTransportCongestionControl | 'bbrv2' | 'bbr' | 'cubic' | 'reno'
+  congestionControlOptions?: string[] // non standard, quic connection option tags, http/3 only
   protocols?: string[] 
 }
 
@@ -110,10 +116,13 @@ export interface WebTransportSendStreamOptions {
   sendGroup:  WebTransportSendGroup|null
   sendOrder?: number
   waitUntilAvailable?: boolean
+  messageMode?: boolean // non standard, length prefixed messages, http/3 only
+  deadline?: number // non standard, milliseconds until the stream is reset, http/3 only
 }
 
 export interface WebTransportSession {
   getStats: () => Promise<WebTransportStats>
+  fillStats?: (stats: Float64Array | BigUint64Array) => boolean // non standard, http/3 only
   readonly ready: Promise<void>
   readonly reliability: WebTransportReliabilityMode
   readonly congestionControl: WebTransportCongestionControl
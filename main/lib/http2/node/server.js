@@ -68,6 +68,7 @@ export class Http2WebTransportServer {
       },
       remoteCustomSettings: [0x2b61, 0x2b62, 0x2b63, 0x2b64, 0x2b65]
     })
+    if (args?.ticketKeys) this.setTicketKeys(args.ticketKeys)
 
     this.serverInt.on('listening', () => {
       const addr = this.serverInt.address()
@@ -455,6 +456,15 @@ export class Http2WebTransportServer {
     this.serverInt.setSecureContext({ key: privKey, cert })
   }
 
+  /**
+   * node keeps only one key, so tickets of the older keys are rejected,
+   * node reads it in its own layout: name, HMAC secret and AES-128 key
+   * @param {Uint8Array[]} keys
+   */
+  setTicketKeys(keys) {
+    this.serverInt.setTicketKeys(Buffer.from(keys[0]))
+  }
+
   /**
    * @param {boolean} isset
    */
@@ -309,6 +309,22 @@ export class ParserBase {
     this.scheduler.Schedule(streamid)
   }
 
+  /**
+   * @param {bigint} streamid
+   * @param {number} bytes
+   */
+  addStreamBytesSent(streamid, bytes) {
+    this.scheduler.AddBytesSent(streamid, bytes)
+  }
+
+  /**
+   * @param {bigint} sendGroupId
+   * @param {number} weight
+   */
+  setSendGroupWeight(sendGroupId, weight) {
+    this.scheduler.SetSendGroupWeight(sendGroupId, weight)
+  }
+
   /**
    *
    * @param {bigint} streamid
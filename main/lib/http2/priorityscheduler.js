@@ -440,6 +440,88 @@ export class PriorityScheduler {
      * @type {Object<string, {sendGroupId: SendGroupId, perGroupScheduler: BTreeScheduler }>}
      */
     this.streamToGroupMap_ = {} // absl:: flat_hash_map < StreamId, GroupSchedulerPair *>
+
+    // Weighted send groups, not part of quiche: if any weight is set, the
+    // groups are not served round-robin, but by the least virtual time, which
+    // advances by the bytes sent divided by the weight of the group.
+    /**
+     * @type {Object<string, number>}
+     */
+    this.groupWeights_ = {}
+    /**
+     * @type {Object<string, number>}
+     */
+    this.groupVirtualTime_ = {}
+    // The virtual time of the last served group.
+    this.virtualTime_ = 0
+  }
+
+  // Returns true if weights are set for any group.
+  IsWeighted() {
+    return Object.keys(this.groupWeights_).length !== 0
+  }
+
+  // Sets the weight of a group, groups without a weight have the weight 1,
+  // a weight of 0 or less removes it.
+  /**
+   * @param {SendGroupId} sendGroupId
+   * @param {number} weight
+   */
+  SetSendGroupWeight(sendGroupId, weight) {
+    if (weight > 0) {
+      this.groupWeights_[sendGroupIdToKey(sendGroupId)] = weight
+    } else {
+      delete this.groupWeights_[sendGroupIdToKey(sendGroupId)]
+    }
+  }
+
+  /**
+   * @param {SendGroupId} sendGroupId
+   */
+  GroupWeight(sendGroupId) {
+    return this.groupWeights_[sendGroupIdToKey(sendGroupId)] ?? 1
+  }
+
+  /**
+   * @param {SendGroupId} sendGroupId
+   */
+  GroupVirtualTime(sendGroupId) {
+    return this.groupVirtualTime_[sendGroupIdToKey(sendGroupId)] ?? 0
+  }
+
+  // Charges the bytes sent by a stream to its group.
+  /**
+   * @param {StreamId} streamId
+   * @param {number} bytes
+   */
+  AddBytesSent(streamId, bytes) {
+    if (!this.IsWeighted()) {
+      return
+    }
+    const stream = this.streamToGroupMap_[streamIdToKey(streamId)]
+    if (!stream) {
+      return
+    }
+    const key = sendGroupIdToKey(stream.sendGroupId)
+    this.groupVirtualTime_[key] =
+      this.GroupVirtualTime(stream.sendGroupId) +
+      bytes / this.GroupWeight(stream.sendGroupId)
+  }
+
+  // Returns the scheduled group with the least virtual time, groups with the
+  // same virtual time are served in the round-robin order.
+  NextWeightedGroup() {
+    let next
+    let nextTime = 0
+    for (const entry of this.activeGroups_.schedule_) {
+      const groupId = BTreeScheduler.StreamId(entry)
+      const time = this.GroupVirtualTime(groupId)
+      if (typeof next === 'undefined' || time < nextTime) {
+        next = groupId
+        nextTime = time
+      }
+    }
+    return next
   }
 
   // Returns true if there are any streams registered.
@@ -500,6 +582,7 @@ export class PriorityScheduler {
     // Clean up the group if there are no more streams associated with it.
     if (!groupScheduler.HasRegistered()) {
       delete this.perGroupSchedulers_[sendGroupIdToKey(groupId)]
+      delete this.groupVirtualTime_[sendGroupIdToKey(groupId)]
       this.activeGroups_.Unregister(groupId)
     }
   }
@@ -552,9 +635,21 @@ export class PriorityScheduler {
     }
     const { sendGroupId, perGroupScheduler } = stream
 
-    const perGroupResult = this.activeGroups_.ShouldYield(sendGroupId)
-    if (perGroupResult) {
-      return true
+    if (this.IsWeighted()) {
+      // Yield to a group, which is behind its share.
+      const next = this.NextWeightedGroup()
+      if (
+        typeof next !== 'undefined' &&
+        next !== sendGroupId &&
+        this.GroupVirtualTime(next) < this.GroupVirtualTime(sendGroupId)
+      ) {
+        return true
+      }
+    } else {
+      const perGroupResult = this.activeGroups_.ShouldYield(sendGroupId)
+      if (perGroupResult) {
+        return true
+      }
     }
 
     return perGroupScheduler.ShouldYield(streamId)
@@ -579,7 +674,17 @@ export class PriorityScheduler {
 
   // Pops the highest priority stream.  Will fail if the schedule is empty.
   PopFront() {
-    const groupId = this.activeGroups_.PopFront()
+    let groupId
+    if (this.IsWeighted()) {
+      groupId = this.NextWeightedGroup()
+      if (typeof groupId === 'undefined') {
+        return undefined
+      }
+      this.activeGroups_.Deschedule(groupId)
+      this.virtualTime_ = this.GroupVirtualTime(groupId)
+    } else {
+      groupId = this.activeGroups_.PopFront()
+    }
     if (typeof groupId === 'undefined') {
       return undefined
     }
@@ -610,6 +715,14 @@ export class PriorityScheduler {
       return new Error('Stream ID not registered')
     }
     const { sendGroupId, perGroupScheduler } = it
+    if (
+      this.IsWeighted() &&
+      !this.activeGroups_.IsScheduled(sendGroupId) &&
+      this.GroupVirtualTime(sendGroupId) < this.virtualTime_
+    ) {
+      // An idle group does not save up a share.
+      this.groupVirtualTime_[sendGroupIdToKey(sendGroupId)] = this.virtualTime_
+    }
     this.activeGroups_.Schedule(sendGroupId)
     return perGroupScheduler.Schedule(streamId)
   }
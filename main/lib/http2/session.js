@@ -4,6 +4,7 @@
  * @typedef {import('../dom.js').WebTransportSendStreamOptions} WebTransportSendStreamOptions
  */
 import { ParserBase } from './parserbase.js'
+import { DatagramStatus } from '../session.js'
 import { FlowController } from './flowcontroller.js'
 import { logger } from '../utils.js'
 import { StreamIdManager } from './streamidmanager.js'
@@ -73,8 +74,13 @@ export class Http2WebTransportSession {
       maxAllowedIncomingStreams: initialBidirectionalReceiveStreams,
       maxAllowedOutgoingStreams: initialBidirectionalSendStreams
     })
-    /** @type {Array<Uint8Array>} */
+    /** @type {Array<{chunk: Uint8Array, queued: number}>} */
     this.datagramsWaiting_ = []
+    // limits of the waiting datagrams, see setDatagramQueue
+    this.datagramMaxQueue_ = 0
+    this.datagramMaxAge_ = 0
+    this.datagramDropOldest_ = true
+    this.datagramsDropped_ = 0n
     /** @type {Array<{sendOrder: number, sendGroupId: bigint}>} */
     this.orderUniStreams = []
     /** @type {Array<{sendOrder: number, sendGroupId: bigint}>} */
@@ -126,8 +132,9 @@ export class Http2WebTransportSession {
   }
 
   drainWrites() {
+    this.expireDatagrams()
     while (!this.capsParser.blocked && this.datagramsWaiting_.length > 0) {
-      const outChunk = this.datagramsWaiting_.shift()
+      const outChunk = this.datagramsWaiting_.shift()?.chunk
       this.capsParser.writeCapsule({
         type: ParserBase.DATAGRAM,
         headerVints: [],
@@ -141,12 +148,26 @@ export class Http2WebTransportSession {
 
   /**
    * @param {Uint8Array} chunk
-   * @return {{ code: "success" | "blocked" | "internalError" | "tooBig", message?: string | undefined; }}
+   * @return {{ code: "success" | "blocked" | "internalError" | "tooBig" | "dropped", message?: string | undefined; }}
    */
   writeDatagram(chunk) {
     if (chunk.byteLength > this.getMaxDatagramSize()) return { code: 'tooBig' }
     if (this.capsParser.blocked) {
-      this.datagramsWaiting_.push(chunk)
+      this.expireDatagrams()
+      if (
+        this.datagramMaxQueue_ > 0 &&
+        this.datagramsWaiting_.length >= this.datagramMaxQueue_
+      ) {
+        this.datagramsDropped_++
+        if (!this.datagramDropOldest_) {
+          return {
+            code: 'dropped',
+            message: 'Datagram dropped, the queue is full'
+          }
+        }
+        this.datagramsWaiting_.shift()
+      }
+      this.datagramsWaiting_.push({ chunk, queued: Date.now() })
       this.capsParser.scheduleDrainWrites()
       return { code: 'blocked' }
     }
@@ -158,6 +179,61 @@ export class Http2WebTransportSession {
     return { code: 'success' }
   }
 
+  /**
+   * @param {{maxQueue?: number, maxAge?: number, dropPolicy?: string}} arg
+   */
+  setDatagramQueue({ maxQueue = 0, maxAge = 0, dropPolicy = 'oldest' }) {
+    if (dropPolicy !== 'oldest' && dropPolicy !== 'newest')
+      throw new TypeError('dropPolicy must be oldest or newest')
+    if (maxQueue < 0) throw new RangeError('maxQueue must not be negative')
+    this.datagramMaxQueue_ = maxQueue
+    this.datagramMaxAge_ = maxAge
+    this.datagramDropOldest_ = dropPolicy === 'oldest'
+    this.expireDatagrams()
+    while (
+      this.datagramMaxQueue_ > 0 &&
+      this.datagramsWaiting_.length > this.datagramMaxQueue_
+    ) {
+      this.datagramsWaiting_.shift()
+      this.datagramsDropped_++
+    }
+  }
+
+  expireDatagrams() {
+    if (this.datagramMaxAge_ <= 0) return
+    const now = Date.now()
+    while (
+      this.datagramsWaiting_.length > 0 &&
+      this.datagramsWaiting_[0].queued + this.datagramMaxAge_ <= now
+    ) {
+      this.datagramsWaiting_.shift()
+      this.datagramsDropped_++
+    }
+  }
+
+  /**
+   * @param {Uint8Array[]|Uint8Array} chunks
+   * @param {Uint32Array} [lengths]
+   * @return {Uint8Array}
+   */
+  writeDatagrams(chunks, lengths) {
+    let datagrams = chunks
+    if (!Array.isArray(chunks)) {
+      // unpack, the views share the buffer
+      datagrams = []
+      let offset = chunks.byteOffset
+      for (const len of lengths ?? []) {
+        datagrams.push(new Uint8Array(chunks.buffer, offset, len))
+        offset += len
+      }
+    }
+    const codes = new Uint8Array(datagrams.length)
+    datagrams.forEach((chunk, i) => {
+      codes[i] = DatagramStatus[this.writeDatagram(chunk).code]
+    })
+    return codes
+  }
+
   trySendingUnidirectionalStreams() {
     while (
       this.orderUniStreams.length > 0 &&
@@ -237,7 +313,7 @@ export class Http2WebTransportSession {
   orderSessionStats() {
     this.jsobj.onSessionStats({
       timestamp: 0,
-      expiredOutgoing: 0n,
+      expiredOutgoing: this.datagramsDropped_,
       lostOutgoing: 0n,
       // non Datagram
       minRtt: 0,
@@ -250,11 +326,19 @@ export class Http2WebTransportSession {
   orderDatagramStats() {
     this.jsobj.onDatagramStats({
       timestamp: 0,
-      expiredOutgoing: 0n,
+      expiredOutgoing: this.datagramsDropped_,
       lostOutgoing: 0n
     })
   }
 
+  /**
+   * @param {bigint} sendGroupId
+   * @param {number} weight
+   */
+  setSendGroupWeight(sendGroupId, weight) {
+    this.capsParser.setSendGroupWeight(sendGroupId, weight)
+  }
+
   getMaxDatagramSize() {
     return 16384 // this completly arbitry, we do not have a real restriction, but we choose more than quiche, to make things interesting
   }
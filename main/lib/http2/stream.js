@@ -357,6 +357,10 @@ export class Http2WebTransportStream {
         if (payload) {
           this.flowController.addBytesSent(payload?.byteLength)
           this.sessionFlowController.addBytesSent(payload?.byteLength)
+          this.capsuleParser.addStreamBytesSent(
+            this.streamid,
+            payload.byteLength
+          )
         }
       }
       if (outgoChunkSend) {
@@ -23,8 +23,16 @@
  */
 
 // both imports from the browser side and for nodes to generate a joint type file
-export { HttpServer, Http3Server, Http2Server } from './server.js'
+export {
+  HttpServer,
+  Http3Server,
+  Http2Server,
+  ConnectionStatsField
+} from './server.js'
 export { WebTransport, quicheLoaded } from './webtransport.node.js'
+export { spliceStream, sendFile } from './stream.js'
+export { BroadcastGroup, DatagramBroadcastGroup } from './broadcast.js'
+export { DatagramStatus, SessionStatsField } from './session.js'
 
 export {
   WebTransportPonyfill,
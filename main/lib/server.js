@@ -58,8 +58,35 @@ const quicheLoaded = new Promise((resolve, reject) => {
  * @typedef {import('./types').HttpServerListeningEvent} HttpServerListeningEvent
  * @typedef {import('./types').ServerSessionRequestEvent} ServerSessionRequestEvent
  * @typedef {import('./types').HttpServerInit} HttpServerInit
+ * @typedef {import('./types').CertCompressionStats} CertCompressionStats
  */
 
+/**
+ * Byte offsets inside a record returned by the non standard
+ * server.connectionStats, must match ConnectionStatsOffset in http3server.h,
+ * the counters are uint64 in host byte order
+ */
+export const ConnectionStatsField = Object.freeze({
+  connectionIdLength: 0, // uint8
+  peerFamily: 1, // uint8, 4 or 6
+  peerPort: 2, // uint16
+  connectionId: 4, // up to 20 bytes
+  peerAddress: 24, // 4 or 16 bytes in network order
+  minRtt: 40, // microseconds
+  smoothedRtt: 48,
+  rttVariation: 56,
+  estimatedSendRate: 64, // bits per second
+  congestionWindow: 72,
+  bytesInFlight: 80,
+  bytesSent: 88,
+  bytesReceived: 96,
+  packetsSent: 104,
+  packetsLost: 112,
+  packetsReceived: 120,
+  activeStreams: 128,
+  recordSize: 136
+})
+
 // @ts-ignore
 class TransportIntServerProxy {
   /**
@@ -92,6 +119,49 @@ class TransportIntServerProxy {
     })
   }
 
+  /**
+   * @param {Uint8Array[]} keys
+   */
+  setTicketKeys(keys) {
+    this.transportsInts.forEach((transport) => {
+      if (transport.setTicketKeys) transport.setTicketKeys(keys)
+    })
+  }
+
+  /**
+   * @param {'never'|'load'|'always'} mode
+   * @param {number} [threshold]
+   * @returns {number|undefined}
+   */
+  setRetry(mode, threshold) {
+    for (const transport of this.transportsInts) {
+      if (transport.setRetry) return transport.setRetry(mode, threshold)
+    }
+    return undefined
+  }
+
+  /**
+   * @returns {CertCompressionStats|undefined}
+   */
+  certCompressionStats() {
+    for (const transport of this.transportsInts) {
+      if (transport.certCompressionStats)
+        return transport.certCompressionStats()
+    }
+    return undefined
+  }
+
+  /**
+   * @param {Uint8Array} [target]
+   * @returns {Uint8Array|undefined}
+   */
+  connectionStats(target) {
+    for (const transport of this.transportsInts) {
+      if (transport.connectionStats) return transport.connectionStats(target)
+    }
+    return undefined
+  }
+
   /**
    * @param {boolean} hasHandler
    */
@@ -173,6 +243,8 @@ export class HttpServer {
       })
       .catch((error) => {
         log('Problem in startServer', error)
+        // e.g. invalid options, the server will never listen
+        this._ready.reject(error)
       })
   }
 
@@ -186,8 +258,8 @@ export class HttpServer {
   }
 
   /**
-   * @param {string} cert
-   * @param {string} privKey
+   * @param {string|string[]} cert
+   * @param {string|string[]} privKey
    * @param {boolean} http2only
    * */
   updateCert(cert, privKey, http2only) {
@@ -195,6 +267,53 @@ export class HttpServer {
       this.transportInt.updateCert(cert, privKey, http2only)
   }
 
+  /**
+   * Replaces the TLS session ticket keys, each key has 48 bytes, 16 bytes
+   * name and a 32 bytes AES-256-GCM key. The first one encrypts new tickets,
+   * all are accepted for resumption, http/2 uses only the first key
+   * @param {Uint8Array[]} keys
+   */
+  setTicketKeys(keys) {
+    if (this.transportInt.setTicketKeys) this.transportInt.setTicketKeys(keys)
+  }
+
+  /**
+   * Selects, when the http/3 transport answers new connections without
+   * a valid address token with a Retry
+   * @param {'never'|'load'|'always'} mode
+   * @param {number} [threshold] handshakes in progress for 'load', the
+   * current one is kept, if undefined
+   * @returns {number|undefined} handshakes in progress, undefined without
+   * http/3 transport
+   */
+  setRetry(mode, threshold) {
+    if (!this.transportInt?.setRetry) return undefined
+    return this.transportInt.setRetry(mode, threshold)
+  }
+
+  /**
+   * Counters of the http/3 certificate compression, the ratio is
+   * compressedBytes / uncompressedBytes
+   * @returns {CertCompressionStats|undefined} undefined
+   * without http/3 transport
+   */
+  certCompressionStats() {
+    if (!this.transportInt?.certCompressionStats) return undefined
+    return this.transportInt.certCompressionStats()
+  }
+
+  /**
+   * Snapshot of all http/3 connections, one record of
+   * ConnectionStatsField.recordSize bytes per connection,
+   * written into target, if it is large enough
+   * @param {Uint8Array} [target]
+   * @returns {Uint8Array|undefined} undefined without http/3 transport
+   */
+  connectionStats(target) {
+    if (!this.transportInt?.connectionStats) return undefined
+    return this.transportInt.connectionStats(target)
+  }
+
   /**
    * @returns {{ port: number, host: string, family: 'IPv4' | 'IPv6' } | null}
    */
@@ -282,6 +401,22 @@ export class HttpServer {
       peerAddress: args.peerAddress,
       userData: args.userData ?? {},
       datagramsReadableMode: this.defaultDatagramsReadableMode_,
+      sendHighWaterMark: {
+        session: this.args.sessionSendHighWaterMark,
+        stream: this.args.streamSendHighWaterMark
+      },
+      streamMessageMode: {
+        enabled: this.args.streamMessageMode,
+        maxMessageSize: this.args.maxMessageSize
+      },
+      datagramRing: {
+        size: this.args.datagramRingSize
+      },
+      datagramQueue: {
+        maxQueue: this.args.datagramMaxQueue,
+        maxAge: this.args.datagramMaxAge,
+        dropPolicy: this.args.datagramDropPolicy
+      },
       parentobj: this
     })
     args.session.jsobj = sesobj
@@ -13,6 +13,7 @@ const log = logger(`webtransport:httpwtsession(${pid})`)
  * @typedef {import('./types').SessionReadyEvent} SessionReadyEvent
  * @typedef {import('./types').SessionCloseEvent} SessionCloseEvent
  * @typedef {import('./types').DatagramReceivedEvent} DatagramReceivedEvent
+ * @typedef {import('./types').DatagramsReceivedEvent} DatagramsReceivedEvent
  * @typedef {import('./types').GoawayReceivedEvent} GoawayReceivedEvent
  * @typedef {import('./types').DatagramStatsEvent} DatagramStatsEvent
  * @typedef {import('./types').SessionStatsEvent} SessionStatsEvent
@@ -44,6 +45,59 @@ const log = logger(`webtransport:httpwtsession(${pid})`)
  * @typedef {import('stream/web').WritableStreamDefaultController} WritableStreamDefaultController
  */
 
+/**
+ * Status per datagram returned by the non standard datagrams.writeDatagrams
+ */
+export const DatagramStatus = Object.freeze({
+  success: 0,
+  blocked: 1, // queued by the transport
+  tooBig: 2,
+  internalError: 3,
+  dropped: 4 // by the limit of the outgoing datagram queue
+})
+
+/**
+ * Offsets of the counters written by the non standard session.fillStats,
+ * must match SessionStatsField in http3wtsessionvisitor.h
+ */
+export const SessionStatsField = Object.freeze({
+  minRtt: 0, // microseconds
+  smoothedRtt: 1,
+  rttVariation: 2,
+  estimatedSendRate: 3, // bits per second
+  congestionWindow: 4, // bytes
+  bytesInFlight: 5,
+  packetsSent: 6,
+  packetsLost: 7,
+  packetsReceived: 8,
+  bytesSent: 9,
+  bytesReceived: 10,
+  datagramsExpiredOutgoing: 11,
+  datagramsLostOutgoing: 12,
+  length: 13 // minimal length of the array
+})
+
+/**
+ * Maps the congestionControl option, a value of the spec or an algorithm,
+ * to the value of the spec
+ * @param {string | undefined} congestionControl
+ * @returns {WebTransportCongestionControl}
+ */
+function specCongestionControl(congestionControl) {
+  switch (congestionControl) {
+    case 'low-latency':
+    case 'bbrv2':
+    case 'bbr':
+      return 'low-latency'
+    case 'throughput':
+    case 'cubic':
+    case 'reno':
+      return 'throughput'
+    default:
+      return 'default'
+  }
+}
+
 /**
  * @implements {WebTransportSessionEventHandler}
  * @implements {WebTransportSession}
@@ -57,14 +111,27 @@ export class HttpWTSession {
    * @param {Object | undefined} [args.userData= undefined]
    * @param {string | undefined} [args.peerAddress= undefined]
    * @param {DatagramsReadableMode} [args.datagramsReadableMode]
+   * @param {{session?: number, stream?: number}} [args.sendHighWaterMark]
+   * @param {{enabled?: boolean, maxMessageSize?: number}} [args.streamMessageMode]
+   * @param {{size?: number}} [args.datagramRing]
+   * @param {{maxQueue?: number, maxAge?: number, dropPolicy?: string}} [args.datagramQueue]
+   * @param {string} [args.congestionControl] as requested by the options
    */
   constructor(args) {
+    this.sendHighWaterMark = args.sendHighWaterMark
+    this.streamMessageMode = args.streamMessageMode
+    this.datagramRing = args.datagramRing
+    this.datagramQueue = { ...args.datagramQueue }
     if (args.object) {
       this.objint = args.object
       this.objint.jsobj = this
       if (this.objint.sendInitialParameters) {
         this.objint.sendInitialParameters()
       }
+      this.applySendHighWaterMark()
+      this.applyStreamMessageMode()
+      this.applyDatagramRing()
+      this.applyDatagramQueue()
     }
     this.parentobj = args.parentobj
     /** @type {import('./types').WebTransportSessionState} */
@@ -92,7 +159,7 @@ export class HttpWTSession {
     /** @type {WebTransportReliabilityMode} */
     this.reliability = 'pending'
     /** @type {WebTransportCongestionControl} */
-    this.congestionControl = 'default'
+    this.congestionControl = specCongestionControl(args.congestionControl)
     /** @type {Promise<WebTransportCloseInfo>} */
     this.closed = new Promise((resolve, reject) => {
       this.closedResolve = resolve
@@ -183,7 +250,8 @@ export class HttpWTSession {
               if (
                 code !== 'success' &&
                 code !== 'blocked' &&
-                code !== 'tooBig'
+                code !== 'tooBig' &&
+                code !== 'dropped'
               ) {
                 throw new WebTransportError(code + ':' + message)
               }
@@ -234,6 +302,26 @@ export class HttpWTSession {
         // @ts-ignore
         return this._getMaxDatagramSize()
       },
+      /**
+       * non standard, sends many datagrams in one call, either an array of
+       * chunks or one packed chunk and the lengths of the datagrams inside
+       * @param {Uint8Array[]|Uint8Array} chunks
+       * @param {Uint32Array|number[]} [lengths]
+       * @return {Uint8Array} a DatagramStatus per datagram
+       */
+      writeDatagrams: (chunks, lengths) => {
+        if (this.state === 'closed') throw new Error('Session is closed')
+        if (this.objint == null) {
+          throw new Error('this.objint is not set')
+        }
+        if (!Array.isArray(chunks)) {
+          if (!(chunks instanceof Uint8Array) || !lengths)
+            throw new TypeError('writeDatagrams expects chunks or lengths')
+          if (!(lengths instanceof Uint32Array))
+            lengths = Uint32Array.from(lengths)
+        }
+        return this.objint.writeDatagrams(chunks, lengths)
+      },
       // @ts-ignore
       _getMaxDatagramSize: () => {
         if (this.objint) {
@@ -242,6 +330,42 @@ export class HttpWTSession {
         return this._lastGetMaxDatagramSize
       }
     }
+    Object.defineProperties(this.datagrams, {
+      outgoingMaxAge: {
+        get: () => this.datagramQueue.maxAge || null,
+        /**
+         * @param {number|null} value milliseconds, null for no limit
+         */
+        set: (value) => {
+          this.datagramQueue.maxAge = value ?? 0
+          this.objint?.setDatagramQueue?.(this.datagramQueue)
+        }
+      },
+      outgoingHighWaterMark: {
+        get: () => this.datagramQueue.maxQueue || 0,
+        /**
+         * @param {number} value datagrams, 0 for no limit
+         */
+        set: (value) => {
+          if (value < 0) throw new RangeError('maxQueue must not be negative')
+          this.datagramQueue.maxQueue = value
+          this.objint?.setDatagramQueue?.(this.datagramQueue)
+        }
+      },
+      // non standard
+      outgoingDropPolicy: {
+        get: () => this.datagramQueue.dropPolicy ?? 'oldest',
+        /**
+         * @param {'oldest'|'newest'} value
+         */
+        set: (value) => {
+          if (value !== 'oldest' && value !== 'newest')
+            throw new TypeError('outgoingDropPolicy must be oldest or newest')
+          this.datagramQueue.dropPolicy = value
+          this.objint?.setDatagramQueue?.(this.datagramQueue)
+        }
+      }
+    })
 
     /** @type {Array<(stream: WebTransportBidirectionalStream) => void>} */
     this.resolveBiDi = []
@@ -294,9 +418,51 @@ export class HttpWTSession {
       if (this.objint.sendInitialParameters) {
         this.objint.sendInitialParameters()
       }
+      this.applySendHighWaterMark()
+      this.applyStreamMessageMode()
+      this.applyDatagramRing()
+      this.applyDatagramQueue()
+      this.applySendGroupWeights()
+    }
+  }
+
+  applySendHighWaterMark() {
+    // only transports with a native send queue support it
+    if (this.sendHighWaterMark && this.objint?.setSendHighWaterMark) {
+      this.objint.setSendHighWaterMark(this.sendHighWaterMark)
+    }
+  }
+
+  applyStreamMessageMode() {
+    // message framing is only done by the http/3 transport
+    if (this.streamMessageMode?.enabled && this.objint?.setStreamMessageMode) {
+      this.objint.setStreamMessageMode(this.streamMessageMode)
     }
   }
 
+  applyDatagramRing() {
+    // only the http/3 transport collects datagrams in a ring
+    const size = this.datagramRing?.size
+    if (!size || !this.objint?.setDatagramRing) return
+    // not shared with workers, the native side overwrites it without
+    // knowing, which datagrams were read
+    this.datagramRing_ = new Uint8Array(size)
+    this.objint.setDatagramRing(this.datagramRing_)
+  }
+
+  applyDatagramQueue() {
+    const { maxQueue, maxAge, dropPolicy } = this.datagramQueue
+    if (!maxQueue && !maxAge && !dropPolicy) return // unlimited, as before
+    this.objint?.setDatagramQueue?.(this.datagramQueue)
+  }
+
+  applySendGroupWeights() {
+    this._sendGroupIndex.forEach((sendGroup, sendGroupId) => {
+      if (sendGroup.weight !== 1)
+        this.objint?.setSendGroupWeight?.(sendGroupId, sendGroup.weight)
+    })
+  }
+
   get protocol() {
     return this._selectedProtocol
   }
@@ -313,6 +479,20 @@ export class HttpWTSession {
     return prom
   }
 
+  /**
+   * Writes the counters synchronously at the offsets of SessionStatsField,
+   * without allocating, for polling at high rates
+   * @param {Float64Array | BigUint64Array} stats
+   * @returns {boolean} false, if the stats are unavailable
+   */
+  fillStats(stats) {
+    if (this.objint == null) {
+      throw new Error('this.objint not set')
+    }
+    if (!this.objint.fillStats) return false // http/2
+    return this.objint.fillStats(stats)
+  }
+
   /**
    * @param {SessionStatsEvent} evt
    */
@@ -444,7 +624,9 @@ export class HttpWTSession {
     const notblocked = this.objint.orderBidiStream({
       sendGroup: opts?.sendGroup || null, // maybe replace, when implemented
       sendOrder: opts?.sendOrder || 0,
-      waitUntilAvailable: opts?.waitUntilAvailable || false
+      waitUntilAvailable: opts?.waitUntilAvailable || false,
+      messageMode: opts?.messageMode, // undefined for the session default
+      deadline: opts?.deadline
     })
     if (!notblocked) {
       const rej = this.rejectBiDi.pop()
@@ -476,7 +658,9 @@ export class HttpWTSession {
     const notblocked = this.objint.orderUnidiStream({
       sendGroup: opts?.sendGroup || null, // maybe replace, when implemented
       sendOrder: opts?.sendOrder || 0,
-      waitUntilAvailable: opts?.waitUntilAvailable || false
+      waitUntilAvailable: opts?.waitUntilAvailable || false,
+      messageMode: opts?.messageMode, // undefined for the session default
+      deadline: opts?.deadline
     })
     if (!notblocked) {
       const rej = this.rejectUniDi.pop()
@@ -510,9 +694,21 @@ export class HttpWTSession {
   createSendGroup() {
     if (this.state === 'closed' || this.state === 'failed')
       throw new Error('InvalidState')
+    const session = this
     const _sendGroupId = this._sendGroupNum++
+    let weight = 1
     const sendGroup = {
       _sendGroupId,
+      // non standard, share of the send rate relative to the other groups
+      get weight() {
+        return weight
+      },
+      set weight(value) {
+        if (typeof value !== 'number' || !(value > 0))
+          throw new TypeError('weight must be a positive number')
+        weight = value
+        session.objint?.setSendGroupWeight?.(_sendGroupId, value)
+      },
       getStats: async () => {
         // TODO implement
         return {
@@ -638,7 +834,8 @@ export class HttpWTSession {
       bidirectional: args.bidirectional,
       incoming: args.incoming,
       sendGroup: this._sendGroupIndex.get(args.sendGroupId || 0n),
-      sendOrder: args.sendOrder
+      sendOrder: args.sendOrder,
+      messageMode: args.messageMode
     })
     this.addStreamObj(strobj)
     if (args.incoming) {
@@ -722,6 +919,29 @@ export class HttpWTSession {
     }
   }
 
+  /**
+   * @param {DatagramsReceivedEvent} args
+   */
+  onDatagramsReceived({ index, count }) {
+    const ring = this.datagramRing_
+    if (!ring) return
+    // @ts-ignore
+    const handler = this.datagrams.ondatagrams
+    if (typeof handler === 'function') {
+      if (this.state === 'closed' || this.state === 'failed') return
+      // the data is only valid during the call
+      handler(ring, index, count)
+      return
+    }
+    for (let i = 0; i < count; i++) {
+      const offset = index[2 * i]
+      // copied by onDatagramReceived
+      this.onDatagramReceived({
+        datagram: ring.subarray(offset, offset + index[2 * i + 1])
+      })
+    }
+  }
+
   /**
    * @param {GoawayReceivedEvent} args
    */
@@ -6,12 +6,46 @@ import { canByteStream } from './features.js'
 const pid = typeof process !== 'undefined' ? process.pid : 0
 const log = logger(`webtransport:http3wtstream(${pid})`)
 
+// offsets must match StreamStatsField in http3wtstreamvisitor.h
+const STATS_BYTES_WRITTEN = 0
+const STATS_BYTES_SENT = 1
+const STATS_BYTES_ACKNOWLEDGED = 2
+const STATS_BYTES_RECEIVED = 3
+const STATS_BYTES_READ = 4
+// shared by all streams, filled synchronously by the native side
+const nativeStreamStats = new BigUint64Array(5)
+
+/**
+ * maps readables and writables to their HttpWTStream for spliceStream
+ * @type {WeakMap<object, HttpWTStream>}
+ */
+const streamObjs = new WeakMap()
+
+/**
+ * takes the place of the native object, after it was recycled
+ * @type {any}
+ */
+const goneNativeStream = {
+  startReading: () => {},
+  drainReads: () => {},
+  stopReading: () => {},
+  stopSending: () => {},
+  resetStream: () => {},
+  writeChunk: () => true, // the chunk is dropped
+  streamFinal: () => {},
+  updateSendOrderAndGroup: () => {},
+  getDeadline: () => null
+}
+
 /**
  * WebTransport stream events
  * @typedef {import('./types').WebTransportStreamEventHandler} WebTransportStreamEventHandler
  * @typedef {import('./types').StreamRecvSignalEvent} StreamRecvSignalEvent
  * @typedef {import('./types').StreamReadEvent} StreamReadEvent
  * @typedef {import('./types').StreamWriteEvent} StreamWriteEvent
+ * @typedef {import('./types').StreamMessagesEvent} StreamMessagesEvent
+ * @typedef {import('./types').StreamDeadlineEvent} StreamDeadlineEvent
+ * @typedef {import('./types').StreamFileErrorEvent} StreamFileErrorEvent
  * @typedef {import('./types').StreamNetworkFinishEvent} StreamNetworkFinishEvent
  *
  * @typedef {import('./types').NativeHttpWTStream} NativeHttpWTStream
@@ -37,6 +71,7 @@ export class HttpWTStream {
    * @param {boolean} args.incoming
    * @param {WebTransportSendGroup|undefined} args.sendGroup
    * @param {number} args.sendOrder
+   * @param {boolean} [args.messageMode] every chunk is one length prefixed message
    */
   constructor(args) {
     this.objint = args.object
@@ -46,6 +81,9 @@ export class HttpWTStream {
     this.bidirectional = args.bidirectional
     this.incoming = args.incoming
     this.closed = false
+    this.messageMode = !!args.messageMode
+    // messages are delivered as chunks, which byte streams can not represent
+    this.readableBytes = canByteStream && !this.messageMode
 
     this._sendGroup = args.sendGroup
     this._sendOrder = args.sendOrder
@@ -79,7 +117,7 @@ export class HttpWTStream {
           // eslint-disable-next-line no-unused-vars
           /** @type {import("stream/web").ReadableByteStreamController} */ controller
         ) => {
-          if (this.readableclosed) {
+          if (this.readableclosed || this.splicing) {
             return Promise.resolve()
           }
           // eslint-disable-next-line no-unused-vars
@@ -112,7 +150,7 @@ export class HttpWTStream {
         type: 'bytes'
       }
 
-      if (!canByteStream) {
+      if (!this.readableBytes) {
         // @ts-ignore
         delete readableopts.type
       }
@@ -122,11 +160,19 @@ export class HttpWTStream {
         // @ts-ignore
         readableopts
       )
+      streamObjs.set(this.readable, this)
       this.readable.getStats = () => {
+        if (!this.fillNativeStats()) {
+          return Promise.resolve({
+            timestamp: 0,
+            bytesReceived: 0n,
+            bytesRead: 0n
+          })
+        }
         return Promise.resolve({
-          timestamp: 0,
-          bytesReceived: 0n,
-          bytesRead: 0n
+          timestamp: Date.now(),
+          bytesReceived: nativeStreamStats[STATS_BYTES_RECEIVED],
+          bytesRead: nativeStreamStats[STATS_BYTES_READ]
         })
       }
       // @ts-ignore
@@ -150,16 +196,18 @@ export class HttpWTStream {
               wchunk = new Uint8Array(wchunk)
             }
             if (wchunk instanceof Uint8Array) {
-              if (wchunk.byteLength === 0) {
+              if (wchunk.byteLength === 0 && !this.messageMode) {
                 // or should we throw an error ?, Ask the W3C people!
                 return
               }
+              // true means, we are below the native high water mark
+              if (this.objint.writeChunk(wchunk)) return
+              /** @type {Promise<void>} */
               // eslint-disable-next-line no-unused-vars
-              this.pendingoperation = new Promise((resolve, reject) => {
-                this.pendingres = resolve
+              const promise = new Promise((resolve, reject) => {
+                this.pendingWrites.push(resolve)
               })
-              this.objint.writeChunk(wchunk)
-              return this.pendingoperation
+              return promise
             } else {
               log.trace('chunk info:', chunk)
               throw new Error(
@@ -213,11 +261,19 @@ export class HttpWTStream {
         { highWaterMark: 4 }
       )
       this.writable.getStats = () => {
+        if (!this.fillNativeStats()) {
+          return Promise.resolve({
+            timestamp: 0,
+            bytesWritten: 0,
+            bytesSent: 0,
+            bytesAcknowledged: 0
+          })
+        }
         return Promise.resolve({
-          timestamp: 0,
-          bytesWritten: 0,
-          bytesSent: 0,
-          bytesAcknowledged: 0
+          timestamp: Date.now(),
+          bytesWritten: Number(nativeStreamStats[STATS_BYTES_WRITTEN]),
+          bytesSent: Number(nativeStreamStats[STATS_BYTES_SENT]),
+          bytesAcknowledged: Number(nativeStreamStats[STATS_BYTES_ACKNOWLEDGED])
         })
       }
       Object.defineProperties(this.writable, {
@@ -248,22 +304,55 @@ export class HttpWTStream {
               this.updateSendOrderAndGroup()
             }
           }
+        },
+        // non standard, milliseconds until the stream is reset, null clears it
+        deadline: {
+          get: () => {
+            return this.objint.getDeadline?.() ?? null
+          },
+          /**
+           * @param {number|null} value
+           */
+          set: (value) => {
+            this.updateSendOrderAndGroup(value ?? null)
+          }
         }
       })
+      streamObjs.set(this.writable, this)
       // @ts-ignore
       this.parentobj.addSendStream(this.writable, this.writableController)
     }
+    this.splicing = false
 
     /** @type {(() => void) | null} */
     this.cancelres = null
     /** @type {(() => void) | null} */
     this.pendingres = null
+    /** @type {((error: Error) => void) | null} */
+    this.pendingFileReject = null
+    /** @type {Array<() => void>} */
+    this.pendingWrites = []
     /** @type {(() => void) | null} */
     this.abortres = null
+    /** @type {BigUint64Array | null} */
+    this.finalStats = null
 
     this.finaldrain_ = false
   }
 
+  /**
+   * @returns {boolean} true, if nativeStreamStats holds the counters of this stream
+   */
+  fillNativeStats() {
+    if (this.finalStats) {
+      nativeStreamStats.set(this.finalStats)
+      return true
+    }
+    if (!this.objint.getStats) return false
+    this.objint.getStats(nativeStreamStats)
+    return true
+  }
+
   /**
    * @param {{byteSize: number}} args
    * @returns {ReadBuffer}
@@ -334,15 +423,103 @@ export class HttpWTStream {
     return retObj
   }
 
-  updateSendOrderAndGroup() {
+  /**
+   * @param {StreamMessagesEvent} args
+   * @returns {boolean} false, if the native side should pause reading
+   */
+  onStreamMessages({ messages, fin, error }) {
+    if (!this.readableclosed) {
+      for (const message of messages) this.readableController.enqueue(message)
+    }
+    if (this.pendingoperationRead) {
+      const res = this.pendingresRead
+      this.pendingoperationRead = null
+      this.pendingresRead = null
+      if (res) res()
+    }
+    if (error) {
+      const parentstate = this.parentobj.state
+      if (parentstate !== 'closed' && parentstate !== 'failed') {
+        this.parentobj.removeReceiveStream(
+          this.readable,
+          this.readableController
+        )
+      }
+      if (!this.readableclosed) {
+        this.readableclosed = true
+        this.readableController.error(new WebTransportError(error))
+      }
+      return false
+    }
+    if (fin) {
+      this.commitReadBuffer({ fin })
+      return false
+    }
+    const desiredSize = this.readableController.desiredSize
+    return this.finaldrain_ || desiredSize == null || desiredSize > 0
+  }
+
+  /**
+   * @param {number|null} [deadline] left unchanged, if undefined
+   */
+  updateSendOrderAndGroup(deadline) {
     this.objint.updateSendOrderAndGroup({
       sendOrder: this._sendOrder,
       // 0n is reserved for no sendgroup
       // @ts-ignore _sendGroupId is internal, FIXME convert to symbol
-      sendGroupId: this._sendGroup?._sendGroupId || 0n
+      sendGroupId: this._sendGroup?._sendGroupId || 0n,
+      deadline
     })
   }
 
+  /**
+   * @param {StreamDeadlineEvent} args
+   */
+  onStreamDeadline(args) {
+    log('stream deadline expired, dropped chunks:', args.dropped)
+    if (this.writable) {
+      const parentstate = this.parentobj.state
+      if (parentstate !== 'closed' && parentstate !== 'failed') {
+        this.parentobj.removeSendStream(this.writable, this.writableController)
+      }
+      if (!this.writableclosed) {
+        this.writableclosed = true
+        this.writableController.error(
+          new WebTransportError('Stream deadline expired')
+        )
+      }
+    }
+    if (this.pendingoperation) {
+      const res = this.pendingres
+      this.pendingoperation = null
+      this.pendingres = null
+      this.pendingFileReject = null
+      if (res != null) res()
+    }
+    this.resolvePendingWrites(this.pendingWrites.length)
+  }
+
+  /**
+   * the file of sendFile could not be read or was truncated, the native
+   * side reset the stream instead of sending the fin
+   * @param {StreamFileErrorEvent} args
+   */
+  onStreamFileError({ errno, message }) {
+    log('sendFile failed:', message)
+    const error = Object.assign(new Error(`sendFile failed: ${message}`), {
+      errno
+    })
+    if (this.writable && !this.writableclosed) {
+      this.writableclosed = true
+      this.writableController.error(error)
+    }
+    const reject = this.pendingFileReject
+    this.pendingoperation = null
+    this.pendingres = null
+    this.pendingFileReject = null
+    if (reject != null) reject(error)
+  }
+
   /**
    * @param {import('./types').StreamRecvSignalEvent} args
    * @returns {void}
@@ -406,6 +583,7 @@ export class HttpWTStream {
         res()
       }
     }
+    this.resolvePendingWrites(this.pendingWrites.length)
     if (this.pendingoperationRead) {
       const res = this.pendingresRead
       this.pendingoperationRead = null
@@ -416,24 +594,71 @@ export class HttpWTStream {
     }
   }
 
+  /**
+   * @param {string | number} file path or file descriptor
+   * @param {number} [offset]
+   * @param {number} [length]
+   * @returns {Promise<void>}
+   */
+  sendFile(file, offset, length) {
+    // the fin may be sent synchronously
+    /** @type {Promise<void>} */
+    const promise = new Promise((resolve, reject) => {
+      this.pendingres = resolve
+      this.pendingFileReject = reject
+    })
+    this.pendingoperation = promise
+    try {
+      this.objint.sendFile(file, offset, length)
+    } catch (error) {
+      this.pendingoperation = null
+      this.pendingres = null
+      this.pendingFileReject = null
+      throw error
+    }
+    this.writableclosed = true
+    this.parentobj.removeSendStream(this.writable, this.writableController)
+    return promise
+  }
+
+  /**
+   * @returns {boolean} true, if chunks are queued inside the readable
+   */
+  readableQueued() {
+    const desiredSize = this.readableController?.desiredSize
+    // default high water marks, 0 for byte streams and 1 otherwise
+    return desiredSize != null && desiredSize < (this.readableBytes ? 0 : 1)
+  }
+
+  onStreamGone() {
+    // the native object will be reused for another stream
+    if (this.fillNativeStats()) this.finalStats = nativeStreamStats.slice()
+    this.objint = goneNativeStream
+  }
+
   finalDrain() {
     this.finaldrain_ = true
     this.objint.drainReads()
   }
 
+  /**
+   * @param {number} count
+   */
+  resolvePendingWrites(count) {
+    const resolvers = this.pendingWrites.splice(0, count)
+    for (const res of resolvers) res()
+  }
+
   /**
    * @param {StreamWriteEvent} args
    */
-  // eslint-disable-next-line no-unused-vars
-  onStreamWrite(args) {
-    // we ignore success
-    if (this.pendingoperation) {
-      const res = this.pendingres
-      this.pendingoperation = null
-      this.pendingres = null
-      if (res != null) {
-        res()
-      }
+  onStreamWrite({ count = 1, ready }) {
+    // we ignore success, a batch may complete several chunks
+    if (ready === undefined) {
+      // no native high water mark, every chunk is completed on its own
+      this.resolvePendingWrites(count)
+    } else if (ready) {
+      this.resolvePendingWrites(this.pendingWrites.length)
     }
   }
 
@@ -478,6 +703,7 @@ export class HttpWTStream {
           const res = this.pendingres
           this.pendingoperation = null
           this.pendingres = null
+          this.pendingFileReject = null
           if (res != null) {
             res()
           }
@@ -489,3 +715,105 @@ export class HttpWTStream {
     // we could differentiate....
   }
 }
+
+/**
+ * @param {object} webstream readable or writable
+ * @returns {NativeHttpWTStream | undefined} the native http/3 stream, if it is still present
+ */
+export function nativeStreamOf(webstream) {
+  const objint = streamObjs.get(webstream)?.objint
+  if (!objint || objint === goneNativeStream || !objint.spliceTo) {
+    return undefined
+  }
+  return objint
+}
+
+/**
+ * Relays all data of a receive stream to a send stream inside the native
+ * http/3 transport, the relayed data does not enter js.
+ * Backpressure, fin and resets are propagated between both streams.
+ * Both streams are locked during the relay.
+ * @param {WebTransportReceiveStream} readable
+ * @param {WebTransportSendStream} writable
+ * @returns {Promise<void>} resolves after the fin was relayed
+ */
+export async function spliceStream(readable, writable) {
+  const source = streamObjs.get(readable)
+  const target = streamObjs.get(writable)
+  if (
+    source?.objint === goneNativeStream ||
+    target?.objint === goneNativeStream
+  ) {
+    throw new DOMException('The stream is gone', 'InvalidStateError')
+  }
+  if (!source || !target || !source.objint.spliceTo) {
+    throw new TypeError(
+      'spliceStream requires streams of the http/3 transport'
+    )
+  }
+  if (source.messageMode || target.messageMode) {
+    throw new TypeError('spliceStream does not support message mode')
+  }
+  const reader = readable.getReader()
+  const writer = writable.getWriter()
+  try {
+    // chunks already passed to js are forwarded first to keep the order
+    source.splicing = true
+    source.objint.stopReading()
+    while (source.readableQueued()) {
+      const { value, done } = await reader.read()
+      if (done) break
+      await writer.write(value)
+    }
+    if (!source.readableclosed) {
+      if (!source.objint.spliceTo(target.objint)) {
+        throw new Error(
+          'spliceStream failed, streams are gone or already spliced'
+        )
+      }
+      await Promise.race([reader.closed, writer.closed])
+    }
+    await writer.close()
+  } catch (error) {
+    writer.abort(error).catch(() => {})
+    reader.cancel(error).catch(() => {})
+    throw error
+  } finally {
+    reader.releaseLock()
+    writer.releaseLock()
+  }
+}
+
+/**
+ * Sends a region of a file over a send stream and closes the stream
+ * afterwards. The http/3 transport reads the file natively,
+ * the data does not enter js. If the file can not be read or is truncated,
+ * the stream is reset and the promise rejects with the errno of the read.
+ * @param {WebTransportSendStream} writable
+ * @param {string | number} file path or file descriptor
+ * @param {{offset?: number, length?: number}} [args] length defaults to the rest of the file
+ * @returns {Promise<void>} resolves after the fin was sent
+ */
+export async function sendFile(writable, file, args) {
+  const stream = streamObjs.get(writable)
+  if (stream?.objint === goneNativeStream) {
+    throw new DOMException('The stream is gone', 'InvalidStateError')
+  }
+  if (!stream || !stream.objint.sendFile) {
+    throw new TypeError(
+      'sendFile requires a send stream of the http/3 transport'
+    )
+  }
+  if (stream.messageMode) {
+    throw new TypeError('sendFile does not support message mode')
+  }
+  const writer = writable.getWriter()
+  try {
+    // a write is only passed on, after all preceding writes
+    await writer.write(new Uint8Array(0))
+    await stream.sendFile(file, args?.offset, args?.length)
+    await writer.close()
+  } finally {
+    writer.releaseLock()
+  }
+}
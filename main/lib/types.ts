@@ -3,6 +3,7 @@ import type {
   WebTransportHash,
   WebTransportOptions,
   WebTransportSendStreamOptions,
+  WebTransportCongestionControl,
   DatagramsReadableMode
 } from './dom'
 import type { IncomingHttpHeaders, Http2Stream, ServerHttp2Stream } from 'http2'
@@ -17,13 +18,20 @@ import { SocketOptions } from 'dgram'
 export interface NativeHttpWTSession {
   jsobj: WebTransportSessionEventHandler
   sendInitialParameters?: () => void
-  writeDatagram: (chunk: Uint8Array) => { code: 'success' | 'blocked' | 'internalError' | 'tooBig', message?: string}
+  writeDatagram: (chunk: Uint8Array) => { code: 'success' | 'blocked' | 'internalError' | 'tooBig' | 'dropped', message?: string}
+  writeDatagrams: (chunks: Uint8Array[] | Uint8Array, lengths?: Uint32Array) => Uint8Array
   orderUnidiStream: (opts: WebTransportSendStreamOptions) => boolean
   orderBidiStream: (opts: WebTransportSendStreamOptions)  => boolean
   orderSessionStats: () => void
   orderDatagramStats: () => void
+  fillStats?: (stats: Float64Array | BigUint64Array) => boolean
   notifySessionDraining: () => void
   getMaxDatagramSize: () => number
+  setSendHighWaterMark?: (marks: { session?: number, stream?: number }) => void
+  setStreamMessageMode?: (mode: { enabled?: boolean, maxMessageSize?: number }) => void
+  setSendGroupWeight?: (sendGroupId: bigint, weight: number) => void
+  setDatagramRing?: (ring?: Uint8Array) => void
+  setDatagramQueue?: (queue: { maxQueue?: number, maxAge?: number, dropPolicy?: string }) => void
   close: (arg: { code: number; reason: string }) => void
 }
 
@@ -39,12 +47,17 @@ export interface NativeHttpWTStream {
   stopReading: () => void
   stopSending: (code: number) => void
   resetStream: (code: number) => void
-  writeChunk: (buf: Uint8Array) => void
+  writeChunk: (buf: Uint8Array) => boolean | void
   streamFinal: () => void
   updateSendOrderAndGroup: (args :{
     sendOrder: number,
-    sendGroupId: bigint
+    sendGroupId: bigint,
+    deadline?: number | null // milliseconds from now, null clears it
   }) => void
+  getDeadline?: () => number | null // milliseconds until the deadline
+  getStats?: (stats: BigUint64Array) => void
+  spliceTo?: (target: NativeHttpWTStream) => boolean
+  sendFile?: (file: string | number, offset?: number, length?: number) => void
 }
 
 export interface NativeServerOptions {
@@ -55,6 +68,7 @@ export interface NativeServerOptions {
   certhttp2?: string // if http2 has a different cert
   privKey: string
   privKeyhttp2?: string // if http2 has a different cert
+  ticketKeys?: Uint8Array[]
   initialBidirectionalSendStreams?: number
   initialBidirectionalReceiveStreams?: number
   initialUnidirectionalSendStreams?: number
@@ -144,6 +158,25 @@ export interface StreamReadEvent {
 
 export interface StreamWriteEvent {
   success?: boolean
+  count?: number // number of completed chunks, defaults to 1
+  byteLength?: number
+  ready?: boolean // below the native high water marks, missing if there are none
+}
+
+export interface StreamMessagesEvent {
+  messages: Uint8Array[] // views into one buffer per batch
+  fin: boolean
+  error?: string // oversized or truncated message, the stream is not read any further
+}
+
+export interface StreamDeadlineEvent {
+  dropped: number // queued chunks, that were not sent
+  droppedBytes: number
+}
+
+export interface StreamFileErrorEvent {
+  errno: number // of the failed read, 0 if the file was truncated
+  message: string
 }
 
 export interface StreamResetEvent {}
@@ -156,6 +189,10 @@ export interface WebTransportStreamEventHandler {
   onStreamRecvSignal: (evt: StreamRecvSignalEvent) => void
   onStreamWrite: (evt: StreamWriteEvent) => void
   onStreamNetworkFinish: (evt: StreamNetworkFinishEvent) => void
+  onStreamGone?: () => void
+  onStreamMessages?: (evt: StreamMessagesEvent) => boolean
+  onStreamDeadline?: (evt: StreamDeadlineEvent) => void
+  onStreamFileError?: (evt: StreamFileErrorEvent) => void
 }
 
 export interface SessionReadyEvent {
@@ -190,6 +227,12 @@ export interface DatagramReceivedEvent {
   datagram: Uint8Array
 }
 
+// batched receive into the ring set with setDatagramRing
+export interface DatagramsReceivedEvent {
+  index: Uint32Array // offset and length per datagram
+  count: number
+}
+
 export interface GoawayReceivedEvent {}
 
 export interface NewStreamEvent {
@@ -198,12 +241,14 @@ export interface NewStreamEvent {
   incoming: boolean
   sendGroupId?: bigint;
   sendOrder: number;
+  messageMode?: boolean // length prefixed message framing
 }
 
 export interface WebTransportSessionEventHandler {
   onReady: (evt: SessionReadyEvent) => void
   onClose: (evt: SessionCloseEvent) => void
   onDatagramReceived: (evt: DatagramReceivedEvent) => void
+  onDatagramsReceived?: (evt: DatagramsReceivedEvent) => void
   onGoAwayReceived: (evt: GoawayReceivedEvent) => void
   onSessionStats: (evt: SessionStatsEvent) => void
   onDatagramStats: (evt: DatagramStatsEvent) => void
@@ -307,6 +352,13 @@ export type WebTransportServerReliability =
   | 'reliableOnly'
   | 'both'
 
+export interface CertCompressionStats {
+  compressed: number // certificate messages compressed
+  cached: number // certificate messages taken from the cache
+  uncompressedBytes: number
+  compressedBytes: number
+}
+
 // see HttpServerJS C++ type
 export interface HttpServerInit extends HttpWebTransportInit {
   port: string | number
@@ -323,6 +375,21 @@ export interface HttpServerInit extends HttpWebTransportInit {
   sessionFlowControlWindowSizeLimit?: number
   reliability?: WebTransportServerReliability
   defaultDatagramsReadableMode: DatagramsReadableMode
+  sessionSendHighWaterMark?: number
+  streamSendHighWaterMark?: number
+  streamMessageMode?: boolean
+  maxMessageSize?: number
+  datagramRingSize?: number
+  datagramMaxQueue?: number
+  datagramMaxAge?: number
+  datagramDropPolicy?: 'oldest' | 'newest'
+  congestionControl?: WebTransportCongestionControl | 'bbrv2' | 'bbr' | 'cubic' | 'reno'
+  congestionControlOptions?: string[] // quic connection option tags
+  ticketKeys?: Uint8Array[] // 48 bytes each (16 name, 32 AES-256-GCM), the first encrypts new tickets, http/2 uses only the first
+  asyncSigning?: boolean // sign handshakes on node's thread pool
+  certCompression?: boolean // zlib compression of the certificate message
+  retry?: 'never' | 'load' | 'always' // stateless Retry for new connections
+  retryThreshold?: number // handshakes in progress, that trigger 'load'
   quicheNodeSocketOptions?: SocketOptions // options only for quiche and node
 }
 
@@ -337,6 +404,16 @@ export interface HttpClientInit extends HttpWebTransportInit {
   initialSessionFlowControlWindow?: number
   sessionShouldAutoTuneReceiveWindow?: boolean
   sessionFlowControlWindowSizeLimit?: number
+  sessionSendHighWaterMark?: number
+  streamSendHighWaterMark?: number
+  streamMessageMode?: boolean
+  maxMessageSize?: number
+  datagramRingSize?: number
+  datagramMaxQueue?: number
+  datagramMaxAge?: number
+  datagramDropPolicy?: 'oldest' | 'newest'
+  earlyData?: boolean // send the session request as 0-RTT data on resumption
+  sessionCacheFile?: string // persists the session tickets, one process per file
   createReliableClient?: (cklient: HttpClient) => any
   createUnreliableClient?: (client: HttpClient) => any
 }
@@ -346,6 +423,26 @@ export interface TransportHttp3Quiche {
 
   Http3WebTransportServer: new (init: HttpServerInit) => any
   Http3WebTransportServerSocket: new (init: HttpServerInit) => any
+  Http3WTBroadcastGroup: new (init?: BroadcastGroupInit) => NativeBroadcastGroup
+  Http3WTDatagramBroadcastGroup: new () => NativeDatagramBroadcastGroup
+}
+
+export interface BroadcastGroupInit {
+  policy?: 'drop' | 'buffer' // for streams, that can not take the payload at once
+}
+
+export interface NativeBroadcastGroup {
+  add: (stream: NativeHttpWTStream) => boolean
+  remove: (stream: NativeHttpWTStream) => void
+  write: (chunk: Uint8Array) => { written: number, dropped: number }
+  getSize: () => number
+}
+
+export interface NativeDatagramBroadcastGroup {
+  add: (session: NativeHttpWTSession | undefined) => boolean
+  remove: (session: NativeHttpWTSession | undefined) => void
+  write: (chunk: Uint8Array) => { sent: number, blocked: number, tooBig: number, dropped: number, failed: number }
+  getSize: () => number
 }
 
 export interface Logger {
@@ -143,6 +143,31 @@ export class WebTransport extends WebTransportBase {
     const sessionint = new HttpWTSession({
       /* object: args.session, */
       datagramsReadableMode: args.datagramsReadableMode,
+      sendHighWaterMark: {
+        // @ts-ignore
+        session: args.sessionSendHighWaterMark,
+        // @ts-ignore
+        stream: args.streamSendHighWaterMark
+      },
+      streamMessageMode: {
+        // @ts-ignore
+        enabled: args.streamMessageMode,
+        // @ts-ignore
+        maxMessageSize: args.maxMessageSize
+      },
+      datagramRing: {
+        // @ts-ignore
+        size: args.datagramRingSize
+      },
+      datagramQueue: {
+        // @ts-ignore
+        maxQueue: args.datagramMaxQueue,
+        // @ts-ignore
+        maxAge: args.datagramMaxAge,
+        // @ts-ignore
+        dropPolicy: args.datagramDropPolicy
+      },
+      congestionControl: args.congestionControl,
       parentobj: client
     })
     return { client, sessionint }
@@ -109,6 +109,20 @@ export class WebTransportBase {
     return session.getStats()
   }
 
+  /**
+   * @param {Float64Array | BigUint64Array} stats
+   * @returns {boolean}
+   */
+  fillStats(stats) {
+    const session = this.sessionint
+
+    if (!session) {
+      // should never happen as session is only removed when this instance is garbage collected
+      throw new Error('Http3WTSession was undefined')
+    }
+    return session.fillStats(stats)
+  }
+
   /**
    * @param {WebTransportCloseInfo} [closeinfo]
    */
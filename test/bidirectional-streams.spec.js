@@ -7,6 +7,12 @@ import { writeStream } from './fixtures/write-stream.js'
 import { readCertHash } from './fixtures/read-cert-hash.js'
 import WebTransport from './fixtures/webtransport.js'
 import { quicheLoaded } from './fixtures/quiche.js'
+import {
+  BroadcastGroup,
+  sendFile,
+  spliceStream,
+  writeTempFile
+} from './fixtures/native.js'
 import * as ui8 from 'uint8arrays'
 import {
   KNOWN_BYTES,
@@ -81,6 +87,72 @@ describe('bidirectional streams', function () {
     )
   })
 
+  if (browser == null && process.env.USE_HTTP2 !== 'true') {
+    it('reports stream stats for an outgoing bidirectional stream', async () => {
+      client = new WebTransport(
+        `${process.env.SERVER_URL}/bidirectional_client_initiated_echo`,
+        wtOptions
+      )
+      await client.ready
+
+      const stream = await client.createBidirectionalStream()
+      await writeStream(stream.writable, KNOWN_BYTES)
+      await readStream(stream.readable, KNOWN_BYTES_LENGTH)
+
+      const sendStats = await stream.writable.getStats()
+      expect(sendStats.bytesWritten).to.equal(KNOWN_BYTES_LENGTH)
+      expect(sendStats.bytesSent).to.equal(KNOWN_BYTES_LENGTH)
+
+      const receiveStats = await stream.readable.getStats()
+      expect(receiveStats.bytesRead).to.equal(BigInt(KNOWN_BYTES_LENGTH))
+      expect(receiveStats.bytesReceived >= receiveStats.bytesRead).to.be.true()
+    })
+  }
+
+  if (browser == null && process.env.USE_HTTP2 !== 'true') {
+    it('holds writes above the send high water marks', async () => {
+      const CHUNK_LENGTH = 64 * 1024
+      for (const mark of [
+        'streamSendHighWaterMark',
+        'sessionSendHighWaterMark'
+      ]) {
+        client = new WebTransport(
+          `${process.env.SERVER_URL}/bidirectional_client_initiated_echo`,
+          { ...wtOptions, [mark]: 16 * 1024 }
+        )
+        await client.ready
+
+        const stream = await client.createBidirectionalStream()
+        const chunks = [
+          new Uint8Array(CHUNK_LENGTH).fill(1),
+          new Uint8Array(CHUNK_LENGTH).fill(2)
+        ]
+        const reading = readStream(stream.readable, 2 * CHUNK_LENGTH)
+        const writer = stream.writable.getWriter()
+        // quiche takes the first chunk directly, the second one is queued
+        // natively and is above the mark
+        await writer.write(chunks[0])
+        let written = false
+        const write = writer.write(chunks[1]).then(() => {
+          written = true
+        })
+        for (let i = 0; i < 10; i++) await Promise.resolve()
+        expect(written).to.be.false()
+
+        // resolves, once onStreamWrite reports ready
+        await write
+        await writer.close()
+        const output = await reading
+        expect(ui8.concat(chunks)).to.deep.equal(
+          ui8.concat(output),
+          'Did not receive the same bytes we sent'
+        )
+        client.close()
+        client = undefined
+      }
+    })
+  }
+
   it('sends and receives data over an outgoing bidirectional stream including a zero length chunk', async () => {
     // client context - connects to the server, opens a bidi stream, sends some data and reads the response
     client = new WebTransport(
@@ -181,6 +253,327 @@ describe('bidirectional streams', function () {
     expect(received).to.equal(CHUNKS * CHUNK_LENGTH)
   })
 
+  it('resolves every write promise when many chunks are written at once', async function () {
+    if (addDelay) this.timeout(12000)
+    const CHUNKS = 512
+    const CHUNK_LENGTH = 256
+    client = new WebTransport(
+      `${process.env.SERVER_URL}/bidirectional_client_initiated_echo`,
+      wtOptions
+    )
+    await client.ready
+
+    const stream = await client.createBidirectionalStream()
+    const chunks = []
+    for (let i = 0; i < CHUNKS; i++) {
+      chunks.push(new Uint8Array(CHUNK_LENGTH).fill(i % 256))
+    }
+
+    // completions are reported in batches, but every write must resolve
+    const [output] = await Promise.all([
+      readStream(stream.readable, CHUNKS * CHUNK_LENGTH),
+      (async function writeData() {
+        const writer = stream.writable.getWriter()
+        const writes = chunks.map((chunk) => writer.write(chunk))
+        await Promise.all(writes)
+        await writer.close()
+      })()
+    ])
+
+    expect(ui8.concat(chunks)).to.deep.equal(
+      ui8.concat(output),
+      'Did not receive the same bytes we sent'
+    )
+  })
+
+  if (browser == null && process.env.USE_HTTP2 !== 'true') {
+    it('splices an echo stream into a stream of another session', async () => {
+      client = new WebTransport(
+        `${process.env.SERVER_URL}/bidirectional_client_initiated_echo`,
+        wtOptions
+      )
+      const otherClient = new WebTransport(
+        `${process.env.SERVER_URL}/bidirectional_client_initiated_echo`,
+        wtOptions
+      )
+      try {
+        await Promise.all([client.ready, otherClient.ready])
+
+        const source = await client.createBidirectionalStream()
+        const target = await otherClient.createBidirectionalStream()
+        // the echo of source is relayed to target and echoed again
+        const splice = spliceStream(source.readable, target.writable)
+        await writeStream(source.writable, KNOWN_BYTES)
+
+        // without expected length readStream only returns on the fin
+        const output = await readStream(target.readable)
+        await splice
+        expect(ui8.concat(KNOWN_BYTES)).to.deep.equal(
+          ui8.concat(output),
+          'Did not receive the same bytes we sent'
+        )
+      } finally {
+        otherClient.close()
+      }
+    })
+  }
+
+  if (browser == null && process.env.USE_HTTP2 !== 'true') {
+    it('sends a region of a file over an outgoing bidirectional stream', async function () {
+      this.timeout(5000)
+      client = new WebTransport(
+        `${process.env.SERVER_URL}/bidirectional_client_initiated_echo`,
+        wtOptions
+      )
+      await client.ready
+
+      // spans several slices of the native file source
+      const content = ui8.concat(KNOWN_BYTES_LONG)
+      const file = await writeTempFile('sendfile.bin', content)
+      const offset = 1000
+      const length = content.byteLength - 2 * offset
+
+      const stream = await client.createBidirectionalStream()
+      const [output] = await Promise.all([
+        readStream(stream.readable),
+        sendFile(stream.writable, file, { offset, length })
+      ])
+      expect(content.subarray(offset, offset + length)).to.deep.equal(
+        ui8.concat(output),
+        'Did not receive the bytes of the file region'
+      )
+    })
+  }
+
+  if (browser == null && process.env.USE_HTTP2 !== 'true') {
+    describe('broadcast group', () => {
+      /** @type {import('../lib/dom').WebTransport | undefined} */
+      let otherClient
+
+      afterEach(() => {
+        otherClient?.close()
+        otherClient = undefined
+      })
+
+      async function openEchoStreams() {
+        await quicheLoaded
+        client = new WebTransport(
+          `${process.env.SERVER_URL}/bidirectional_client_initiated_echo`,
+          wtOptions
+        )
+        otherClient = new WebTransport(
+          `${process.env.SERVER_URL}/bidirectional_client_initiated_echo`,
+          wtOptions
+        )
+        await Promise.all([client.ready, otherClient.ready])
+        return Promise.all([
+          client.createBidirectionalStream(),
+          otherClient.createBidirectionalStream()
+        ])
+      }
+
+      it('rejects an unknown policy', async () => {
+        await quicheLoaded
+        expect(() => new BroadcastGroup({ policy: 'wait' })).to.throw(
+          TypeError,
+          'policy must be drop or buffer'
+        )
+      })
+
+      it('buffers chunks for streams of several sessions', async () => {
+        const streams = await openEchoStreams()
+        const group = new BroadcastGroup()
+        for (const stream of streams) {
+          expect(group.add(stream.writable)).to.be.true()
+        }
+        expect(group.size).to.equal(2)
+
+        const chunks = [1, 2, 3, 4].map((fill) =>
+          new Uint8Array(16 * 1024).fill(fill)
+        )
+        for (const chunk of chunks) {
+          expect(group.write(chunk)).to.deep.equal({ written: 2, dropped: 0 })
+        }
+        const outputs = await Promise.all(
+          streams.map(async (stream) => {
+            const reading = readStream(stream.readable)
+            await stream.writable.close()
+            return reading
+          })
+        )
+        for (const output of outputs) {
+          expect(ui8.concat(chunks)).to.deep.equal(
+            ui8.concat(output),
+            'Did not receive the broadcast bytes'
+          )
+        }
+      })
+
+      it('drops chunks for streams, that can not take them at once', async () => {
+        const [stream] = await openEchoStreams()
+        const group = new BroadcastGroup({ policy: 'drop' })
+        expect(group.add(stream.writable)).to.be.true()
+
+        // the first chunk fills the buffer of quiche, the network is not
+        // served in between the synchronous writes
+        const chunks = [1, 2, 3, 4].map((fill) =>
+          new Uint8Array(64 * 1024).fill(fill)
+        )
+        const written = chunks.filter((chunk) => {
+          const result = group.write(chunk)
+          expect(result.written + result.dropped).to.equal(1)
+          return result.written === 1
+        })
+        expect(written[0]).to.equal(chunks[0])
+        expect(written.length).to.be.lessThan(chunks.length)
+
+        const reading = readStream(stream.readable)
+        await stream.writable.close()
+        expect(ui8.concat(written)).to.deep.equal(
+          ui8.concat(await reading),
+          'Did not receive only the written chunks'
+        )
+      })
+
+      it('removes gone streams automatically', async function () {
+        this.timeout(5000)
+        const streams = await openEchoStreams()
+        const group = new BroadcastGroup()
+        for (const stream of streams) group.add(stream.writable)
+        expect(group.write(new Uint8Array([1, 2, 3]))).to.deep.equal({
+          written: 2,
+          dropped: 0
+        })
+
+        // both directions are finished, the transport releases the streams
+        await Promise.all(
+          streams.map(async (stream) => {
+            const reading = readStream(stream.readable)
+            await stream.writable.close()
+            return reading
+          })
+        )
+        while (group.size > 0) {
+          await new Promise((resolve) => setTimeout(resolve, 20))
+        }
+        expect(group.write(new Uint8Array([4]))).to.deep.equal({
+          written: 0,
+          dropped: 0
+        })
+        expect(group.add(streams[0].writable)).to.be.false()
+      })
+    })
+  }
+
+  if (browser == null && process.env.USE_HTTP2 !== 'true') {
+    it('frames messages with length prefixes of all sizes', async () => {
+      client = new WebTransport(
+        `${process.env.SERVER_URL}/bidirectional_client_initiated_echo`,
+        // @ts-ignore
+        { ...wtOptions, streamMessageMode: true }
+      )
+      await client.ready
+
+      // the echo returns the framed bytes, they are framed again by the
+      // client, lengths with 1, 1, 2 and 4 byte varints
+      const messages = [0, 1, 100, 20000].map((length) =>
+        new Uint8Array(length).fill(length & 0xff)
+      )
+      const stream = await client.createBidirectionalStream()
+      const reading = readStream(stream.readable)
+      const writer = stream.writable.getWriter()
+      for (const message of messages) await writer.write(message)
+      await writer.close()
+      expect(await reading).to.deep.equal(
+        messages,
+        'Did not receive the same messages we sent'
+      )
+    })
+
+    it('errors the readable on an oversized message', async () => {
+      client = new WebTransport(
+        `${process.env.SERVER_URL}/bidirectional_client_initiated_echo`,
+        // @ts-ignore
+        { ...wtOptions, streamMessageMode: true, maxMessageSize: 64 }
+      )
+      await client.ready
+
+      const stream = await client.createBidirectionalStream()
+      const reader = stream.readable.getReader()
+      const writer = stream.writable.getWriter()
+      await writer.write(new Uint8Array(64).fill(1))
+      await writer.write(new Uint8Array(65).fill(2))
+
+      expect((await reader.read()).value).to.deep.equal(
+        new Uint8Array(64).fill(1)
+      )
+      const error = await reader.read().catch((error) => error)
+      expect(error)
+        .to.be.a('WebTransportError')
+        .with.property('message', 'message exceeds maxMessageSize')
+      // the client stops the echo, the echo stops the client
+      const closed = await writer.closed.then(
+        () => null,
+        (error) => error
+      )
+      expect(closed).to.not.be.null()
+    })
+  }
+
+  if (browser == null && process.env.USE_HTTP2 !== 'true') {
+    it('resets a stream after its deadline expired', async () => {
+      client = new WebTransport(
+        `${process.env.SERVER_URL}/bidirectional_client_initiated_echo`,
+        wtOptions
+      )
+      await client.ready
+
+      // @ts-ignore
+      const stream = await client.createBidirectionalStream({ deadline: 50 })
+      // @ts-ignore
+      expect(stream.writable.deadline).to.be.within(0, 50)
+      const writer = stream.writable.getWriter()
+      await writer.write(new Uint8Array([1, 2, 3]))
+      // the stream is not finished in time
+      const closed = await writer.closed.then(
+        () => null,
+        (error) => error
+      )
+      expect(closed)
+        .to.be.a('WebTransportError')
+        .with.property('message', 'Stream deadline expired')
+      // the reset stops the echo, which resets its stream in turn
+      const readError = await readStream(stream.readable).then(
+        () => null,
+        (error) => error
+      )
+      expect(readError).to.not.be.null()
+    })
+
+    it('clears the deadline of a stream', async () => {
+      client = new WebTransport(
+        `${process.env.SERVER_URL}/bidirectional_client_initiated_echo`,
+        wtOptions
+      )
+      await client.ready
+
+      // @ts-ignore
+      const stream = await client.createBidirectionalStream({ deadline: 50 })
+      // @ts-ignore
+      stream.writable.deadline = null
+      // @ts-ignore
+      expect(stream.writable.deadline).to.be.null()
+      await new Promise((resolve) => setTimeout(resolve, 150))
+
+      const reading = readStream(stream.readable, KNOWN_BYTES_LENGTH)
+      await writeStream(stream.writable, KNOWN_BYTES)
+      expect(ui8.concat(KNOWN_BYTES)).to.deep.equal(
+        ui8.concat(await reading),
+        'Did not receive the same bytes we sent'
+      )
+    })
+  }
+
   it('sends and receives data over an incoming bidirectional stream', async () => {
     // client context - waits for the server to open a bidi stream then pipes it back to them
     client = new WebTransport(
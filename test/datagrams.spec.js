@@ -6,6 +6,10 @@ import { readStream } from './fixtures/read-stream.js'
 import { readCertHash } from './fixtures/read-cert-hash.js'
 import { pTimeout, TimeoutError } from './fixtures/p-timeout.js'
 import { quicheLoaded } from './fixtures/quiche.js'
+import {
+  DatagramBroadcastGroup,
+  DatagramStatus
+} from './fixtures/native.js'
 
 /**
  * @template T
@@ -93,6 +97,180 @@ describe('datagrams', function () {
     expect(result).to.have.property('closeCode', 0)
   })
 
+  if (browser == null) {
+    it('client sends an array of datagrams in one call', async () => {
+      client = new WebTransport(
+        `${process.env.SERVER_URL}/datagrams_client_send`,
+        wtOptions
+      )
+      await client.ready
+
+      const datagrams = client.datagrams
+      const tooBig = new Uint8Array(datagrams.maxDatagramSize + 1)
+      const codes = datagrams.writeDatagrams([
+        Uint8Array.from([0, 1, 2, 3, 4]),
+        Uint8Array.from([5, 6, 7]),
+        tooBig
+      ])
+      expect(codes).to.be.an.instanceOf(Uint8Array)
+      expect(codes).to.have.lengthOf(3)
+      // queued datagrams are still sent
+      expect([DatagramStatus.success, DatagramStatus.blocked]).to.include(
+        codes[0]
+      )
+      expect([DatagramStatus.success, DatagramStatus.blocked]).to.include(
+        codes[1]
+      )
+      expect(codes[2]).to.equal(DatagramStatus.tooBig)
+
+      // the server closes the session after it received a datagram
+      const result = await client.closed
+      expect(result).to.have.property('reason', '')
+      expect(result).to.have.property('closeCode', 0)
+    })
+
+    it('client sends packed datagrams with their lengths in one call', async () => {
+      client = new WebTransport(
+        `${process.env.SERVER_URL}/datagrams_client_send`,
+        wtOptions
+      )
+      await client.ready
+
+      const packed = Uint8Array.from([0, 1, 2, 3, 4, 5, 6, 7, 8, 9])
+      const codes = client.datagrams.writeDatagrams(packed, [4, 6])
+      expect(codes).to.have.lengthOf(2)
+      for (const code of codes) {
+        expect([DatagramStatus.success, DatagramStatus.blocked]).to.include(
+          code
+        )
+      }
+      expect(() => client?.datagrams.writeDatagrams(packed)).to.throw(
+        TypeError
+      )
+      if (process.env.USE_HTTP2 !== 'true') {
+        // the lengths must fit into the packed chunk
+        expect(() =>
+          client?.datagrams.writeDatagrams(packed, [4, 7])
+        ).to.throw(RangeError)
+      }
+
+      const result = await client.closed
+      expect(result).to.have.property('reason', '')
+      expect(result).to.have.property('closeCode', 0)
+    })
+
+    it('exports the datagram status codes', () => {
+      expect(DatagramStatus).to.be.frozen()
+      expect(DatagramStatus).to.include({
+        success: 0,
+        blocked: 1,
+        tooBig: 2,
+        internalError: 3,
+        dropped: 4
+      })
+    })
+
+    it('reports datagrams dropped by a full outgoing queue', async () => {
+      client = new WebTransport(
+        `${process.env.SERVER_URL}/datagrams_client_send`,
+        wtOptions
+      )
+      await client.ready
+
+      const datagrams = client.datagrams
+      expect(() => {
+        datagrams.outgoingHighWaterMark = -1
+      }).to.throw(RangeError)
+      datagrams.outgoingHighWaterMark = 1
+      // @ts-ignore
+      datagrams.outgoingDropPolicy = 'newest'
+      const chunks = []
+      for (let i = 0; i < 256; i++) {
+        chunks.push(new Uint8Array(datagrams.maxDatagramSize).fill(i))
+      }
+      // depending on the congestion window, some may go out right away
+      const codes = datagrams.writeDatagrams(chunks)
+      for (const code of codes) {
+        expect([
+          DatagramStatus.success,
+          DatagramStatus.blocked,
+          DatagramStatus.dropped
+        ]).to.include(code)
+      }
+      // one datagram fits into the queue, one may wait inside the transport
+      expect(
+        codes.filter((code) => code === DatagramStatus.blocked).length
+      ).to.be.at.most(2)
+
+      const result = await client.closed
+      expect(result).to.have.property('reason', '')
+      expect(result).to.have.property('closeCode', 0)
+    })
+  }
+
+  if (browser == null && process.env.USE_HTTP2 !== 'true') {
+    it('broadcasts datagrams to several sessions', async () => {
+      client = new WebTransport(
+        `${process.env.SERVER_URL}/datagrams_server_send`,
+        wtOptions
+      )
+      const otherClient = new WebTransport(
+        `${process.env.SERVER_URL}/datagrams_server_send`,
+        wtOptions
+      )
+      try {
+        await Promise.all([client.ready, otherClient.ready])
+        const group = new DatagramBroadcastGroup()
+        expect(group.add(client)).to.be.true()
+        expect(group.add(otherClient)).to.be.true()
+        expect(group.add(client)).to.be.true()
+        expect(group.size).to.equal(2)
+
+        const first = group.write(Uint8Array.from([0, 1, 2, 3, 4]))
+        expect(first.sent + first.blocked).to.equal(2)
+        expect(
+          group.write(new Uint8Array(client.datagrams.maxDatagramSize + 1))
+        ).to.deep.equal({
+          sent: 0,
+          blocked: 0,
+          tooBig: 2,
+          dropped: 0,
+          failed: 0
+        })
+
+        // the queue of one session only keeps the oldest datagram
+        otherClient.datagrams.outgoingHighWaterMark = 1
+        // @ts-ignore
+        otherClient.datagrams.outgoingDropPolicy = 'newest'
+        const chunk = new Uint8Array(client.datagrams.maxDatagramSize)
+        let dropped = 0
+        for (let i = 0; i < 256; i++) {
+          const result = group.write(chunk)
+          expect(
+            result.sent + result.blocked + result.dropped + result.tooBig
+          ).to.equal(2)
+          expect(result.failed).to.equal(0)
+          dropped += result.dropped
+        }
+        expect(dropped).to.be.above(0)
+
+        // a closed session fails, until it leaves the group
+        otherClient.close()
+        await otherClient.closed
+        const size = group.size
+        expect(size).to.be.within(1, 2)
+        const last = group.write(Uint8Array.from([5, 6, 7]))
+        expect(last.failed).to.equal(size - 1)
+        expect(last.sent + last.blocked + last.dropped).to.equal(1)
+
+        group.remove(client)
+        expect(group.size).to.equal(size - 1)
+      } finally {
+        otherClient.close()
+      }
+    })
+  }
+
   it('receives datagrams from the server', async () => {
     // client context - pipes the server's datagrams back to them
     client = new WebTransport(
@@ -129,6 +307,72 @@ describe('datagrams', function () {
     expect(received).to.have.lengthOf(expected)
   })
 
+  if (browser == null && process.env.USE_HTTP2 !== 'true') {
+    it('receives datagrams from the server through a ring', async () => {
+      client = new WebTransport(
+        `${process.env.SERVER_URL}/datagrams_server_send`,
+        // @ts-ignore
+        { ...wtOptions, datagramRingSize: 64 }
+      )
+      await client.ready
+
+      // without ondatagrams the datagrams arrive at the readable
+      const received = await pTimeout(
+        readStream(client.datagrams.readable, 2),
+        1000
+      )
+      expect(received).to.have.lengthOf(2)
+      for (const datagram of received) {
+        expect(datagram).to.deep.equal(Uint8Array.from([0, 1, 2, 3, 4]))
+      }
+    })
+
+    it('passes batches of datagrams in the ring to ondatagrams', async () => {
+      client = new WebTransport(
+        `${process.env.SERVER_URL}/datagrams_server_send`,
+        // @ts-ignore
+        { ...wtOptions, datagramRingSize: 12 }
+      )
+      /** @type {number[]} */
+      const offsets = []
+      /** @type {Uint8Array[]} */
+      const datagrams = []
+      /** @type {Set<ArrayBufferLike>} */
+      const rings = new Set()
+      /** @type {() => void} */
+      let done = () => {}
+      const collected = new Promise((resolve) => {
+        done = () => resolve(undefined)
+      })
+      // @ts-ignore
+      client.datagrams.ondatagrams = (
+        /** @type {Uint8Array} */ ring,
+        /** @type {Uint32Array} */ index,
+        /** @type {number} */ count
+      ) => {
+        rings.add(ring.buffer)
+        expect(ring.byteLength).to.equal(12)
+        for (let i = 0; i < count; i++) {
+          const offset = index[2 * i]
+          offsets.push(offset)
+          // the data is only valid during the call
+          datagrams.push(ring.slice(offset, offset + index[2 * i + 1]))
+        }
+        if (datagrams.length >= 6) done()
+      }
+      await client.ready
+      await pTimeout(collected, 2000)
+
+      // two datagrams of 5 bytes fit, the third one starts over at 0
+      expect(rings.size).to.equal(1)
+      for (const datagram of datagrams) {
+        expect(datagram).to.deep.equal(Uint8Array.from([0, 1, 2, 3, 4]))
+      }
+      for (const offset of offsets) expect([0, 5]).to.include(offset)
+      expect(offsets.slice(offsets.indexOf(5))).to.include(0)
+    })
+  }
+
   if (browser !== 'chromium') {
     // chromium defaults to byte stream
     it('receives zero datagrams from the server', async () => {
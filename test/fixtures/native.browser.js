@@ -0,0 +1,17 @@
+// browsers only offer the WebTransport API
+export const spliceStream = undefined
+export const sendFile = undefined
+export const BroadcastGroup = undefined
+export const DatagramBroadcastGroup = undefined
+export const writeTempFile = undefined
+export const tempFilePath = undefined
+export const readSessionCacheFile = undefined
+export const appendFile = undefined
+export const copyFile = undefined
+export const stat = undefined
+export const DatagramStatus = undefined
+export const SessionStatsField = undefined
+export const ConnectionStatsField = undefined
+export const createCertificate = undefined
+export const stubVerifyProof = undefined
+export const startHttp3Server = undefined
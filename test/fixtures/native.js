@@ -0,0 +1,195 @@
+import { createHash } from 'crypto'
+import { mkdtemp, readFile, writeFile } from 'fs/promises'
+import { tmpdir } from 'os'
+import path from 'path'
+import { Http3Server } from '@fails-components/webtransport'
+import { generateWebTransportCertificate } from './certificate.js'
+import { getReaderStream, getReaderValue } from './reader-value.js'
+
+// functions of the http/3 transport beyond the WebTransport API,
+// only available with node
+export {
+  spliceStream,
+  sendFile,
+  BroadcastGroup,
+  DatagramBroadcastGroup,
+  DatagramStatus,
+  SessionStatsField,
+  ConnectionStatsField
+} from '@fails-components/webtransport'
+export { appendFile, copyFile, stat } from 'fs/promises'
+
+/**
+ * Write data to a file in a new temporary directory
+ *
+ * @param {string} name
+ * @param {Uint8Array} data
+ * @returns {Promise<string>} the path of the file
+ */
+export async function writeTempFile(name, data) {
+  const dir = await mkdtemp(path.join(tmpdir(), 'webtransport-test-'))
+  const file = path.join(dir, name)
+  await writeFile(file, data)
+  return file
+}
+
+/**
+ * Return the path of a file in a new temporary directory, the file is not
+ * created
+ *
+ * @param {string} name
+ */
+export async function tempFilePath(name) {
+  const dir = await mkdtemp(path.join(tmpdir(), 'webtransport-test-'))
+  return path.join(dir, name)
+}
+
+/**
+ * Parse a session cache file of the http/3 client like
+ * http3sessioncache.cc does: a magic followed by records with a 32 bit
+ * little endian length, whose first byte is the type of the record
+ *
+ * @param {string} file
+ * @returns {Promise<{ types: number[], rest: number }>} rest counts the
+ * bytes of a record cut off at the end
+ */
+export async function readSessionCacheFile(file) {
+  const magic = 'WTSCACHE2'
+  const data = await readFile(file).catch(() => new Uint8Array(0))
+  /** @type {number[]} */
+  const types = []
+  if (new TextDecoder().decode(data.subarray(0, magic.length)) !== magic) {
+    return { types, rest: data.byteLength }
+  }
+  const view = new DataView(data.buffer, data.byteOffset, data.byteLength)
+  let pos = magic.length
+  while (pos + 4 <= data.byteLength) {
+    const length = view.getUint32(pos, true)
+    if (pos + 4 + length > data.byteLength) break
+    types.push(data[pos + 4])
+    pos += 4 + length
+  }
+  return { types, rest: data.byteLength - pos }
+}
+
+/**
+ * Create a self signed certificate like the one of the test server,
+ * the http/3 server selects a chain by the dns names of its leaf
+ *
+ * @param {string} [commonName]
+ * @param {string[]} [dnsNames] added to the subject alternative names
+ */
+export async function createCertificate(commonName = '127.0.0.1', dnsNames) {
+  /** @type {{ days: number, extensions?: any[] }} */
+  const options = { days: 13 }
+  if (dnsNames != null) {
+    // the default extensions of the certificate fixture plus the names
+    options.extensions = [
+      { name: 'basicConstraints', cA: false },
+      {
+        name: 'keyUsage',
+        keyCertSign: true,
+        digitalSignature: true,
+        nonRepudiation: true,
+        keyEncipherment: true,
+        dataEncipherment: true
+      },
+      {
+        name: 'subjectAltName',
+        altNames: [
+          { type: 6, value: 'http://example.org/webid#me' },
+          ...dnsNames.map((value) => ({ type: 2, value }))
+        ]
+      }
+    ]
+  }
+  const certificate = await generateWebTransportCertificate(
+    [
+      { shortName: 'C', value: 'DE' },
+      { shortName: 'ST', value: 'Berlin' },
+      { shortName: 'L', value: 'Berlin' },
+      { shortName: 'O', value: 'WebTransport Test Server' },
+      { shortName: 'CN', value: commonName }
+    ],
+    options
+  )
+  if (certificate == null) {
+    throw new Error('Certificate generation failed')
+  }
+  return certificate
+}
+
+/**
+ * Replace the PKI verification of the node client, which is called for
+ * every full handshake of a client without serverCertificateHashes, and
+ * would reject the self signed certificates. Records the hostname and the
+ * sha-256 hash of the leaf certificate of every call.
+ */
+export function stubVerifyProof() {
+  // @ts-ignore
+  const verifyProof = globalThis.FAILSVerifyProof
+  /** @type {Array<{ hostname: string, hash: Uint8Array }>} */
+  const verifications = []
+  // @ts-ignore
+  globalThis.FAILSVerifyProof = (
+    /** @type {{ certs: Uint8Array[], hostname: string }} */ obj
+  ) => {
+    verifications.push({
+      hostname: obj.hostname,
+      hash: new Uint8Array(createHash('sha256').update(obj.certs[0]).digest())
+    })
+    return true
+  }
+  return {
+    verifications,
+    restore() {
+      // @ts-ignore
+      globalThis.FAILSVerifyProof = verifyProof
+    }
+  }
+}
+
+/**
+ * Start an additional http/3 server inside the test process, for tests of
+ * server options the shared test server does not use. Bidirectional
+ * streams of sessions on /echo are echoed.
+ *
+ * @param {object} [options] passed on to the Http3Server
+ */
+export async function startHttp3Server(options = {}) {
+  const certificate = await createCertificate()
+  const server = new Http3Server({
+    port: 0,
+    host: '127.0.0.1',
+    secret: 'mysecret',
+    cert: certificate.cert,
+    privKey: certificate.private,
+    ...options
+  })
+  const sessions = server.sessionStream('/echo')
+  server.startServer()
+  await server.ready
+  ;(async () => {
+    for await (const session of getReaderStream(sessions)) {
+      getReaderValue(session.incomingBidirectionalStreams)
+        .then((bidiStream) => bidiStream.readable.pipeTo(bidiStream.writable))
+        .catch(() => {
+          // the client closes the session
+        })
+    }
+  })()
+  const address = server.address()
+  if (address == null) {
+    throw new Error('Could not determine server address')
+  }
+
+  return {
+    server,
+    certificate,
+    url: `https://${address.host}:${address.port}`,
+    async close() {
+      server.stopServer()
+      await server.closed
+    }
+  }
+}
@@ -9,6 +9,7 @@ import { KNOWN_BYTES_LONG } from './fixtures/known-bytes.js'
 import * as ui8 from 'uint8arrays'
 import { quicheLoaded } from './fixtures/quiche.js'
 import { expect } from 'chai'
+import { PriorityScheduler } from '../main/lib/http2/priorityscheduler.js'
 
 describe('sendgroup streams', function () {
   this.timeout(5000)
@@ -170,6 +171,132 @@ describe('sendgroup streams', function () {
       expect(Number(afterHighArrivedLowCounter)).to.be.below(dataSize / 2)
     }
   })
+  it('sends data over two outgoing bidirectional streams in send groups with different weights (10 MB)', async function () {
+    client = new WebTransport(
+      `${process.env.SERVER_URL}/send_order_bidi_two_10MB`,
+      wtOptions
+    )
+    await client.ready
+
+    const groupLowWeight = client.createSendGroup()
+    if (typeof groupLowWeight.weight === 'undefined') {
+      console.log('send group weights are not implemented, skipping')
+      return // not implemented
+    }
+    const groupHighWeight = client.createSendGroup()
+    groupHighWeight.weight = 3
+    expect(() => {
+      groupLowWeight.weight = 0
+    }).to.throw(TypeError)
+    expect(groupLowWeight.weight).to.equal(1)
+
+    // the same send order, only the weights differ
+    const streamLowWeight = await client.createBidirectionalStream({
+      sendGroup: groupLowWeight
+    })
+    const streamHighWeight = await client.createBidirectionalStream({
+      sendGroup: groupHighWeight
+    })
+    const dataSize = 10 * 1024 * 1024
+    const verylongarray = new Uint8Array(dataSize)
+    await Promise.all([
+      writeStream(streamLowWeight.writable, [verylongarray]),
+      writeStream(streamHighWeight.writable, [verylongarray])
+    ])
+    const sizeOfData = BigUint64Array.BYTES_PER_ELEMENT * 2
+    const buffersHighWeight = await readStream(
+      streamHighWeight.readable,
+      sizeOfData
+    )
+    const bufferHighWeight = ui8.concat(buffersHighWeight)
+    // counters of the first and the second stream, when the second one completed
+    const [lowCounter, highCounter] = new BigUint64Array(
+      bufferHighWeight.buffer,
+      bufferHighWeight.byteOffset,
+      bufferHighWeight.byteLength / BigUint64Array.BYTES_PER_ELEMENT
+    )
+    if (!websocketEmu) {
+      expect(Number(highCounter)).to.equal(dataSize)
+      // a share of 1/4 of the rate, with some slack for the start and the end
+      expect(Number(lowCounter)).to.be.below(dataSize / 2)
+    }
+  })
+
+  describe('PriorityScheduler with send group weights', function () {
+    const groupA = 1n
+    const groupB = 2n
+
+    /**
+     * @param {number} weightA
+     * @param {number} weightB
+     */
+    function createScheduler(weightA, weightB) {
+      const scheduler = new PriorityScheduler()
+      scheduler.Register(10n, { sendGroupId: groupA, sendOrder: 0 })
+      scheduler.Register(20n, { sendGroupId: groupB, sendOrder: 0 })
+      scheduler.SetSendGroupWeight(groupA, weightA)
+      scheduler.SetSendGroupWeight(groupB, weightB)
+      return scheduler
+    }
+
+    /**
+     * Pops streams and charges a fixed write to each, as the http/2
+     * transport does for every chunk sent
+     * @param {PriorityScheduler} scheduler
+     * @param {bigint[]} streams
+     * @param {number} rounds
+     */
+    function run(scheduler, streams, rounds) {
+      /** @type {Object<string, number>} */
+      const served = {}
+      for (const streamId of streams) {
+        served[streamId.toString()] = 0
+        if (!scheduler.IsScheduled(streamId)) scheduler.Schedule(streamId)
+      }
+      for (let i = 0; i < rounds; i++) {
+        const streamId = scheduler.PopFront()
+        if (typeof streamId === 'undefined') throw new Error('empty schedule')
+        scheduler.AddBytesSent(streamId, 1000)
+        served[streamId.toString()]++
+        scheduler.Schedule(streamId)
+      }
+      return served
+    }
+
+    it('serves the groups in proportion to their weights', () => {
+      const scheduler = createScheduler(3, 1)
+      const served = run(scheduler, [10n, 20n], 400)
+      expect(served['10']).to.be.within(295, 305)
+      expect(served['20']).to.be.within(95, 105)
+      // the virtual times stay close, as both groups got their share
+      expect(
+        Math.abs(
+          scheduler.GroupVirtualTime(groupA) -
+            scheduler.GroupVirtualTime(groupB)
+        )
+      ).to.be.at.most(1000)
+    })
+
+    it('does not let an idle group save up a share', () => {
+      const scheduler = createScheduler(1, 1)
+      run(scheduler, [10n], 100)
+      // group B was idle, it starts at the current virtual time
+      const served = run(scheduler, [10n, 20n], 40)
+      expect(served['20']).to.be.within(19, 21)
+      expect(served['10']).to.be.within(19, 21)
+    })
+
+    it('is round-robin again after the weights are removed', () => {
+      const scheduler = createScheduler(3, 1)
+      scheduler.SetSendGroupWeight(groupA, 0)
+      scheduler.SetSendGroupWeight(groupB, 0)
+      expect(scheduler.IsWeighted()).to.equal(false)
+      const served = run(scheduler, [10n, 20n], 40)
+      expect(served['10']).to.equal(20)
+      expect(served['20']).to.equal(20)
+    })
+  })
+
   it('should correctly update sendOrder on writable stream', async () => {
     client = new WebTransport(
       `${process.env.SERVER_URL}/bidirectional_client_initiated_echo`,
@@ -0,0 +1,637 @@
+/* eslint-env mocha */
+
+import WebTransport from './fixtures/webtransport.js'
+import { expect } from './fixtures/chai.js'
+import { readStream } from './fixtures/read-stream.js'
+import { writeStream } from './fixtures/write-stream.js'
+import { readCertHash } from './fixtures/read-cert-hash.js'
+import { quicheLoaded } from './fixtures/quiche.js'
+import {
+  appendFile,
+  ConnectionStatsField,
+  copyFile,
+  createCertificate,
+  readSessionCacheFile,
+  startHttp3Server,
+  stat,
+  stubVerifyProof,
+  tempFilePath
+} from './fixtures/native.js'
+import { KNOWN_BYTES, KNOWN_BYTES_LENGTH } from './fixtures/known-bytes.js'
+import * as ui8 from 'uint8arrays'
+
+/**
+ * @param {string} fingerprint
+ */
+function certOptions(fingerprint) {
+  return {
+    serverCertificateHashes: [
+      {
+        algorithm: 'sha-256',
+        value: readCertHash(fingerprint)
+      }
+    ]
+  }
+}
+
+/**
+ * Send some bytes over a bidirectional stream of the echo path and
+ * check the echo, also makes sure, that the session ticket has arrived
+ *
+ * @param {import('../lib/dom').WebTransport} client
+ */
+async function echo(client) {
+  const stream = await client.createBidirectionalStream()
+  await writeStream(stream.writable, KNOWN_BYTES)
+  const output = await readStream(stream.readable, KNOWN_BYTES_LENGTH)
+  expect(ui8.concat(output)).to.deep.equal(ui8.concat(KNOWN_BYTES))
+}
+
+// the counters are in host byte order
+const littleEndian = new Uint8Array(new Uint16Array([1]).buffer)[0] === 1
+
+// options of the http/3 server, which the shared test server does not use,
+// every test starts its own server inside the test process
+describe('http/3 server', function () {
+  const browser = process.env.BROWSER
+  if (browser != null || process.env.USE_HTTP2 === 'true') return
+
+  /** @type {import('../lib/dom').WebTransport | undefined} */
+  let client
+  /** @type {Awaited<ReturnType<typeof startHttp3Server>> | undefined} */
+  let server
+
+  // @ts-ignore
+  beforeEach(async () => {
+    await quicheLoaded
+  })
+
+  // @ts-ignore
+  afterEach(async () => {
+    if (client != null) {
+      client.close()
+      client = undefined
+    }
+    if (server != null) {
+      await server.close()
+      server = undefined
+    }
+  })
+
+  it('reports the connections in the layout of ConnectionStatsField', async () => {
+    server = await startHttp3Server()
+    client = new WebTransport(
+      `${server.url}/echo`,
+      certOptions(server.certificate.fingerprint)
+    )
+    await client.ready
+    const stream = await client.createBidirectionalStream()
+    await writeStream(stream.writable, KNOWN_BYTES)
+    await readStream(stream.readable, KNOWN_BYTES_LENGTH)
+
+    const stats = server.server.connectionStats()
+    expect(stats).to.be.an.instanceOf(Uint8Array)
+    expect(stats?.byteLength).to.equal(ConnectionStatsField.recordSize)
+    if (stats == null) return
+    const view = new DataView(stats.buffer, stats.byteOffset, stats.byteLength)
+
+    const cidLength = view.getUint8(ConnectionStatsField.connectionIdLength)
+    expect(cidLength).to.be.within(1, 20)
+    expect(view.getUint8(ConnectionStatsField.peerFamily)).to.equal(4)
+    expect(
+      view.getUint16(ConnectionStatsField.peerPort, littleEndian)
+    ).to.be.above(0)
+    // network order
+    expect(
+      Array.from(
+        stats.subarray(
+          ConnectionStatsField.peerAddress,
+          ConnectionStatsField.peerAddress + 4
+        )
+      )
+    ).to.deep.equal([127, 0, 0, 1])
+
+    /**
+     * @param {number} offset
+     */
+    const counter = (offset) => view.getBigUint64(offset, littleEndian)
+    expect(counter(ConnectionStatsField.smoothedRtt) > 0n).to.be.true()
+    expect(counter(ConnectionStatsField.congestionWindow) > 0n).to.be.true()
+    expect(
+      counter(ConnectionStatsField.bytesSent) >= BigInt(KNOWN_BYTES_LENGTH)
+    ).to.be.true()
+    expect(
+      counter(ConnectionStatsField.bytesReceived) >= BigInt(KNOWN_BYTES_LENGTH)
+    ).to.be.true()
+    expect(counter(ConnectionStatsField.packetsSent) > 0n).to.be.true()
+    expect(counter(ConnectionStatsField.packetsReceived) > 0n).to.be.true()
+    expect(
+      counter(ConnectionStatsField.packetsLost) <=
+        counter(ConnectionStatsField.packetsSent)
+    ).to.be.true()
+
+    // a large enough target is reused, a too small one is not
+    const target = new Uint8Array(4 * ConnectionStatsField.recordSize)
+    const reused = server.server.connectionStats(target)
+    expect(reused?.buffer).to.equal(target.buffer)
+    expect(reused?.byteLength).to.equal(ConnectionStatsField.recordSize)
+    const tooSmall = new Uint8Array(ConnectionStatsField.recordSize - 1)
+    const fresh = server.server.connectionStats(tooSmall)
+    expect(fresh?.buffer).to.not.equal(tooSmall.buffer)
+    expect(fresh?.byteLength).to.equal(ConnectionStatsField.recordSize)
+  })
+
+  it('connects with the selected congestion control', async () => {
+    server = await startHttp3Server({
+      congestionControl: 'bbr',
+      congestionControlOptions: ['BBR4']
+    })
+    // the algorithm requested by the client wins for its connection
+    for (const congestionControl of ['cubic', 'low-latency', 'default']) {
+      client = new WebTransport(`${server.url}/echo`, {
+        ...certOptions(server.certificate.fingerprint),
+        // @ts-ignore
+        congestionControl
+      })
+      await client.ready
+      expect(client.congestionControl).to.equal(
+        congestionControl === 'cubic' ? 'throughput' : congestionControl
+      )
+      const stream = await client.createBidirectionalStream()
+      await writeStream(stream.writable, KNOWN_BYTES)
+      const output = await readStream(stream.readable, KNOWN_BYTES_LENGTH)
+      expect(ui8.concat(output)).to.deep.equal(ui8.concat(KNOWN_BYTES))
+      client.close()
+      client = undefined
+    }
+  })
+
+  it('rejects an unknown congestion control', async () => {
+    /**
+     * @param {Promise<any>} promise
+     */
+    const rejection = (promise) =>
+      promise.then(
+        () => {
+          throw new Error('Expected a rejection')
+        },
+        (/** @type {Error} */ error) => error
+      )
+
+    // the server never listens
+    const serverError = await rejection(
+      startHttp3Server({ congestionControl: 'vegas' })
+    )
+    expect(serverError.stack).to.include(
+      'congestionControl must be bbrv2, bbr, cubic, reno'
+    )
+    const optionsError = await rejection(
+      startHttp3Server({ congestionControlOptions: ['TOOLONG'] })
+    )
+    expect(optionsError.stack).to.include(
+      'congestionControlOptions must be tags of up to 4 characters'
+    )
+
+    server = await startHttp3Server()
+    client = new WebTransport(`${server.url}/echo`, {
+      ...certOptions(server.certificate.fingerprint),
+      // @ts-ignore
+      congestionControl: 'vegas'
+    })
+    const clientError = await rejection(client.ready)
+    expect(clientError.stack).to.include(
+      'congestionControl must be bbrv2, bbr, cubic, reno'
+    )
+    client = undefined
+  })
+
+  it('does not resume sessions of clients verifying the server differently', async function () {
+    this.timeout(10000)
+    server = await startHttp3Server()
+    const url = `${server.url}/echo`
+    // the PKI verification of node is called for every full handshake,
+    // it would reject the self signed certificate
+    // @ts-ignore
+    const verifyProof = globalThis.FAILSVerifyProof
+    let verifications = 0
+    // @ts-ignore
+    globalThis.FAILSVerifyProof = () => {
+      verifications++
+      return true
+    }
+    try {
+      client = new WebTransport(url)
+      await client.ready
+      await echo(client)
+      client.close()
+      expect(verifications).to.equal(1)
+
+      // a pinned client must not resume the ticket of the unpinned one,
+      // a wrong pin is only detected by a full handshake
+      const wrongHash = readCertHash(server.certificate.fingerprint)
+      wrongHash[0] ^= 0xff
+      client = new WebTransport(url, {
+        serverCertificateHashes: [{ algorithm: 'sha-256', value: wrongHash }],
+        requireUnreliable: true
+      })
+      const error = await client.ready.then(
+        () => undefined,
+        (/** @type {Error} */ error) => error
+      )
+      expect(error).to.be.an.instanceOf(Error)
+
+      // the ticket is still there for a client verifying the same way
+      client = new WebTransport(url)
+      await client.ready
+      await echo(client)
+      client.close()
+      expect(verifications).to.equal(1)
+
+      // a pinned client does not take the next ticket of the unpinned one
+      client = new WebTransport(
+        url,
+        certOptions(server.certificate.fingerprint)
+      )
+      await client.ready
+      await echo(client)
+      client.close()
+      client = new WebTransport(url)
+      await client.ready
+      client.close()
+      expect(verifications).to.equal(1)
+      client = undefined
+    } finally {
+      // @ts-ignore
+      globalThis.FAILSVerifyProof = verifyProof
+    }
+  })
+
+  it('keeps the session cache in a file', async function () {
+    this.timeout(10000)
+    server = await startHttp3Server()
+    const url = `${server.url}/echo`
+    const file = await tempFilePath('sessioncache.bin')
+    // the clients of a process share the cache of a path, another spelling
+    // of the path loads the file again, like a new process would
+    const alias = file.replace(/([^/\\]+)$/, './$1')
+    const kRecordEntry = 1
+    const verifier = stubVerifyProof()
+    try {
+      client = new WebTransport(url, {
+        // @ts-ignore
+        sessionCacheFile: file
+      })
+      await client.ready
+      await echo(client)
+      // the ticket arrives after the handshake
+      while (
+        !(await readSessionCacheFile(file)).types.includes(kRecordEntry)
+      ) {
+        await new Promise((resolve) => setTimeout(resolve, 20))
+      }
+      client.close()
+      client = undefined
+      expect(verifier.verifications).to.have.lengthOf(1)
+      if (process.platform !== 'win32') {
+        expect((await stat(file)).mode & 0o777).to.equal(0o600)
+      }
+
+      // a record cut off by a crash ends the log
+      const truncated = await tempFilePath('truncated.bin')
+      await copyFile(file, truncated)
+      await appendFile(truncated, Uint8Array.from([200, 0, 0, 0, 1, 2, 3]))
+      expect((await readSessionCacheFile(truncated)).rest).to.equal(7)
+
+      for (const sessionCacheFile of [alias, truncated]) {
+        client = new WebTransport(url, {
+          // @ts-ignore
+          sessionCacheFile
+        })
+        await client.ready
+        await echo(client)
+        client.close()
+        client = undefined
+        // the replayed ticket resumes the session, no certificate is shown
+        expect(verifier.verifications).to.have.lengthOf(1)
+      }
+      // the log is compacted on load, without the cut off record
+      expect((await readSessionCacheFile(truncated)).rest).to.equal(0)
+    } finally {
+      verifier.restore()
+    }
+  })
+
+  it('resumes sessions with the tickets of servers sharing the ticket keys', async function () {
+    this.timeout(10000)
+    const oldKey = new Uint8Array(48).fill(1)
+    const newKey = new Uint8Array(48).fill(2)
+    server = await startHttp3Server({ ticketKeys: [oldKey] })
+    const { certificate } = server
+    const port = server.server.address()?.port
+    const url = `${server.url}/echo`
+    // every file is a cache of its own, holding one ticket for the server
+    const files = [
+      await tempFilePath('sessioncache1.bin'),
+      await tempFilePath('sessioncache2.bin')
+    ]
+    const verifier = stubVerifyProof()
+    /**
+     * @param {string} sessionCacheFile
+     */
+    const connect = async (sessionCacheFile) => {
+      client = new WebTransport(url, {
+        // @ts-ignore
+        sessionCacheFile
+      })
+      await client.ready
+      await echo(client)
+      client.close()
+      client = undefined
+    }
+    try {
+      for (const file of files) await connect(file)
+      expect(verifier.verifications).to.have.lengthOf(2)
+
+      // another server of the fleet on the same address
+      await server.close()
+      server = await startHttp3Server({
+        port,
+        cert: certificate.cert,
+        privKey: certificate.private,
+        ticketKeys: [oldKey]
+      })
+      await connect(files[0])
+      expect(verifier.verifications).to.have.lengthOf(2)
+
+      // new tickets use the new key, the old key still decrypts
+      server.server.setTicketKeys([newKey, oldKey])
+      await connect(files[1])
+      expect(verifier.verifications).to.have.lengthOf(2)
+
+      // the ticket of files[0] was issued with the old key
+      server.server.setTicketKeys([newKey])
+      await connect(files[0])
+      expect(verifier.verifications).to.have.lengthOf(3)
+    } finally {
+      verifier.restore()
+    }
+  })
+
+  it('uses an updated certificate for new handshakes', async function () {
+    this.timeout(10000)
+    server = await startHttp3Server()
+    const url = `${server.url}/echo`
+    const verifier = stubVerifyProof()
+    /**
+     * @param {number} fill
+     */
+    const ticketKey = (fill) => new Uint8Array(48).fill(fill)
+    try {
+      client = new WebTransport(url)
+      await client.ready
+      await echo(client)
+      client.close()
+      expect(verifier.verifications.map(({ hash }) => hash)).to.deep.equal([
+        readCertHash(server.certificate.fingerprint)
+      ])
+
+      const certificate = await createCertificate()
+      server.server.updateCert(certificate.cert, certificate.private, false)
+      // a resumed session would not show the certificate again
+      server.server.setTicketKeys([ticketKey(1)])
+      client = new WebTransport(url)
+      await client.ready
+      await echo(client)
+      client.close()
+      expect(verifier.verifications).to.have.lengthOf(2)
+      expect(verifier.verifications[1].hash).to.deep.equal(
+        readCertHash(certificate.fingerprint)
+      )
+
+      // a broken pem is rejected and the certificate is kept
+      expect(() =>
+        server?.server.updateCert('no pem', 'no pem', false)
+      ).to.throw()
+      server.server.setTicketKeys([ticketKey(2)])
+      client = new WebTransport(url)
+      await client.ready
+      await echo(client)
+      expect(verifier.verifications).to.have.lengthOf(3)
+      expect(verifier.verifications[2].hash).to.deep.equal(
+        readCertHash(certificate.fingerprint)
+      )
+    } finally {
+      verifier.restore()
+    }
+  })
+
+  it('selects the certificate by the hostname of the client', async function () {
+    this.timeout(10000)
+    const defaultCertificate = await createCertificate()
+    const hostCertificate = await createCertificate('localhost', ['localhost'])
+    // client and server resolve localhost the same way
+    server = await startHttp3Server({
+      host: 'localhost',
+      cert: [defaultCertificate.cert, hostCertificate.cert],
+      privKey: [defaultCertificate.private, hostCertificate.private]
+    })
+    const url = `https://localhost:${server.server.address()?.port}/echo`
+    const verifier = stubVerifyProof()
+    try {
+      client = new WebTransport(url)
+      await client.ready
+      await echo(client)
+      client.close()
+      expect(verifier.verifications).to.have.lengthOf(1)
+      expect(verifier.verifications[0].hostname).to.equal('localhost')
+      expect(verifier.verifications[0].hash).to.deep.equal(
+        readCertHash(hostCertificate.fingerprint)
+      )
+
+      // without a chain for the hostname the first chain is used
+      const otherCertificate = await createCertificate('other', [
+        'other.invalid'
+      ])
+      server.server.updateCert(
+        [defaultCertificate.cert, otherCertificate.cert],
+        [defaultCertificate.private, otherCertificate.private],
+        false
+      )
+      // a resumed session would not show the certificate again
+      server.server.setTicketKeys([new Uint8Array(48).fill(1)])
+      client = new WebTransport(url)
+      await client.ready
+      await echo(client)
+      expect(verifier.verifications).to.have.lengthOf(2)
+      expect(verifier.verifications[1].hash).to.deep.equal(
+        readCertHash(defaultCertificate.fingerprint)
+      )
+    } finally {
+      verifier.restore()
+    }
+  })
+
+  it('signs handshakes on the thread pool', async function () {
+    this.timeout(10000)
+    server = await startHttp3Server({ asyncSigning: true })
+    client = new WebTransport(
+      `${server.url}/echo`,
+      certOptions(server.certificate.fingerprint)
+    )
+    await client.ready
+    await echo(client)
+    client.close()
+    client = undefined
+
+    // more handshakes at once than pool threads, the surplus is signed
+    // synchronously
+    const poolSize = Number(process.env.UV_THREADPOOL_SIZE) || 4
+    // a resumed session would not be signed
+    server.server.setTicketKeys([new Uint8Array(48).fill(1)])
+    const clients = Array.from(
+      { length: 2 * poolSize + 1 },
+      () =>
+        new WebTransport(
+          `${server?.url}/echo`,
+          certOptions(server?.certificate.fingerprint ?? '')
+        )
+    )
+    try {
+      await Promise.all(
+        clients.map(async (burstClient) => {
+          await burstClient.ready
+          await echo(burstClient)
+        })
+      )
+    } finally {
+      for (const burstClient of clients) burstClient.close()
+    }
+  })
+
+  it('compresses the certificate message once per chain', async () => {
+    server = await startHttp3Server({ certCompression: true })
+    const url = `${server.url}/echo`
+    client = new WebTransport(url, certOptions(server.certificate.fingerprint))
+    await client.ready
+    await echo(client)
+    client.close()
+    const stats = server.server.certCompressionStats()
+    expect(stats).to.include({ compressed: 1, cached: 0 })
+    expect(stats?.uncompressedBytes).to.be.above(0)
+    // subject and issuer of the self signed certificate are the same
+    expect(stats?.compressedBytes)
+      .to.be.above(0)
+      .and.below(stats?.uncompressedBytes ?? 0)
+
+    // a resumed session would not send the certificate
+    server.server.setTicketKeys([new Uint8Array(48).fill(1)])
+    client = new WebTransport(url, certOptions(server.certificate.fingerprint))
+    await client.ready
+    await echo(client)
+    const cachedStats = server.server.certCompressionStats()
+    expect(cachedStats).to.include({ compressed: 1, cached: 1 })
+    expect(cachedStats?.uncompressedBytes).to.equal(
+      2 * (stats?.uncompressedBytes ?? 0)
+    )
+    expect(cachedStats?.compressedBytes).to.equal(
+      2 * (stats?.compressedBytes ?? 0)
+    )
+  })
+
+  it('does not compress the certificate message by default', async () => {
+    server = await startHttp3Server()
+    client = new WebTransport(
+      `${server.url}/echo`,
+      certOptions(server.certificate.fingerprint)
+    )
+    await client.ready
+    expect(server.server.certCompressionStats()).to.deep.equal({
+      compressed: 0,
+      cached: 0,
+      uncompressedBytes: 0,
+      compressedBytes: 0
+    })
+  })
+
+  it('connects after a Retry', async () => {
+    server = await startHttp3Server({ retry: 'always' })
+    const url = `${server.url}/echo`
+    // the first client has no token, the second one may present the
+    // token of a NEW_TOKEN frame
+    for (let i = 0; i < 2; i++) {
+      client = new WebTransport(
+        url,
+        certOptions(server.certificate.fingerprint)
+      )
+      await client.ready
+      await echo(client)
+      client.close()
+      client = undefined
+    }
+    expect(server.server.setRetry('load')).to.equal(0)
+  })
+
+  it('validates the retry threshold', async () => {
+    const error = await startHttp3Server({ retryThreshold: -1 }).then(
+      () => {
+        throw new Error('Expected a rejection')
+      },
+      (/** @type {Error} */ error) => error
+    )
+    expect(error.stack).to.include(
+      'retryThreshold must be a non negative number'
+    )
+
+    server = await startHttp3Server({ retry: 'load', retryThreshold: 0 })
+    expect(() => server?.server.setRetry('load', -1)).to.throw(RangeError)
+    // the threshold 0 is kept, so every new connection gets a Retry
+    expect(server.server.setRetry('load')).to.equal(0)
+    client = new WebTransport(
+      `${server.url}/echo`,
+      certOptions(server.certificate.fingerprint)
+    )
+    await client.ready
+    await echo(client)
+  })
+
+  it('rejects invalid session options at startup', async () => {
+    /**
+     * @param {Promise<any>} promise
+     */
+    const rejection = (promise) =>
+      promise.then(
+        () => {
+          throw new Error('Expected a rejection')
+        },
+        (/** @type {Error} */ error) => error
+      )
+    const invalid = [
+      { sessionSendHighWaterMark: -1 },
+      { streamSendHighWaterMark: -1 },
+      { maxMessageSize: -1 },
+      { datagramMaxQueue: -1 },
+      { datagramMaxAge: -1 }
+    ]
+    for (const options of invalid) {
+      const name = Object.keys(options)[0]
+      const serverError = await rejection(startHttp3Server(options))
+      expect(serverError.stack).to.include(
+        `${name} must be a non negative number`
+      )
+    }
+
+    server = await startHttp3Server()
+    for (const options of invalid) {
+      const name = Object.keys(options)[0]
+      client = new WebTransport(`${server.url}/echo`, {
+        ...certOptions(server.certificate.fingerprint),
+        ...options
+      })
+      const clientError = await rejection(client.ready)
+      expect(clientError.stack).to.include(
+        `${name} must be a non negative number`
+      )
+    }
+    client = undefined
+  })
+})
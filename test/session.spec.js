@@ -5,7 +5,13 @@ import WebTransport from './fixtures/webtransport.js'
 import { expect } from './fixtures/chai.js'
 import { quicheLoaded } from './fixtures/quiche.js'
 import { getReaderValue } from './fixtures/reader-value.js'
-import { readStringFromStream } from './fixtures/read-stream.js'
+import {
+  readStream,
+  readStringFromStream
+} from './fixtures/read-stream.js'
+import { writeStream } from './fixtures/write-stream.js'
+import { SessionStatsField } from './fixtures/native.js'
+import * as ui8 from 'uint8arrays'
 
 /**
  * @template T
@@ -171,6 +177,93 @@ describe('session', function () {
     expect(client.protocol).to.equal('')
     await client.closed
   })
+  if (browser == null && process.env.USE_HTTP2 !== 'true') {
+    it('should not deliver events of recycled wrappers to their previous owners', async function () {
+      this.timeout(10000)
+      const SESSIONS = 16
+      const STREAMS = 8
+      /** @type {Array<{stream: any, length: number}>} */
+      const oldStreams = []
+
+      for (let s = 0; s < SESSIONS; s++) {
+        client = new WebTransport(
+          `${process.env.SERVER_URL}/bidirectional_client_initiated_echo`,
+          wtOptions
+        )
+        await client.ready
+        // the echo path serves the first stream of a session only
+        const stream = await client.createBidirectionalStream()
+        const chunks = []
+        for (let i = 0; i < STREAMS; i++) {
+          chunks.push(new Uint8Array(64 + s).fill(s * STREAMS + i))
+        }
+        const length = STREAMS * (64 + s)
+        await writeStream(stream.writable, chunks)
+        const output = await readStream(stream.readable, length)
+        expect(ui8.concat(chunks)).to.deep.equal(
+          ui8.concat(output),
+          'Did not receive the same bytes we sent'
+        )
+        // closed streams without traffic, their wrappers go back to the pool
+        for (let i = 0; i < STREAMS; i++) {
+          const unused = await client.createBidirectionalStream()
+          await unused.writable.close()
+        }
+        oldStreams.push({ stream, length })
+        client.close()
+        await client.closed
+        client = undefined
+      }
+
+      // the wrappers now serve other streams, the old owners keep their stats
+      for (const { stream, length } of oldStreams) {
+        const stats = await stream.writable.getStats()
+        expect(stats.bytesWritten).to.equal(length)
+      }
+    })
+
+    it('should fill the session stats synchronously', async () => {
+      client = new WebTransport(
+        `${process.env.SERVER_URL}/bidirectional_client_initiated_echo`,
+        wtOptions
+      )
+      await client.ready
+      const stream = await client.createBidirectionalStream()
+      const chunks = [new Uint8Array(1024).fill(1)]
+      await writeStream(stream.writable, chunks)
+      await readStream(stream.readable, 1024)
+
+      const doubles = new Float64Array(SessionStatsField.length)
+      // @ts-ignore
+      expect(client.fillStats(doubles)).to.be.true()
+      expect(doubles[SessionStatsField.smoothedRtt]).to.be.above(0)
+      expect(doubles[SessionStatsField.congestionWindow]).to.be.above(0)
+      expect(doubles[SessionStatsField.packetsSent]).to.be.above(0)
+      expect(doubles[SessionStatsField.bytesSent]).to.be.at.least(1024)
+      expect(doubles[SessionStatsField.bytesReceived]).to.be.at.least(1024)
+
+      // the counters only grow, so the later snapshot is not smaller
+      const bigints = new BigUint64Array(SessionStatsField.length)
+      // @ts-ignore
+      expect(client.fillStats(bigints)).to.be.true()
+      expect(
+        bigints[SessionStatsField.packetsSent] >=
+          BigInt(doubles[SessionStatsField.packetsSent])
+      ).to.be.true()
+      expect(
+        bigints[SessionStatsField.bytesSent] >=
+          BigInt(doubles[SessionStatsField.bytesSent])
+      ).to.be.true()
+
+      const tooSmall = new Float64Array(SessionStatsField.length - 1)
+      // @ts-ignore
+      expect(() => client.fillStats(tooSmall)).to.throw(RangeError)
+      const wrongType = new Uint32Array(SessionStatsField.length)
+      // @ts-ignore
+      expect(() => client.fillStats(wrongType)).to.throw(TypeError)
+    })
+  }
+
   if (browser !== 'chromium' && browser !== 'firefox' && browser !== 'webkit') {
     it('should error when connecting with a bad certificate (non serverCertificateHashes)', async () => {
       client = new WebTransport(`${process.env.SERVER_URL}/session_close`, {
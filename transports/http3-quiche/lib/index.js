@@ -47,5 +47,8 @@ export const checkQuicheInit = function (args) {
 
 export const Http3WebTransportClient = wtrouter.Http3WebTransportClient
 export const Http3WebTransportServer = wtrouter.Http3WebTransportServer
+export const Http3WTBroadcastGroup = wtrouter.Http3WTBroadcastGroup
+export const Http3WTDatagramBroadcastGroup =
+  wtrouter.Http3WTDatagramBroadcastGroup
 export { Http3WebTransportClientSocket } from './clientsocket.js'
 export { Http3WebTransportServerSocket } from './serversocket.js'
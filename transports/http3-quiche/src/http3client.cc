@@ -12,13 +12,16 @@
 #include "src/http3wtsessionvisitor.h"
 #include "src/http3sessioncache.h"
 
+#include <algorithm>
 #include <memory>
 #include <utility>
 #include <vector>
 
+#include "absl/strings/escaping.h"
 #include "absl/strings/match.h"
 #include "absl/strings/string_view.h"
 #include "absl/cleanup/cleanup.h"
+#include "openssl/pool.h"
 #include "openssl/x509.h"
 #include "quiche/quic/core/crypto/proof_verifier.h"
 #include "quiche/quic/core/http/quic_spdy_client_stream.h"
@@ -39,6 +42,7 @@
 #include "quiche/quic/tools/quic_url.h"
 #include "quiche/common/quiche_text_utils.h"
 #include "quiche/web_transport/web_transport_headers.h"
+#include "zlib.h"
 
 using quiche::HttpHeaderBlock;
 
@@ -150,6 +154,22 @@ namespace quic
         EnvGetter *envg_;
     };
 
+    // accepts zlib compressed certificate messages (RFC 8879), BoringSSL
+    // limits uncompressed_len to the maximum certificate list size
+    static int decompressCert(SSL *ssl, CRYPTO_BUFFER **out, size_t uncompressed_len,
+                              const uint8_t *in, size_t in_len)
+    {
+        uint8_t *data;
+        bssl::UniquePtr<CRYPTO_BUFFER> buffer(CRYPTO_BUFFER_alloc(&data, uncompressed_len));
+        if (!buffer)
+            return 0;
+        uLongf len = uncompressed_len;
+        if (uncompress(data, &len, in, in_len) != Z_OK || len != uncompressed_len)
+            return 0;
+        *out = buffer.release();
+        return 1;
+    }
+
     QuicStreamId GetNthClientInitiatedBidirectionalStreamId(
         QuicTransportVersion version, int n)
     {
@@ -197,7 +217,8 @@ namespace quic
           priority_(HttpStreamPriority()),
           protocols_(protocols)
     {
-       
+        SSL_CTX_add_cert_compression_alg(crypto_config_.ssl_ctx(), TLSEXT_cert_compression_zlib,
+                                         nullptr, decompressCert);
     }
 
     Http3Client::~Http3Client()
@@ -567,7 +588,10 @@ namespace quic
         }
         if (webtransport_server_support_inform_ && connected())
         {
-            if (session_->SupportsWebTransport())
+            // a resumed session knows the settings of the server before the handshake
+            // completes, the session request is only sent as 0-RTT data on opt-in
+            if (session_->SupportsWebTransport() &&
+                (early_data_ || session_->OneRttKeysAvailable()))
             {
                 getJS()->processClientWebtransportSupport();
                 webtransport_server_support_inform_ = false;
@@ -611,6 +635,7 @@ namespace quic
                         getJS()->processNewClientSession(wtsessionobj);
                         auto visitor = std::make_unique<Http3WTSession::Visitor>(wtsessionobj,
                             static_cast<Http3ClientSession *>(session_.get()));
+                        visitor->setConnection(session_->connection());
                         static_cast<Http3ClientSession *>(session_.get())->AddVisitor(id, visitor.get());
                         wtsession->SetVisitor(std::move(visitor));
                     }
@@ -689,6 +714,10 @@ namespace quic
         {
             session_->connection()->SetMaxPacketLength(initial_max_packet_length_);
         }
+        if (!connection_options_.empty())
+        {
+            session_->connection()->ApplyConnectionOptions(connection_options_);
+        }
         // Reset |writer()| after |session()| so that the old writer outlives the old
         // session.
         if (writer_.get() != writer)
@@ -1158,6 +1187,9 @@ namespace quic
         std::vector<WebTransportHash> serverCertificateHashes;
         std::vector<std::string> protocols;
         std::string privkey;
+        QuicTagVector ccoptions;
+        bool earlyData = false;
+        std::string sessionCacheFile;
         QuicConfig cconfig;
         auto env = info.Env();
         if (!info[0].IsUndefined())
@@ -1276,6 +1308,16 @@ namespace quic
                         return;
                     }
                 }
+                if (lobj.Has("earlyData") && !(lobj).Get("earlyData").IsUndefined())
+                {
+                    earlyData = (lobj).Get("earlyData").ToBoolean().Value();
+                }
+                if (lobj.Has("sessionCacheFile") && !(lobj).Get("sessionCacheFile").IsUndefined())
+                {
+                    sessionCacheFile = (lobj).Get("sessionCacheFile").ToString().Utf8Value();
+                }
+                if (!parseCongestionControl(lobj, ccoptions) || !validateSessionOptions(lobj))
+                    return;
             }
         }
 
@@ -1285,10 +1327,19 @@ namespace quic
             std::make_unique<QuicDefaultConnectionHelper>();
 
         std::unique_ptr<ProofVerifier> verifier;
+        // clients share sessions only with clients verifying the same way
+        std::string cachePartition;
 
         if (serverCertificateHashes.size() > 0)
         {
             verifier = std::make_unique<ChromiumWebTransportFingerprintProofVerifier>(helper->GetClock(), 14);
+            std::vector<std::string> pinned;
+            for (const WebTransportHash &hash : serverCertificateHashes)
+                pinned.push_back(hash.algorithm + ":" + absl::BytesToHexString(hash.value));
+            std::sort(pinned.begin(), pinned.end());
+            cachePartition = "hashes";
+            for (const std::string &hash : pinned)
+                cachePartition += " " + hash;
 
             for (auto cur = serverCertificateHashes.begin();
                  cur != serverCertificateHashes.end(); cur++)
@@ -1303,12 +1354,29 @@ namespace quic
         else
         {
             verifier = std::make_unique<NodeJSProofVerifier>(this);
+            cachePartition = "pki";
         }
 
-        std::unique_ptr<Http3SessionCache> cache;
+        Http3Constructors *constr = env.GetInstanceData<Http3Constructors>();
+        std::shared_ptr<Http3SessionCache> &sessionCache = constr->sessionCaches[sessionCacheFile];
+        if (!sessionCache)
+        {
+            auto newCache = std::make_shared<Http3SessionCache>();
+            std::string error;
+            if (!sessionCacheFile.empty() && !newCache->OpenFile(sessionCacheFile, error))
+            {
+                constr->sessionCaches.erase(sessionCacheFile);
+                Napi::Error::New(env, error).ThrowAsJavaScriptException();
+                return;
+            }
+            sessionCache = newCache;
+        }
+        std::unique_ptr<SessionCache> cache = std::make_unique<Http3SharedSessionCache>(sessionCache, cachePartition);
 
         client_ = std::make_unique<Http3Client>(this, std::move(verifier), std::move(cache), std::move(helper), cconfig, protocols);
         client_->SetUserAgentID("fails-components/webtransport");
+        client_->set_connection_options(ccoptions);
+        client_->set_early_data(earlyData);
 
         Ref(); // do not garbage collect
 
@@ -1434,8 +1502,7 @@ namespace quic
         Napi::Object retObj = Napi::Object::New(Env());
         if (session != nullptr)
         {
-            Http3Constructors *constr = Env().GetInstanceData<Http3Constructors>();
-            Napi::Object sessionobj = constr->session.New({});
+            Napi::Object sessionobj = Http3WTSessionJS::acquire(Env());
             Http3WTSessionJS *sessionjs = Napi::ObjectWrap<Http3WTSessionJS>::Unwrap(sessionobj);
             sessionjs->setObj(session);
             sessionjs->Ref();
@@ -239,6 +239,12 @@ namespace quic
 
         void set_priority(QuicStreamPriority priority) { priority_ = priority; }
 
+        // congestion control applied to every new connection
+        void set_connection_options(const QuicTagVector &tags) { connection_options_ = tags; }
+
+        // allows sending the session request as 0-RTT data, which may be replayed
+        void set_early_data(bool early_data) { early_data_ = early_data; }
+
         void WaitForWriteToFlush();
 
         size_t num_requests() const { return num_requests_; }
@@ -456,6 +462,14 @@ namespace quic
         // zero, the default is used.
         QuicByteCount initial_max_packet_length_;
 
+        // Selects the congestion control of the connection, applied locally
+        // instead of being sent to the server.
+        QuicTagVector connection_options_;
+
+        // Whether the WebTransport session may be opened before the handshake
+        // is confirmed, when resuming a session.
+        bool early_data_ = false;
+
         // The number of hellos sent during the current/latest connection.
         int num_sent_client_hellos_;
 
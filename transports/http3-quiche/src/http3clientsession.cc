@@ -80,4 +80,13 @@ namespace quic
       }
     }
   }
+
+  void Http3ClientSession::OnCanWrite() {
+    QuicSpdyClientSession::OnCanWrite();
+    if (SupportsWebTransport()) {
+      for (auto itty = svisitors_.begin(); itty != svisitors_.end(); itty++) {
+        (*itty).second->OnCanWriteDatagrams();
+      }
+    }
+  }
 } // namespace quic
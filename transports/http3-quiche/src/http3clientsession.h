@@ -44,6 +44,8 @@ namespace quic
     HttpDatagramSupport LocalHttpDatagramSupport() override;
 
    void OnCanCreateNewOutgoingStream(bool unidirectional) override;
+   // also drains the datagram queues of the webtransport sessions
+   void OnCanWrite() override;
    void AddVisitor(const WebTransportSessionId id, Http3WTSession::Visitor *visitor) {
       svisitors_.try_emplace(id, visitor);
     }
@@ -53,6 +55,8 @@ namespace quic
                      [&](const auto& pair) { return pair.second == visitor; });
     }
 
+    bool DatagramQueueEmpty() override { return datagram_queue()->empty(); }
+
     void set_on_interim_headers(
         std::function<void(const quiche::HttpHeaderBlock &)> on_interim_headers)
     {
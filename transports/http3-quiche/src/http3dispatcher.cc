@@ -12,9 +12,51 @@
 #include "src/http3serversession.h"
 
 #include "absl/strings/string_view.h"
+#include "openssl/rand.h"
+#include "openssl/sha.h"
+#include "quiche/quic/core/crypto/quic_crypto_server_config.h"
+#include "quiche/quic/core/quic_versions.h"
 
 namespace quic {
 
+namespace {
+
+// first byte of tokens from NEW_TOKEN frames, see QuicSession::MaybeSendAddressToken
+constexpr char kNewTokenPrefix = 0;
+
+constexpr size_t kRetryTokenNonceSize = 12;
+
+// RFC 9001, section 5.8, the retry integrity key of QUIC version 1
+constexpr uint8_t kRetryIntegrityKey[16] = {
+    0xbe, 0x0c, 0x69, 0x0b, 0x9f, 0x66, 0x57, 0x5a,
+    0x1d, 0x76, 0x6b, 0x54, 0xe3, 0x68, 0xc8, 0x4e};
+constexpr uint8_t kRetryIntegrityNonce[12] = {
+    0x46, 0x15, 0x99, 0xd3, 0x5d, 0x63, 0x2b, 0xf2, 0x23, 0x98, 0x25, 0xbb};
+
+// binds a retry token to the address, the connection ids are sealed inside
+std::string retryTokenAd(const QuicSocketAddress& peer_address) {
+  return peer_address.host().ToPackedString();
+}
+
+void appendConnectionId(std::string& out, const QuicConnectionId& cid) {
+  out.push_back(static_cast<char>(cid.length()));
+  out.append(cid.data(), cid.length());
+}
+
+// reads a connection id with its length prefix at pos and advances pos
+bool readConnectionId(const uint8_t* in, size_t len, size_t& pos,
+                      QuicConnectionId& cid) {
+  if (pos >= len || in[pos] > kQuicMaxConnectionIdWithLengthPrefixLength ||
+      len - pos - 1 < in[pos]) {
+    return false;
+  }
+  cid = QuicConnectionId(reinterpret_cast<const char*>(in + pos + 1), in[pos]);
+  pos += 1 + in[pos];
+  return true;
+}
+
+}  // namespace
+
 Http3Dispatcher::Http3Dispatcher(
     const QuicConfig* config,
     const QuicCryptoServerConfig* crypto_config,
@@ -33,17 +75,221 @@ Http3Dispatcher::Http3Dispatcher(
                      std::move(alarm_factory),
                      expected_server_connection_id_length,
                      generator),
-      http3_server_backend_(http3_server_backend) {}
+      http3_server_backend_(http3_server_backend),
+      pending_handshakes_(std::make_shared<size_t>(0)) {
+  EVP_AEAD_CTX_init(retry_integrity_aead_.get(), EVP_aead_aes_128_gcm(),
+                    kRetryIntegrityKey, sizeof(kRetryIntegrityKey),
+                    EVP_AEAD_DEFAULT_TAG_LENGTH, nullptr);
+  uint8_t key[32];
+  RAND_bytes(key, sizeof(key));
+  EVP_AEAD_CTX_init(retry_token_aead_.get(), EVP_aead_aes_256_gcm(), key,
+                    sizeof(key), EVP_AEAD_DEFAULT_TAG_LENGTH, nullptr);
+}
 
 Http3Dispatcher::~Http3Dispatcher() = default;
 
+void Http3Dispatcher::setRetrySecret(absl::string_view secret) {
+  std::string input = "webtransport retry token ";
+  input.append(secret.data(), secret.size());
+  uint8_t key[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const uint8_t*>(input.data()), input.size(), key);
+  EVP_AEAD_CTX_cleanup(retry_token_aead_.get());
+  EVP_AEAD_CTX_init(retry_token_aead_.get(), EVP_aead_aes_256_gcm(), key,
+                    sizeof(key), EVP_AEAD_DEFAULT_TAG_LENGTH, nullptr);
+}
+
+bool Http3Dispatcher::MaybeDispatchPacket(
+    const ReceivedPacketInfo& packet_info) {
+  if (QuicDispatcher::MaybeDispatchPacket(packet_info)) {
+    return true;
+  }
+  // the packet belongs to no established connection
+  if (retry_mode_ == kRetryNever ||
+      packet_info.form != IETF_QUIC_LONG_HEADER_PACKET ||
+      packet_info.long_packet_type != INITIAL ||
+      packet_info.version != ParsedQuicVersion::RFCv1()) {
+    return false;
+  }
+  // too small packets are dropped later, a Retry would amplify them
+  if (packet_info.packet.length() < kMinClientInitialPacketLength) {
+    return false;
+  }
+  // further packets of a client hello spanning several packets must reach
+  // the connection, that is created for its first packet
+  if (buffered_packets()->HasBufferedPackets(
+          packet_info.destination_connection_id)) {
+    return false;
+  }
+  if (!shouldRetry() || hasValidToken(packet_info)) {
+    return false;
+  }
+  sendRetry(packet_info);
+  return true;
+}
+
+bool Http3Dispatcher::shouldRetry() const {
+  switch (retry_mode_) {
+    case kRetryAlways:
+      return true;
+    case kRetryOnLoad:
+      return *pending_handshakes_ >= retry_threshold_ || HasChlosBuffered();
+    default:
+      return false;
+  }
+}
+
+bool Http3Dispatcher::hasValidToken(
+    const ReceivedPacketInfo& packet_info) {
+  if (!packet_info.retry_token.has_value() ||
+      packet_info.retry_token->empty()) {
+    return false;
+  }
+  absl::string_view token = *packet_info.retry_token;
+  if (token[0] == kRetryTokenPrefix) {
+    // the client addresses the Initial to the connection id of the Retry
+    QuicConnectionId odcid;
+    QuicConnectionId retry_scid;
+    return openRetryToken(token, packet_info.peer_address, odcid,
+                          retry_scid) &&
+           retry_scid == packet_info.destination_connection_id;
+  }
+  if (token[0] != kNewTokenPrefix) {
+    return false;
+  }
+  // as TlsServerHandshaker::ValidateAddressToken
+  SourceAddressTokens tokens;
+  if (crypto_config()->ParseSourceAddressToken(
+          crypto_config()->source_address_token_boxer(), token.substr(1),
+          tokens) != HANDSHAKE_OK) {
+    return false;
+  }
+  CachedNetworkParameters cached_network_params;
+  return crypto_config()->ValidateSourceAddressTokens(
+             tokens, packet_info.peer_address.host(),
+             helper()->GetClock()->WallNow(),
+             &cached_network_params) == HANDSHAKE_OK;
+}
+
+std::string Http3Dispatcher::makeRetryToken(
+    const QuicSocketAddress& peer_address, const QuicConnectionId& odcid,
+    const QuicConnectionId& retry_scid) {
+  std::string plain;
+  uint64_t issued = helper()->GetClock()->WallNow().ToUNIXSeconds();
+  for (int i = 0; i < 8; i++) plain.push_back(static_cast<char>(issued >> (8 * i)));
+  appendConnectionId(plain, odcid);
+  appendConnectionId(plain, retry_scid);
+
+  std::string ad = retryTokenAd(peer_address);
+  std::string token(1 + kRetryTokenNonceSize + plain.size() +
+                        EVP_AEAD_max_overhead(EVP_aead_aes_256_gcm()),
+                    '\0');
+  token[0] = kRetryTokenPrefix;
+  uint8_t* nonce = reinterpret_cast<uint8_t*>(&token[1]);
+  RAND_bytes(nonce, kRetryTokenNonceSize);
+  uint8_t* sealed = nonce + kRetryTokenNonceSize;
+  size_t sealedlen;
+  if (!EVP_AEAD_CTX_seal(retry_token_aead_.get(), sealed, &sealedlen,
+                         token.size() - 1 - kRetryTokenNonceSize, nonce,
+                         kRetryTokenNonceSize,
+                         reinterpret_cast<const uint8_t*>(plain.data()),
+                         plain.size(),
+                         reinterpret_cast<const uint8_t*>(ad.data()),
+                         ad.size())) {
+    return std::string();
+  }
+  token.resize(1 + kRetryTokenNonceSize + sealedlen);
+  return token;
+}
+
+bool Http3Dispatcher::openRetryToken(absl::string_view token,
+                                     const QuicSocketAddress& peer_address,
+                                     QuicConnectionId& odcid,
+                                     QuicConnectionId& retry_scid) {
+  if (token.size() < 1 + kRetryTokenNonceSize || token[0] != kRetryTokenPrefix) {
+    return false;
+  }
+  const uint8_t* nonce = reinterpret_cast<const uint8_t*>(token.data() + 1);
+  const uint8_t* sealed = nonce + kRetryTokenNonceSize;
+  size_t sealedlen = token.size() - 1 - kRetryTokenNonceSize;
+  std::string ad = retryTokenAd(peer_address);
+  uint8_t plain[8 + 2 * (1 + kQuicMaxConnectionIdWithLengthPrefixLength)];
+  size_t plainlen;
+  if (!EVP_AEAD_CTX_open(retry_token_aead_.get(), plain, &plainlen,
+                         sizeof(plain), nonce, kRetryTokenNonceSize, sealed,
+                         sealedlen, reinterpret_cast<const uint8_t*>(ad.data()),
+                         ad.size()) ||
+      plainlen < 8) {
+    return false;
+  }
+  size_t pos = 8;
+  if (!readConnectionId(plain, plainlen, pos, odcid) ||
+      !readConnectionId(plain, plainlen, pos, retry_scid) || pos != plainlen) {
+    return false;
+  }
+  uint64_t issued = 0;
+  for (int i = 0; i < 8; i++) issued |= static_cast<uint64_t>(plain[i]) << (8 * i);
+  uint64_t now = helper()->GetClock()->WallNow().ToUNIXSeconds();
+  return issued <= now + 1 && now <= issued + kRetryTokenLifetimeSecs;
+}
+
+void Http3Dispatcher::sendRetry(const ReceivedPacketInfo& packet_info) {
+  // stateless, if the socket is busy, the client retransmits its Initial
+  if (writer()->IsWriteBlocked()) {
+    return;
+  }
+  char scid[kQuicDefaultConnectionIdLength];
+  RAND_bytes(reinterpret_cast<uint8_t*>(scid), sizeof(scid));
+  QuicConnectionId retry_scid(scid, sizeof(scid));
+  std::string token = makeRetryToken(packet_info.peer_address,
+                                     packet_info.destination_connection_id,
+                                     retry_scid);
+  if (token.empty()) {
+    return;
+  }
+
+  // RFC 9000, section 17.2.5
+  uint8_t unused;
+  RAND_bytes(&unused, 1);
+  std::string packet;
+  packet.push_back(static_cast<char>(0xf0 | (unused & 0x0f)));
+  QuicVersionLabel version = CreateQuicVersionLabel(packet_info.version);
+  for (int i = 3; i >= 0; i--) packet.push_back(static_cast<char>(version >> (8 * i)));
+  const QuicConnectionId& dcid = packet_info.source_connection_id;
+  packet.push_back(static_cast<char>(dcid.length()));
+  packet.append(dcid.data(), dcid.length());
+  packet.push_back(static_cast<char>(retry_scid.length()));
+  packet.append(retry_scid.data(), retry_scid.length());
+  packet.append(token);
+
+  // the integrity tag covers the packet prefixed by the original connection id
+  const QuicConnectionId& odcid = packet_info.destination_connection_id;
+  std::string pseudo;
+  pseudo.push_back(static_cast<char>(odcid.length()));
+  pseudo.append(odcid.data(), odcid.length());
+  pseudo.append(packet);
+  uint8_t tag[EVP_AEAD_MAX_OVERHEAD];
+  size_t taglen;
+  if (!EVP_AEAD_CTX_seal(retry_integrity_aead_.get(), tag, &taglen,
+                         sizeof(tag), kRetryIntegrityNonce,
+                         sizeof(kRetryIntegrityNonce), nullptr, 0,
+                         reinterpret_cast<const uint8_t*>(pseudo.data()),
+                         pseudo.size())) {
+    return;
+  }
+  packet.append(reinterpret_cast<const char*>(tag), taglen);
+  writer()->WritePacket(packet.data(), packet.size(),
+                        packet_info.self_address.host(),
+                        packet_info.peer_address, nullptr,
+                        QuicPacketWriterParams());
+}
+
 
 
 std::unique_ptr<QuicSession> Http3Dispatcher::CreateQuicSession(
     QuicConnectionId connection_id, const QuicSocketAddress& self_address,
     const QuicSocketAddress& peer_address, absl::string_view /*alpn*/,
     const ParsedQuicVersion& version,
-    const ParsedClientHello& /*parsed_chlo*/,
+    const ParsedClientHello& parsed_chlo,
     ConnectionIdGeneratorInterface& connection_id_generator) {
   // The QuicServerSessionBase takes ownership of |connection| below.
   QuicConnection* connection =
@@ -51,11 +297,29 @@ std::unique_ptr<QuicSession> Http3Dispatcher::CreateQuicSession(
                          alarm_factory(), writer(),
                          /* owns_writer= */ false, Perspective::IS_SERVER,
                          ParsedQuicVersionVector{version}, connection_id_generator);
+  if (!http3_server_backend_->connectionOptions().empty()) {
+    connection->ApplyConnectionOptions(http3_server_backend_->connectionOptions());
+  }
+  // after a Retry the client uses the connection id of the Retry, which the
+  // generator may have replaced by connection_id, but the transport
+  // parameters must name the one of its first Initial
+  QuicConnectionId odcid;
+  QuicConnectionId retry_scid;
+  bool retried = !parsed_chlo.retry_token.empty() &&
+                 openRetryToken(parsed_chlo.retry_token, peer_address, odcid,
+                                retry_scid) &&
+                 (retry_scid == connection_id ||
+                  connection_id_generator.MaybeReplaceConnectionId(
+                      retry_scid, version) == connection_id);
 
   auto session = std::make_unique<Http3ServerSession>(
       config(), GetSupportedVersions(), connection, this, session_helper(),
       crypto_config(), compressed_certs_cache(), http3_server_backend_);
   session->Initialize();
+  if (retried) {
+    session->setRetried(odcid, retry_scid);
+  }
+  session->trackHandshake(pending_handshakes_);
   return session;
 }
 
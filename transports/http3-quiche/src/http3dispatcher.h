@@ -11,17 +11,35 @@
 #ifndef HTTP3_DISPATCHER
 #define HTTP3_DISPATCHER
 
+#include <memory>
+
 #include "src/http3serverbackend.h"
 #include "absl/strings/string_view.h"
+#include "openssl/aead.h"
 #include "quiche/quic/core/http/quic_server_session_base.h"
 #include "quiche/quic/core/quic_dispatcher.h"
 
 namespace quic
 {
 
+  // handshakes in progress, above which Initial packets without a valid token get a Retry
+  constexpr size_t kDefaultRetryThreshold = 64;
+
+  // a retry token is accepted for this long
+  constexpr uint64_t kRetryTokenLifetimeSecs = 10;
+
   class Http3Dispatcher : public QuicDispatcher
   {
   public:
+    // when Initial packets of new connections, which carry no valid address
+    // token, are answered with a stateless Retry
+    enum RetryMode
+    {
+      kRetryNever,
+      kRetryOnLoad, // too many handshakes in progress or chlos buffered
+      kRetryAlways
+    };
+
     Http3Dispatcher(
         const QuicConfig *config,
         const QuicCryptoServerConfig *crypto_config,
@@ -35,7 +53,38 @@ namespace quic
 
     ~Http3Dispatcher() override;
 
+    // derives the key of the retry tokens, servers with the same secret accept each others tokens
+    void setRetrySecret(absl::string_view secret);
+
+    void setRetryMode(RetryMode mode, size_t threshold)
+    {
+      retry_mode_ = mode;
+      retry_threshold_ = threshold;
+    }
+
+    size_t retryThreshold() const { return retry_threshold_; }
+
+    size_t pendingHandshakes() const { return *pending_handshakes_; }
+
+    // returns true, the original destination connection id and the source
+    // connection id of the Retry for a retry token issued for peer_address
+    bool openRetryToken(absl::string_view token, const QuicSocketAddress &peer_address,
+                        QuicConnectionId &odcid, QuicConnectionId &retry_scid);
+
   protected:
+    // answers Initial packets of new connections with a Retry, if required
+    bool MaybeDispatchPacket(const ReceivedPacketInfo &packet_info) override;
+
+    bool shouldRetry() const;
+
+    // true for a valid token of a Retry or a NEW_TOKEN frame
+    bool hasValidToken(const ReceivedPacketInfo &packet_info);
+
+    void sendRetry(const ReceivedPacketInfo &packet_info);
+
+    std::string makeRetryToken(const QuicSocketAddress &peer_address, const QuicConnectionId &odcid,
+                               const QuicConnectionId &retry_scid);
+
     std::unique_ptr<QuicSession> CreateQuicSession(
         QuicConnectionId connection_id, const QuicSocketAddress &self_address,
         const QuicSocketAddress &peer_address, absl::string_view alpn,
@@ -50,6 +99,13 @@ namespace quic
 
   private:
     Http3ServerBackend *http3_server_backend_; // Unowned.
+
+    RetryMode retry_mode_ = kRetryNever;
+    size_t retry_threshold_ = kDefaultRetryThreshold;
+    bssl::ScopedEVP_AEAD_CTX retry_token_aead_;
+    bssl::ScopedEVP_AEAD_CTX retry_integrity_aead_;
+    // shared with the sessions, which may outlive this part of the dispatcher
+    std::shared_ptr<size_t> pending_handshakes_;
   };
 
 } // namespace quic
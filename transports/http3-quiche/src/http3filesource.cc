@@ -0,0 +1,189 @@
+// Copyright (c) 2022 Marten Richter or other contributers (see commit). All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/http3filesource.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+#include "quiche/common/quiche_mem_slice.h"
+#include "quiche/common/quiche_stream.h"
+
+namespace quic
+{
+#ifdef _WIN32
+
+    Http3FileSource::~Http3FileSource()
+    {
+        if (fd_ >= 0)
+            _close(fd_);
+    }
+
+    std::unique_ptr<Http3FileSource> Http3FileSource::create(int fd, uint64_t offset, int64_t length,
+                                                             std::string &error)
+    {
+        struct _stat64 st;
+        if (_fstat64(fd, &st) != 0)
+        {
+            error = strerror(errno);
+            _close(fd);
+            return nullptr;
+        }
+        uint64_t size = st.st_size;
+        if (offset > size)
+        {
+            error = "offset is beyond the end of the file";
+            _close(fd);
+            return nullptr;
+        }
+        std::unique_ptr<Http3FileSource> source(new Http3FileSource());
+        uint64_t available = size - offset;
+        source->length_ = length < 0 ? available : std::min<uint64_t>(length, available);
+        source->fd_ = fd;
+        source->offset_ = offset;
+        return source;
+    }
+
+    std::unique_ptr<Http3FileSource> Http3FileSource::open(const std::string &path, uint64_t offset,
+                                                           int64_t length, std::string &error)
+    {
+        int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+        if (fd < 0)
+        {
+            error = strerror(errno);
+            return nullptr;
+        }
+        return create(fd, offset, length, error);
+    }
+
+    std::unique_ptr<Http3FileSource> Http3FileSource::fromFd(int fd, uint64_t offset, int64_t length,
+                                                             std::string &error)
+    {
+        int dupfd = _dup(fd);
+        if (dupfd < 0)
+        {
+            error = strerror(errno);
+            return nullptr;
+        }
+        return create(dupfd, offset, length, error);
+    }
+
+    int64_t Http3FileSource::readAt(char *buffer, size_t len, uint64_t pos)
+    {
+        if (_lseeki64(fd_, pos, SEEK_SET) < 0)
+            return -1;
+        return _read(fd_, buffer, static_cast<unsigned int>(len));
+    }
+
+#else
+
+    Http3FileSource::~Http3FileSource()
+    {
+        if (fd_ >= 0)
+            close(fd_);
+    }
+
+    std::unique_ptr<Http3FileSource> Http3FileSource::create(int fd, uint64_t offset, int64_t length,
+                                                             std::string &error)
+    {
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            error = strerror(errno);
+            close(fd);
+            return nullptr;
+        }
+        uint64_t size = st.st_size;
+        if (offset > size)
+        {
+            error = "offset is beyond the end of the file";
+            close(fd);
+            return nullptr;
+        }
+        std::unique_ptr<Http3FileSource> source(new Http3FileSource());
+        uint64_t available = size - offset;
+        source->length_ = length < 0 ? available : std::min<uint64_t>(length, available);
+        source->fd_ = fd;
+        source->offset_ = offset;
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, offset, source->length_, POSIX_FADV_SEQUENTIAL);
+#endif
+        return source;
+    }
+
+    std::unique_ptr<Http3FileSource> Http3FileSource::open(const std::string &path, uint64_t offset,
+                                                           int64_t length, std::string &error)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            error = strerror(errno);
+            return nullptr;
+        }
+        return create(fd, offset, length, error);
+    }
+
+    std::unique_ptr<Http3FileSource> Http3FileSource::fromFd(int fd, uint64_t offset, int64_t length,
+                                                             std::string &error)
+    {
+        int dupfd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (dupfd < 0)
+        {
+            error = strerror(errno);
+            return nullptr;
+        }
+        return create(dupfd, offset, length, error);
+    }
+
+    int64_t Http3FileSource::readAt(char *buffer, size_t len, uint64_t pos)
+    {
+        ssize_t readbytes;
+        do
+        {
+            readbytes = pread(fd_, buffer, len, pos);
+        } while (readbytes < 0 && errno == EINTR);
+        return readbytes;
+    }
+
+#endif
+
+    bool Http3FileSource::writeInto(WebTransportStream &stream, uint64_t &written)
+    {
+        while (pos_ < length_ && stream.CanWrite())
+        {
+            size_t len = std::min<uint64_t>(kFileSourceSliceSize, length_ - pos_);
+            // quiche keeps the slices until they are acked, so they own their buffer
+            char *buffer = new char[len];
+            int64_t readbytes = readAt(buffer, len, offset_ + pos_);
+            if (readbytes <= 0)
+            {
+                // a read error or a truncated file, the receiver must not
+                // take the bytes so far for the complete region
+                read_error_ = readbytes < 0 ? errno : 0;
+                failed_ = true;
+                delete[] buffer;
+                return false;
+            }
+            quiche::QuicheMemSlice slice(buffer, readbytes,
+                                         [](const char *buffer)
+                                         { delete[] buffer; });
+            absl::Status status = stream.Writev(absl::MakeSpan(&slice, 1), quiche::StreamWriteOptions());
+            if (!status.ok())
+                return false;
+            pos_ += readbytes;
+            written += readbytes;
+        }
+        return pos_ >= length_;
+    }
+}
@@ -0,0 +1,66 @@
+// Copyright (c) 2022 Marten Richter or other contributers (see commit). All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef HTTP3_FILE_SOURCE_H_
+#define HTTP3_FILE_SOURCE_H_
+
+#include <memory>
+#include <string>
+
+#include "quiche/quic/core/web_transport_interface.h"
+
+namespace quic
+{
+    // size of the mem slices handed to quiche
+    constexpr size_t kFileSourceSliceSize = 64 * 1024;
+
+    // feeds a region of a file into a stream, without copying it through js.
+    // The region is read piece by piece into buffers owned by the mem slices,
+    // a mapping would fault, if the file is truncated while quiche holds a slice.
+    class Http3FileSource
+    {
+    public:
+        ~Http3FileSource();
+
+        // takes ownership of fd, returns nullptr and sets error on failure,
+        // a negative length means up to the end of the file
+        static std::unique_ptr<Http3FileSource> create(int fd, uint64_t offset, int64_t length,
+                                                       std::string &error);
+
+        // opens the file at path
+        static std::unique_ptr<Http3FileSource> open(const std::string &path, uint64_t offset,
+                                                     int64_t length, std::string &error);
+
+        // duplicates fd, the caller keeps its descriptor
+        static std::unique_ptr<Http3FileSource> fromFd(int fd, uint64_t offset, int64_t length,
+                                                       std::string &error);
+
+        // writes as long as the stream accepts data, adds the bytes to written,
+        // returns true, if the whole region was written
+        bool writeInto(WebTransportStream &stream, uint64_t &written);
+
+        uint64_t length() const { return length_; }
+
+        // true, if the file could not be read or was truncated while sending
+        bool failed() const { return failed_; }
+
+        // errno of the failed read, 0 if the file was truncated
+        int readError() const { return read_error_; }
+
+    protected:
+        Http3FileSource() = default;
+
+        // reads up to len bytes at the position, returns the bytes read or -1
+        int64_t readAt(char *buffer, size_t len, uint64_t pos);
+
+        uint64_t length_ = 0;
+        uint64_t pos_ = 0;
+        int fd_ = -1;
+        uint64_t offset_ = 0;
+        bool failed_ = false;
+        int read_error_ = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,251 @@
+// Copyright (c) 2022 Marten Richter or other contributers (see commit). All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/http3proofsource.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "openssl/rand.h"
+#include "zlib.h"
+
+namespace quic
+{
+    constexpr size_t kTicketNonceSize = 12;
+
+    // runs the signature of the certificate proof source on node's thread pool
+    class Http3SignatureWorker : public Napi::AsyncWorker
+    {
+    public:
+        Http3SignatureWorker(Napi::Env env, std::shared_ptr<ProofSource> certs,
+                             std::shared_ptr<size_t> pending,
+                             const QuicSocketAddress &server_address,
+                             const QuicSocketAddress &client_address, const std::string &hostname,
+                             uint16_t signature_algorithm, absl::string_view in,
+                             std::unique_ptr<ProofSource::SignatureCallback> callback)
+            : Napi::AsyncWorker(env, "Http3SignatureWorker"), certs_(std::move(certs)),
+              pending_(std::move(pending)), server_address_(server_address),
+              client_address_(client_address), hostname_(hostname),
+              signature_algorithm_(signature_algorithm), in_(in), callback_(std::move(callback))
+        {
+            (*pending_)++;
+        }
+
+        void Execute() override
+        {
+            // the proof sources of quiche run their callbacks synchronously
+            certs_->ComputeTlsSignature(server_address_, client_address_, hostname_,
+                                        signature_algorithm_, in_,
+                                        std::make_unique<Result>(this));
+        }
+
+        void OnOK() override
+        {
+            (*pending_)--;
+            // a no-op, if the handshake is already gone
+            callback_->Run(ok_, std::move(signature_), std::move(details_));
+        }
+
+    protected:
+        class Result : public ProofSource::SignatureCallback
+        {
+        public:
+            Result(Http3SignatureWorker *worker) : worker_(worker) {}
+
+            void Run(bool ok, std::string signature,
+                     std::unique_ptr<ProofSource::Details> details) override
+            {
+                worker_->ok_ = ok;
+                worker_->signature_ = std::move(signature);
+                worker_->details_ = std::move(details);
+            }
+
+        protected:
+            Http3SignatureWorker *worker_;
+        };
+
+        std::shared_ptr<ProofSource> certs_;
+        std::shared_ptr<size_t> pending_;
+        QuicSocketAddress server_address_;
+        QuicSocketAddress client_address_;
+        std::string hostname_;
+        uint16_t signature_algorithm_;
+        std::string in_;
+        std::unique_ptr<ProofSource::SignatureCallback> callback_;
+        bool ok_ = false;
+        std::string signature_;
+        std::unique_ptr<ProofSource::Details> details_;
+    };
+
+    void Http3ProofSource::ComputeTlsSignature(
+        const QuicSocketAddress &server_address,
+        const QuicSocketAddress &client_address, const std::string &hostname,
+        uint16_t signature_algorithm, absl::string_view in,
+        std::unique_ptr<SignatureCallback> callback)
+    {
+        if (!env_ || *pending_signatures_ >= maxPendingSignatures())
+        {
+            certs_->ComputeTlsSignature(server_address, client_address, hostname,
+                                        signature_algorithm, in, std::move(callback));
+            return;
+        }
+        // deletes itself after OnOK
+        Http3SignatureWorker *worker = new Http3SignatureWorker(
+            Napi::Env(env_), certs_, pending_signatures_, server_address, client_address,
+            hostname, signature_algorithm, in, std::move(callback));
+        worker->Queue();
+    }
+
+    size_t Http3ProofSource::maxPendingSignatures()
+    {
+        // the same rules as libuv, which reads the variable once, too
+        static size_t size = []()
+        {
+            const char *value = getenv("UV_THREADPOOL_SIZE");
+            if (value == nullptr)
+                return kDefaultThreadPoolSize;
+            size_t threads = static_cast<size_t>(atoi(value));
+            if (threads == 0)
+                return static_cast<size_t>(1);
+            return threads > kMaxThreadPoolSize ? kMaxThreadPoolSize : threads;
+        }();
+        return size;
+    }
+
+    static int certCompressionIndex()
+    {
+        static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return index;
+    }
+
+    void Http3ProofSource::OnNewSslCtx(SSL_CTX *ssl_ctx)
+    {
+        certs_->OnNewSslCtx(ssl_ctx);
+        if (!cert_compression_)
+            return;
+        SSL_CTX_set_ex_data(ssl_ctx, certCompressionIndex(), this);
+        // only the server side, brotli is not part of the build
+        SSL_CTX_add_cert_compression_alg(ssl_ctx, TLSEXT_cert_compression_zlib, compressCert, nullptr);
+    }
+
+    int Http3ProofSource::compressCert(SSL *ssl, CBB *out, const uint8_t *in, size_t in_len)
+    {
+        Http3ProofSource *source = static_cast<Http3ProofSource *>(
+            SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), certCompressionIndex()));
+        std::string message(reinterpret_cast<const char *>(in), in_len);
+        auto it = source->compressed_certs_.find(message);
+        if (it == source->compressed_certs_.end())
+        {
+            uLongf len = compressBound(in_len);
+            std::string compressed(len, '\0');
+            if (compress2(reinterpret_cast<Bytef *>(&compressed[0]), &len, in, in_len,
+                          Z_BEST_COMPRESSION) != Z_OK)
+                return 0;
+            compressed.resize(len);
+            // stale messages of replaced certs are dropped this way
+            if (source->compressed_certs_.size() >= kMaxCompressedCerts)
+                source->compressed_certs_.clear();
+            it = source->compressed_certs_.emplace(std::move(message), std::move(compressed)).first;
+            source->cert_compression_stats_.compressed++;
+        }
+        else
+        {
+            source->cert_compression_stats_.cached++;
+        }
+        source->cert_compression_stats_.uncompressedBytes += in_len;
+        source->cert_compression_stats_.compressedBytes += it->second.size();
+        return CBB_add_bytes(out, reinterpret_cast<const uint8_t *>(it->second.data()),
+                             it->second.size());
+    }
+
+    Http3TicketCrypter::Http3TicketCrypter()
+    {
+        uint8_t key[kTicketKeySize];
+        RAND_bytes(key, sizeof(key));
+        keys_.push_back(makeKey(key));
+    }
+
+    std::unique_ptr<Http3TicketCrypter::Key> Http3TicketCrypter::makeKey(const uint8_t *data)
+    {
+        auto key = std::make_unique<Key>();
+        memcpy(key->name, data, kTicketKeyNameSize);
+        if (!EVP_AEAD_CTX_init(key->aead.get(), EVP_aead_aes_256_gcm(), data + kTicketKeyNameSize,
+                               kTicketKeySize - kTicketKeyNameSize, EVP_AEAD_DEFAULT_TAG_LENGTH, nullptr))
+            return nullptr;
+        return key;
+    }
+
+    bool Http3TicketCrypter::setKeys(const std::vector<std::string> &keys)
+    {
+        std::vector<std::unique_ptr<Key>> newkeys;
+        for (const std::string &keydata : keys)
+        {
+            if (keydata.size() != kTicketKeySize)
+                return false;
+            std::unique_ptr<Key> key = makeKey(reinterpret_cast<const uint8_t *>(keydata.data()));
+            if (!key)
+                return false;
+            newkeys.push_back(std::move(key));
+        }
+        if (newkeys.empty())
+            return false;
+        keys_ = std::move(newkeys);
+        return true;
+    }
+
+    size_t Http3TicketCrypter::MaxOverhead()
+    {
+        return kTicketKeyNameSize + kTicketNonceSize + EVP_AEAD_max_overhead(EVP_aead_aes_256_gcm());
+    }
+
+    std::vector<uint8_t> Http3TicketCrypter::Encrypt(absl::string_view in,
+                                                     absl::string_view /*encryption_key*/)
+    {
+        const Key &key = *keys_.front();
+        std::vector<uint8_t> out(in.size() + MaxOverhead());
+        memcpy(out.data(), key.name, kTicketKeyNameSize);
+        uint8_t *nonce = out.data() + kTicketKeyNameSize;
+        RAND_bytes(nonce, kTicketNonceSize);
+        uint8_t *sealed = nonce + kTicketNonceSize;
+        size_t sealedlen;
+        // the key name is authenticated as additional data
+        if (!EVP_AEAD_CTX_seal(key.aead.get(), sealed, &sealedlen, out.size() - (sealed - out.data()),
+                               nonce, kTicketNonceSize,
+                               reinterpret_cast<const uint8_t *>(in.data()), in.size(),
+                               key.name, kTicketKeyNameSize))
+            return std::vector<uint8_t>();
+        out.resize(kTicketKeyNameSize + kTicketNonceSize + sealedlen);
+        return out;
+    }
+
+    void Http3TicketCrypter::Decrypt(absl::string_view in,
+                                     std::shared_ptr<ProofSource::DecryptCallback> callback)
+    {
+        // an empty result lets BoringSSL fall back to a full handshake
+        if (in.size() < MaxOverhead())
+        {
+            callback->Run(std::vector<uint8_t>());
+            return;
+        }
+        const uint8_t *ticket = reinterpret_cast<const uint8_t *>(in.data());
+        for (const std::unique_ptr<Key> &key : keys_)
+        {
+            if (memcmp(key->name, ticket, kTicketKeyNameSize) != 0)
+                continue;
+            const uint8_t *nonce = ticket + kTicketKeyNameSize;
+            const uint8_t *sealed = nonce + kTicketNonceSize;
+            size_t sealedlen = in.size() - kTicketKeyNameSize - kTicketNonceSize;
+            std::vector<uint8_t> out(sealedlen);
+            size_t outlen;
+            if (!EVP_AEAD_CTX_open(key->aead.get(), out.data(), &outlen, out.size(),
+                                   nonce, kTicketNonceSize, sealed, sealedlen,
+                                   key->name, kTicketKeyNameSize))
+                break;
+            out.resize(outlen);
+            callback->Run(std::move(out));
+            return;
+        }
+        callback->Run(std::vector<uint8_t>());
+    }
+}
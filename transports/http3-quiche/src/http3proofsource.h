@@ -0,0 +1,155 @@
+// Copyright (c) 2022 Marten Richter or other contributers (see commit). All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef HTTP3_PROOF_SOURCE_H_
+#define HTTP3_PROOF_SOURCE_H_
+
+#include <napi.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "openssl/aead.h"
+#include "openssl/ssl.h"
+#include "quiche/quic/core/crypto/proof_source.h"
+
+namespace quic
+{
+    // a ticket key has the size of node's tls.Server.setTicketKeys, but not
+    // its layout: 16 bytes key name, the remaining 32 bytes are the
+    // AES-256-GCM key (node: name, 16 bytes HMAC and 16 bytes AES-128 key)
+    constexpr size_t kTicketKeyNameSize = 16;
+    constexpr size_t kTicketKeySize = 48;
+
+    // libuv's pool size without UV_THREADPOOL_SIZE and its upper limit
+    constexpr size_t kDefaultThreadPoolSize = 4;
+    constexpr size_t kMaxThreadPoolSize = 1024;
+
+    // compressed certificate messages kept, one per chain and client variant
+    constexpr size_t kMaxCompressedCerts = 64;
+
+    // encrypts session tickets with the first key of a ring and decrypts
+    // with any key of the ring, so that servers sharing the ring accept
+    // each others tickets and keys can be rotated without losing all sessions.
+    // A ticket is key name, nonce and the sealed session.
+    class Http3TicketCrypter : public ProofSource::TicketCrypter
+    {
+    public:
+        // starts with a random key, only valid for this process
+        Http3TicketCrypter();
+
+        // replaces the ring, keys must be kTicketKeySize bytes, the first
+        // one is used for new tickets, returns false on an invalid key
+        bool setKeys(const std::vector<std::string> &keys);
+
+        size_t MaxOverhead() override;
+        std::vector<uint8_t> Encrypt(absl::string_view in,
+                                     absl::string_view encryption_key) override;
+        void Decrypt(absl::string_view in,
+                     std::shared_ptr<ProofSource::DecryptCallback> callback) override;
+
+    protected:
+        struct Key
+        {
+            uint8_t name[kTicketKeyNameSize];
+            bssl::ScopedEVP_AEAD_CTX aead;
+        };
+
+        static std::unique_ptr<Key> makeKey(const uint8_t *data);
+
+        std::vector<std::unique_ptr<Key>> keys_;
+    };
+
+    // forwards to the certificate handling proof source,
+    // but supplies our own ticket crypter and optionally signs
+    // on node's thread pool
+    class Http3ProofSource : public ProofSource
+    {
+    public:
+        Http3ProofSource(std::unique_ptr<ProofSource> certs)
+            : certs_(std::move(certs)), pending_signatures_(std::make_shared<size_t>(0)) {}
+
+        // moves the handshake signatures off the main thread, the
+        // handshake resumes in the main thread once the signature is done
+        void enableAsyncSigning(Napi::Env env) { env_ = env; }
+
+        // offers zlib compression of the certificate message (RFC 8879),
+        // must be called before the proof source is passed to the crypto config
+        void enableCertCompression() { cert_compression_ = true; }
+
+        struct CertCompressionStats
+        {
+            uint64_t compressed = 0; // messages compressed
+            uint64_t cached = 0;     // messages served from the cache
+            uint64_t uncompressedBytes = 0;
+            uint64_t compressedBytes = 0;
+        };
+
+        const CertCompressionStats &certCompressionStats() const { return cert_compression_stats_; }
+
+        void OnNewSslCtx(SSL_CTX *ssl_ctx) override;
+
+        void GetProof(const QuicSocketAddress &server_address,
+                      const QuicSocketAddress &client_address,
+                      const std::string &hostname, const std::string &server_config,
+                      QuicTransportVersion transport_version,
+                      absl::string_view chlo_hash,
+                      std::unique_ptr<Callback> callback) override
+        {
+            certs_->GetProof(server_address, client_address, hostname, server_config,
+                             transport_version, chlo_hash, std::move(callback));
+        }
+
+        quiche::QuicheReferenceCountedPointer<Chain> GetCertChain(
+            const QuicSocketAddress &server_address,
+            const QuicSocketAddress &client_address, const std::string &hostname,
+            bool *cert_matched_sni) override
+        {
+            return certs_->GetCertChain(server_address, client_address, hostname,
+                                        cert_matched_sni);
+        }
+
+        void ComputeTlsSignature(
+            const QuicSocketAddress &server_address,
+            const QuicSocketAddress &client_address, const std::string &hostname,
+            uint16_t signature_algorithm, absl::string_view in,
+            std::unique_ptr<SignatureCallback> callback) override;
+
+        QuicSignatureAlgorithmVector SupportedTlsSignatureAlgorithms() const override
+        {
+            return certs_->SupportedTlsSignatureAlgorithms();
+        }
+
+        TicketCrypter *GetTicketCrypter() override { return &ticket_crypter_; }
+
+        Http3TicketCrypter &ticketCrypter() { return ticket_crypter_; }
+
+        // new handshakes use the new certs, established connections keep
+        // their session, as quiche does not query the proof source afterwards
+        void setCerts(std::unique_ptr<ProofSource> certs) { certs_ = std::move(certs); }
+
+    protected:
+        // signatures waiting for the thread pool, at most one per thread,
+        // more are signed synchronously, so that a reconnect storm does not
+        // starve node's other pool users
+        static size_t maxPendingSignatures();
+
+        // shared with the signatures in flight, which survive a setCerts
+        std::shared_ptr<ProofSource> certs_;
+        Http3TicketCrypter ticket_crypter_;
+        napi_env env_ = nullptr; // set for async signing
+        std::shared_ptr<size_t> pending_signatures_;
+
+        static int compressCert(SSL *ssl, CBB *out, const uint8_t *in, size_t in_len);
+
+        bool cert_compression_ = false;
+        // the message only changes with the chain, so it is compressed once
+        std::map<std::string, std::string> compressed_certs_;
+        CertCompressionStats cert_compression_stats_;
+    };
+}
+
+#endif
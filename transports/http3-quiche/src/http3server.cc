@@ -7,6 +7,10 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <string.h>
+
+#include <algorithm>
+
 #include "absl/cleanup/cleanup.h"
 #include "src/http3server.h"
 #include "src/http3dispatcher.h"
@@ -27,9 +31,10 @@ namespace quic
 
   const size_t kNumSessionsToCreatePerSocketEvent = 16;
 
-  Http3Server::Http3Server(Http3ServerJS *js, std::unique_ptr<ProofSource> proof_source,
+  Http3Server::Http3Server(Http3ServerJS *js, std::unique_ptr<Http3ProofSource> proof_source,
                            const char *secret, QuicConfig config)
       : config_(config),
+        proof_source_(proof_source.get()),
         http3_server_backend_(),
         packet_reader_(new QuicPacketReader()),
         packets_dropped_(0),
@@ -45,6 +50,7 @@ namespace quic
     // may be put somewhereelse
     dispatcher_.reset(CreateQuicDispatcher());
     dispatcher_->InitializeWithWriter(new SocketJSWriter(getJS()));
+    dispatcher()->setRetrySecret(secret);
     // may be put somewhereelse
     const uint32_t kInitialSessionFlowControlWindow = 1 * 1024 * 1024; // 1 MB
     const uint32_t kInitialStreamFlowControlWindow = 64 * 1024;        // 64 KB
@@ -95,6 +101,12 @@ namespace quic
     std::string secret;
     std::vector<std::string> cert;
     std::vector<std::string> privkey;
+    QuicTagVector ccoptions;
+    std::vector<std::string> ticketKeys;
+    bool asyncSigning = false;
+    bool certCompression = false;
+    Http3Dispatcher::RetryMode retryMode = Http3Dispatcher::kRetryNever;
+    size_t retryThreshold = kDefaultRetryThreshold;
 
     QuicConfig sconfig;
     if (!info[0].IsUndefined())
@@ -114,17 +126,8 @@ namespace quic
         }
         if (lobj.Has("cert") && !(lobj).Get("cert").IsEmpty())
         {
-          Napi::Value certValue = (lobj).Get("cert");
-          if (!certValue.IsArray()) {
-            cert.push_back(certValue.ToString().Utf8Value());
-          } else {
-            Napi::Array  certArray = certValue.As<Napi::Array>();
-            if (certArray.Length() < 1) Napi::Error::New(Env(), "No cert in array for Http3Server").ThrowAsJavaScriptException();
-            for (uint32_t i = 0; i < certArray.Length(); i++) {
-              Napi::Value curval = certArray.Get(i);
-              cert.push_back(curval.ToString().Utf8Value()); 
-            }
-          }
+          if (!parsePemList((lobj).Get("cert"), cert, "No cert in array for Http3Server"))
+            return;
         }
         else
         {
@@ -133,24 +136,19 @@ namespace quic
         }
         if (lobj.Has("privKey") && !(lobj).Get("privKey").IsEmpty())
         {
-          Napi::Value keyValue = (lobj).Get("privKey");
-          if (!keyValue.IsArray()) {
-            privkey.push_back(keyValue.ToString().Utf8Value());
-          } else {
-            Napi::Array  keyArray = keyValue.As<Napi::Array>();
-            if (keyArray.Length() < 1) Napi::Error::New(Env(), "No key in array for Http3Server").ThrowAsJavaScriptException();
-            for (uint32_t i = 0; i < keyArray.Length(); i++) {
-              Napi::Value curval = keyArray.Get(i);
-              privkey.push_back(curval.ToString().Utf8Value()); 
-            }
-          }
+          if (!parsePemList((lobj).Get("privKey"), privkey, "No key in array for Http3Server"))
+            return;
         }
         else
         {
           Napi::Error::New(Env(), "No privKey set for Http3Server").ThrowAsJavaScriptException();
           return;
         }
-        if (privkey.size() != cert.size()) Napi::Error::New(Env(), "Key and cert array length for Http3Server do not match").ThrowAsJavaScriptException();
+        if (privkey.size() != cert.size())
+        {
+          Napi::Error::New(Env(), "Key and cert array length for Http3Server do not match").ThrowAsJavaScriptException();
+          return;
+        }
         if (lobj.Has("maxConnections") && !(lobj).Get("maxConnections").IsEmpty())
         {
           Napi::Value maxconnValue = (lobj).Get("maxConnections");
@@ -194,60 +192,254 @@ namespace quic
           sconfig.SetInitialMaxStreamDataBytesIncomingBidirectionalToSend(streamFlowControlWindowSizeLimitWindow);
           sconfig.SetInitialMaxStreamDataBytesUnidirectionalToSend(streamFlowControlWindowSizeLimitWindow);
         }
+        if (!parseCongestionControl(lobj, ccoptions) || !validateSessionOptions(lobj))
+          return;
+        if (lobj.Has("asyncSigning") && !(lobj).Get("asyncSigning").IsUndefined())
+        {
+          asyncSigning = (lobj).Get("asyncSigning").ToBoolean().Value();
+        }
+        if (lobj.Has("certCompression") && !(lobj).Get("certCompression").IsUndefined())
+        {
+          certCompression = (lobj).Get("certCompression").ToBoolean().Value();
+        }
+        if (lobj.Has("retry") && !(lobj).Get("retry").IsUndefined())
+        {
+          if (!parseRetryMode((lobj).Get("retry"), retryMode))
+            return;
+        }
+        if (lobj.Has("retryThreshold") && !(lobj).Get("retryThreshold").IsUndefined())
+        {
+          if (!parseRetryThreshold((lobj).Get("retryThreshold"), retryThreshold))
+            return;
+        }
+        if (lobj.Has("ticketKeys") && !(lobj).Get("ticketKeys").IsUndefined())
+        {
+          if (!parseTicketKeys((lobj).Get("ticketKeys"), ticketKeys))
+            return;
+        }
       }
       // Callback *callback, int port, std::unique_ptr<ProofSource> proof_source,  const char *secret
 
-      std::stringstream certstream(cert[0], std::ios_base::in);
-      quiche::QuicheReferenceCountedPointer<ProofSource::Chain> chain(new ProofSource::Chain(CertificateView::LoadPemFromStream(&certstream)));
+      std::unique_ptr<ProofSource> proofsource = loadCerts(cert, privkey);
+      if (!proofsource)
+        return;
+
+      auto tlsproofsource = std::make_unique<Http3ProofSource>(std::move(proofsource));
+      if (ticketKeys.size() > 0)
+        tlsproofsource->ticketCrypter().setKeys(ticketKeys);
+      if (asyncSigning)
+        tlsproofsource->enableAsyncSigning(Env());
+      if (certCompression)
+        tlsproofsource->enableCertCompression();
 
-      std::stringstream privkeystream(privkey[0], std::ios_base::in);
+      server_ = std::make_unique<Http3Server>(this, std::move(tlsproofsource), secret.c_str(), sconfig);
+      server_->http3_server_backend_.setConnectionOptions(ccoptions);
+      server_->dispatcher()->setRetryMode(retryMode, retryThreshold);
 
-      auto certprivkey = CertificatePrivateKey::LoadPemFromStream(&privkeystream);
-      if (certprivkey == nullptr)
-      {
-        Napi::Error::New(Env(), "LoadPemFromStream privKey  failed for Http3Server").ThrowAsJavaScriptException();
-        return;
-      }
+      return;
+    }
+    else
+    {
+      Napi::Error::New(Env(), "No arguments passed to Http3Server").ThrowAsJavaScriptException();
+      return;
+    }
+  }
 
-      std::unique_ptr<ProofSourceX509> proofsource = ProofSourceX509::Create(chain, std::move(*certprivkey));
-      if (proofsource == nullptr)
+  Http3ServerJS::~Http3ServerJS()
+  {
+  }
+
+  bool Http3ServerJS::parsePemList(Napi::Value value, std::vector<std::string> &list, const char *emptyError)
+  {
+    if (!value.IsArray())
+    {
+      list.push_back(value.ToString().Utf8Value());
+      return true;
+    }
+    Napi::Array array = value.As<Napi::Array>();
+    if (array.Length() < 1)
+    {
+      Napi::Error::New(Env(), emptyError).ThrowAsJavaScriptException();
+      return false;
+    }
+    for (uint32_t i = 0; i < array.Length(); i++)
+    {
+      Napi::Value curval = array.Get(i);
+      list.push_back(curval.ToString().Utf8Value());
+    }
+    return true;
+  }
+
+  quiche::QuicheReferenceCountedPointer<ProofSource::Chain> Http3ServerJS::loadChain(
+      const std::string &pem, ChainCache &chains)
+  {
+    auto it = chains_.find(pem);
+    if (it != chains_.end())
+    {
+      chains[pem] = it->second;
+      return it->second;
+    }
+    std::stringstream certstream(pem, std::ios_base::in);
+    quiche::QuicheReferenceCountedPointer<ProofSource::Chain> chain(new ProofSource::Chain(CertificateView::LoadPemFromStream(&certstream)));
+    chains[pem] = chain;
+    return chain;
+  }
+
+  std::unique_ptr<ProofSource> Http3ServerJS::loadCerts(const std::vector<std::string> &cert,
+                                                        const std::vector<std::string> &privkey)
+  {
+    ChainCache chains;
+    quiche::QuicheReferenceCountedPointer<ProofSource::Chain> chain = loadChain(cert[0], chains);
+
+    std::stringstream privkeystream(privkey[0], std::ios_base::in);
+
+    auto certprivkey = CertificatePrivateKey::LoadPemFromStream(&privkeystream);
+    if (certprivkey == nullptr)
+    {
+      Napi::Error::New(Env(), "LoadPemFromStream privKey  failed for Http3Server").ThrowAsJavaScriptException();
+      return nullptr;
+    }
+
+    // the first chain is the default, the others are selected by the
+    // hostnames of their leaf certificate, including wildcards
+    std::unique_ptr<ProofSourceX509> proofsource = ProofSourceX509::Create(chain, std::move(*certprivkey));
+    if (proofsource == nullptr)
+    {
+      Napi::Error::New(Env(), "LoadPemFromStream cert failed for Http3Server").ThrowAsJavaScriptException();
+      return nullptr;
+    }
+    // add additional certs to proof source
+    for (size_t i = 1; i < cert.size(); i++)
+    {
+      quiche::QuicheReferenceCountedPointer<ProofSource::Chain> addchain = loadChain(cert[i], chains);
+      std::stringstream addprivkeystream(privkey[i], std::ios_base::in);
+      auto addcertprivkey = CertificatePrivateKey::LoadPemFromStream(&addprivkeystream);
+      if (addcertprivkey == nullptr)
       {
-        Napi::Error::New(Env(), "LoadPemFromStream cert failed for Http3Server").ThrowAsJavaScriptException();
-        return;
+        Napi::Error::New(Env(), "LoadPemFromStream addprivKey  failed for Http3Server").ThrowAsJavaScriptException();
+        return nullptr;
       }
-      // add additional certs to proof source
-      for (size_t i = 1; i < cert.size(); i++)
-      {
-        std::stringstream addcertstream(cert[0], std::ios_base::in);
-        quiche::QuicheReferenceCountedPointer<ProofSource::Chain> addchain(new ProofSource::Chain(CertificateView::LoadPemFromStream(&addcertstream)));
-        std::stringstream addprivkeystream(privkey[0], std::ios_base::in);
-        auto addcertprivkey = CertificatePrivateKey::LoadPemFromStream(&privkeystream);
-        if (addcertprivkey == nullptr)
-        {
-          Napi::Error::New(Env(), "LoadPemFromStream addprivKey  failed for Http3Server").ThrowAsJavaScriptException();
-          return;
-        }
 
-        if (!proofsource->AddCertificateChain(addchain, std::move(*addcertprivkey)))
-        {
-          Napi::Error::New(Env(), "AddCertificateChain failed for Http3Server").ThrowAsJavaScriptException();
-          return;
-        }
+      if (!proofsource->AddCertificateChain(addchain, std::move(*addcertprivkey)))
+      {
+        Napi::Error::New(Env(), "AddCertificateChain failed for Http3Server").ThrowAsJavaScriptException();
+        return nullptr;
       }
+    }
+    chains_ = std::move(chains); // drops the chains, that are not used anymore
+    return proofsource;
+  }
 
-      server_ = std::make_unique<Http3Server>(this, std::move(proofsource), secret.c_str(), sconfig);
-
+  void Http3ServerJS::updateCert(const Napi::CallbackInfo &info)
+  {
+    // the http/2 transport has a cert of its own
+    if (!server_ || (!info[2].IsUndefined() && info[2].ToBoolean().Value()))
+      return;
+    std::vector<std::string> cert;
+    std::vector<std::string> privkey;
+    if (!parsePemList(info[0], cert, "No cert in array for updateCert") ||
+        !parsePemList(info[1], privkey, "No key in array for updateCert"))
+      return;
+    if (privkey.size() != cert.size())
+    {
+      Napi::Error::New(Env(), "Key and cert array length for updateCert do not match").ThrowAsJavaScriptException();
       return;
     }
+    std::unique_ptr<ProofSource> proofsource = loadCerts(cert, privkey);
+    if (!proofsource)
+      return;
+    server_->proof_source_->setCerts(std::move(proofsource));
+  }
+
+  Napi::Value Http3ServerJS::certCompressionStats(const Napi::CallbackInfo &info)
+  {
+    if (!server_)
+      return Env().Undefined();
+    const Http3ProofSource::CertCompressionStats &stats = server_->proof_source_->certCompressionStats();
+    Napi::Object retObj = Napi::Object::New(Env());
+    retObj.Set("compressed", Napi::Number::New(Env(), stats.compressed));
+    retObj.Set("cached", Napi::Number::New(Env(), stats.cached));
+    retObj.Set("uncompressedBytes", Napi::Number::New(Env(), stats.uncompressedBytes));
+    retObj.Set("compressedBytes", Napi::Number::New(Env(), stats.compressedBytes));
+    return retObj;
+  }
+
+  bool Http3ServerJS::parseRetryMode(Napi::Value value, Http3Dispatcher::RetryMode &mode)
+  {
+    std::string name = value.ToString().Utf8Value();
+    if (name == "never")
+      mode = Http3Dispatcher::kRetryNever;
+    else if (name == "load")
+      mode = Http3Dispatcher::kRetryOnLoad;
+    else if (name == "always")
+      mode = Http3Dispatcher::kRetryAlways;
     else
     {
-      Napi::Error::New(Env(), "No arguments passed to Http3Server").ThrowAsJavaScriptException();
-      return;
+      Napi::TypeError::New(Env(), "retry must be never, load or always").ThrowAsJavaScriptException();
+      return false;
     }
+    return true;
   }
 
-  Http3ServerJS::~Http3ServerJS()
+  bool Http3ServerJS::parseRetryThreshold(Napi::Value value, size_t &threshold)
   {
+    double number = value.ToNumber().DoubleValue();
+    if (!(number >= 0))
+    {
+      Napi::RangeError::New(Env(), "retryThreshold must be a non negative number").ThrowAsJavaScriptException();
+      return false;
+    }
+    threshold = static_cast<size_t>(std::min(number, 4294967295.));
+    return true;
+  }
+
+  Napi::Value Http3ServerJS::setRetry(const Napi::CallbackInfo &info)
+  {
+    if (!server_)
+      return Env().Undefined();
+    Http3Dispatcher::RetryMode mode;
+    if (!parseRetryMode(info[0], mode))
+      return Env().Undefined();
+    // without a threshold, only the mode changes
+    size_t threshold = server_->dispatcher()->retryThreshold();
+    if (!info[1].IsUndefined() && !parseRetryThreshold(info[1], threshold))
+      return Env().Undefined();
+    server_->dispatcher()->setRetryMode(mode, threshold);
+    // lets js decide on its own measures of load
+    return Napi::Number::New(Env(), server_->dispatcher()->pendingHandshakes());
+  }
+
+  bool Http3ServerJS::parseTicketKeys(Napi::Value value, std::vector<std::string> &keys)
+  {
+    if (!value.IsArray() || value.As<Napi::Array>().Length() < 1)
+    {
+      Napi::TypeError::New(Env(), "ticketKeys must be a non empty array").ThrowAsJavaScriptException();
+      return false;
+    }
+    Napi::Array keyArray = value.As<Napi::Array>();
+    for (uint32_t i = 0; i < keyArray.Length(); i++)
+    {
+      Napi::Value curval = keyArray.Get(i);
+      if (!curval.IsTypedArray() ||
+          curval.As<Napi::TypedArray>().TypedArrayType() != napi_uint8_array ||
+          curval.As<Napi::Uint8Array>().ByteLength() != kTicketKeySize)
+      {
+        Napi::TypeError::New(Env(), "a ticket key must be an Uint8Array of 48 bytes").ThrowAsJavaScriptException();
+        return false;
+      }
+      Napi::Uint8Array key = curval.As<Napi::Uint8Array>();
+      keys.push_back(std::string(reinterpret_cast<const char *>(key.Data()), key.ByteLength()));
+    }
+    return true;
+  }
+
+  void Http3ServerJS::setTicketKeys(const Napi::CallbackInfo &info)
+  {
+    std::vector<std::string> keys;
+    if (!server_ || !parseTicketKeys(info[0], keys))
+      return;
+    if (!server_->ticketCrypter().setKeys(keys))
+      Napi::Error::New(Env(), "setTicketKeys failed").ThrowAsJavaScriptException();
   }
 
   void Http3ServerJS::destroy(const Napi::CallbackInfo &info)
@@ -343,6 +535,85 @@ namespace quic
 
 
 
+  Napi::Value Http3ServerJS::connectionStats(const Napi::CallbackInfo &info)
+  {
+    if (!server_)
+      return Env().Undefined();
+    size_t maxRecords = server_->NumSessions();
+    Napi::Uint8Array target;
+    if (!info[0].IsUndefined())
+    {
+      if (!info[0].IsTypedArray() ||
+          info[0].As<Napi::TypedArray>().TypedArrayType() != napi_uint8_array)
+      {
+        Napi::TypeError::New(Env(), "connectionStats expects an Uint8Array").ThrowAsJavaScriptException();
+        return Env().Undefined();
+      }
+      // reused between scrapes, if it is large enough
+      Napi::Uint8Array given = info[0].As<Napi::Uint8Array>();
+      if (given.ByteLength() >= maxRecords * kConnStatsRecordSize)
+        target = given;
+    }
+    if (target.IsEmpty())
+      target = Napi::Uint8Array::New(Env(), maxRecords * kConnStatsRecordSize);
+    size_t count = server_->FillConnectionStats(target.Data(), maxRecords);
+    return Napi::Uint8Array::New(Env(), count * kConnStatsRecordSize, target.ArrayBuffer(), target.ByteOffset());
+  }
+
+  size_t Http3Server::FillConnectionStats(uint8_t *data, size_t maxRecords)
+  {
+    size_t count = 0;
+    dispatcher_->PerformActionOnActiveSessions([&](QuicSession *session)
+                                               {
+      if (count >= maxRecords)
+        return;
+      uint8_t *record = data + count * kConnStatsRecordSize;
+      auto put = [record](size_t offset, uint64_t value)
+      { memcpy(record + offset, &value, sizeof(value)); };
+      memset(record, 0, kConnStatsRecordSize);
+      QuicConnection *connection = session->connection();
+
+      const QuicConnectionId &cid = connection->connection_id();
+      uint8_t cidlen = std::min<size_t>(cid.length(), kConnStatsConnectionIdMaxLength);
+      record[kConnStatsConnectionIdLength] = cidlen;
+      memcpy(record + kConnStatsConnectionId, cid.data(), cidlen);
+
+      const QuicSocketAddress &peer = connection->peer_address();
+      uint16_t port = peer.port();
+      memcpy(record + kConnStatsPeerPort, &port, sizeof(port));
+      if (peer.host().IsIPv6())
+      {
+        in6_addr addr = peer.host().GetIPv6();
+        record[kConnStatsPeerFamily] = 6;
+        memcpy(record + kConnStatsPeerAddress, &addr, sizeof(addr));
+      }
+      else
+      {
+        in_addr addr = peer.host().GetIPv4();
+        record[kConnStatsPeerFamily] = 4;
+        memcpy(record + kConnStatsPeerAddress, &addr, sizeof(addr));
+      }
+
+      const QuicSentPacketManager &manager = connection->sent_packet_manager();
+      const RttStats *rtt = manager.GetRttStats();
+      put(kConnStatsMinRtt, rtt->min_rtt().ToMicroseconds());
+      put(kConnStatsSmoothedRtt, rtt->smoothed_rtt().ToMicroseconds());
+      put(kConnStatsRttVariation, rtt->mean_deviation().ToMicroseconds());
+      put(kConnStatsEstimatedSendRate, manager.BandwidthEstimate().ToBitsPerSecond());
+      put(kConnStatsCongestionWindow, manager.GetCongestionWindowInBytes());
+      put(kConnStatsBytesInFlight, manager.GetBytesInFlight());
+
+      const QuicConnectionStats &stats = connection->GetStats();
+      put(kConnStatsBytesSent, stats.bytes_sent);
+      put(kConnStatsBytesReceived, stats.bytes_received);
+      put(kConnStatsPacketsSent, stats.packets_sent);
+      put(kConnStatsPacketsLost, stats.packets_lost);
+      put(kConnStatsPacketsReceived, stats.packets_received);
+      put(kConnStatsActiveStreams, session->GetNumActiveStreams());
+      count++; });
+    return count;
+  }
+
   void Http3ServerJS::onCanWrite(const Napi::CallbackInfo &info)
   {
     server_->OnCanWrite();
@@ -405,8 +676,7 @@ namespace quic
   {
     Napi::HandleScope scope(Env());
 
-    Http3Constructors *constr = Env().GetInstanceData<Http3Constructors>();
-    Napi::Object sessionobj = constr->session.New({});
+    Napi::Object sessionobj = Http3WTSessionJS::acquire(Env());
     Http3WTSessionJS *sessionjs = Napi::ObjectWrap<Http3WTSessionJS>::Unwrap(sessionobj);
     sessionjs->setObj(session);
     sessionjs->Ref();
@@ -598,6 +868,9 @@ namespace quic
           {
             std::unique_ptr<Http3ServerBackend::WebTransportResponse> response = std::make_unique<Http3ServerBackend::WebTransportResponse>();
             response->response_headers[":status"] = std::to_string(status);
+            // per session override, applies to the whole connection
+            if (!parseCongestionControl(lobj, response->connection_options))
+              return;
             if (selectedProtocol != "") {
               absl::StatusOr<std::string> selprot = webtransport::SerializeSubprotocolResponseHeader(selectedProtocol);
               if (!selprot.ok()) {
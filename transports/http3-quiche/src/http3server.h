@@ -10,11 +10,15 @@
 #ifndef WT_HTTP3_SERVER_H
 #define WT_HTTP3_SERVER_H
 
+#include <map>
 #include <memory>
+#include <string>
 
 #include <napi.h>
 
 #include "src/librarymain.h"
+#include "src/http3dispatcher.h"
+#include "src/http3proofsource.h"
 #include "src/http3serverbackend.h"
 #include "src/napialarmfactory.h"
 #include "src/socketjswriter.h"
@@ -36,7 +40,32 @@ namespace quic
     class Http3ServerJS;
     class Http3WTSession;
 
-   
+    // byte offsets inside a record written by connectionStats, the counters
+    // are uint64 in host byte order and 8 byte aligned within the record
+    enum ConnectionStatsOffset
+    {
+        kConnStatsConnectionIdLength = 0, // uint8
+        kConnStatsPeerFamily = 1,         // uint8, 4 or 6
+        kConnStatsPeerPort = 2,           // uint16
+        kConnStatsConnectionId = 4,       // up to 20 bytes, zero padded
+        kConnStatsPeerAddress = 24,       // 4 or 16 bytes in network order, zero padded
+        kConnStatsMinRtt = 40,            // microseconds
+        kConnStatsSmoothedRtt = 48,
+        kConnStatsRttVariation = 56,
+        kConnStatsEstimatedSendRate = 64, // bits per second
+        kConnStatsCongestionWindow = 72,
+        kConnStatsBytesInFlight = 80,
+        kConnStatsBytesSent = 88,
+        kConnStatsBytesReceived = 96,
+        kConnStatsPacketsSent = 104,
+        kConnStatsPacketsLost = 112,
+        kConnStatsPacketsReceived = 120,
+        kConnStatsActiveStreams = 128,
+        kConnStatsRecordSize = 136
+    };
+
+    constexpr size_t kConnStatsConnectionIdMaxLength = 20;
+
 
     class Http3ServerJS : public Napi::ObjectWrap<Http3ServerJS>,
                           public EnvGetter
@@ -78,9 +107,19 @@ namespace quic
 
         void processBufferedChlos(const Napi::CallbackInfo &info);
 
+        Napi::Value connectionStats(const Napi::CallbackInfo &info);
+
+        void setTicketKeys(const Napi::CallbackInfo &info);
+
+        void updateCert(const Napi::CallbackInfo &info);
+
+        Napi::Value certCompressionStats(const Napi::CallbackInfo &info);
+
+        Napi::Value setRetry(const Napi::CallbackInfo &info);
+
         static void InitExports(Napi::Env env, Napi::Object exports)
         {
-            Napi::Function tplsrv = DefineClass(env, "Http3WebTransportServer", {InstanceMethod<&Http3ServerJS::destroy>("destroy", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::addPath>("addPath", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::recvPaket>("recvPaket", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::processBufferedChlos>("processBufferedChlos", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::onCanWrite>("onCanWrite", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::finishSessionRequest>("finishSessionRequest", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::setJSRequestHandler>("setJSRequestHandler", static_cast<napi_property_attributes>(napi_writable | napi_configurable))});
+            Napi::Function tplsrv = DefineClass(env, "Http3WebTransportServer", {InstanceMethod<&Http3ServerJS::destroy>("destroy", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::addPath>("addPath", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::recvPaket>("recvPaket", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::processBufferedChlos>("processBufferedChlos", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::onCanWrite>("onCanWrite", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::finishSessionRequest>("finishSessionRequest", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::setJSRequestHandler>("setJSRequestHandler", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::connectionStats>("connectionStats", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::setTicketKeys>("setTicketKeys", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::updateCert>("updateCert", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::certCompressionStats>("certCompressionStats", static_cast<napi_property_attributes>(napi_writable | napi_configurable)), InstanceMethod<&Http3ServerJS::setRetry>("setRetry", static_cast<napi_property_attributes>(napi_writable | napi_configurable))});
             exports.Set("Http3WebTransportServer", tplsrv);
         }
 
@@ -88,7 +127,31 @@ namespace quic
         void processNewSessionRequest(WebTransportSession *session, const quiche::HttpHeaderBlock &reqheadcopy,  const std::string &peer_address, WebTransportRespPromisePtr promise);
 
     protected:
+        // reads a pem string or an array of them, throws and returns false on an empty array
+        bool parsePemList(Napi::Value value, std::vector<std::string> &list, const char *emptyError);
+
+        // parsed chains by pem, shared by the proof sources of updateCert
+        using ChainCache = std::map<std::string, quiche::QuicheReferenceCountedPointer<ProofSource::Chain>>;
+
+        // returns the cached chain for pem or parses it, adds it to chains
+        quiche::QuicheReferenceCountedPointer<ProofSource::Chain> loadChain(const std::string &pem,
+                                                                            ChainCache &chains);
+
+        // builds the proof source for the cert chains and keys, throws and returns nullptr on error
+        std::unique_ptr<ProofSource> loadCerts(const std::vector<std::string> &cert,
+                                               const std::vector<std::string> &privkey);
+
+        // reads never, load or always, throws and returns false otherwise
+        bool parseRetryMode(Napi::Value value, Http3Dispatcher::RetryMode &mode);
+
+        // reads a non negative number, throws and returns false otherwise
+        bool parseRetryThreshold(Napi::Value value, size_t &threshold);
+
+        // reads an array of ticket keys, throws and returns false on error
+        bool parseTicketKeys(Napi::Value value, std::vector<std::string> &keys);
+
         std::unique_ptr<Http3Server> server_;
+        ChainCache chains_;
     };
 
     class Http3Server
@@ -97,7 +160,7 @@ namespace quic
 
     public:
         Http3Server(Http3ServerJS *js, 
-                    std::unique_ptr<ProofSource> proof_source,
+                    std::unique_ptr<Http3ProofSource> proof_source,
                     const char *secret,
                     QuicConfig config);
 
@@ -115,8 +178,19 @@ namespace quic
 
         void OnCanWrite();
 
+        // upper bound for the number of records written by FillConnectionStats
+        size_t NumSessions() const { return dispatcher_->NumSessions(); }
+
+        // writes one record of kConnStatsRecordSize bytes per connection,
+        // returns the number of records
+        size_t FillConnectionStats(uint8_t *data, size_t maxRecords);
+
         Http3ServerJS *getJS() { return js_; };
 
+        Http3TicketCrypter &ticketCrypter() { return proof_source_->ticketCrypter(); }
+
+        Http3Dispatcher *dispatcher() { return static_cast<Http3Dispatcher *>(dispatcher_.get()); }
+
     private:
         Http3ServerJS *js_;
 
@@ -126,6 +200,8 @@ namespace quic
         // config_ contains non-crypto parameters that are negotiated in the crypto
         // handshake.
         QuicConfig config_;
+        // owned by crypto_config_
+        Http3ProofSource *proof_source_;
         // crypto_config_ contains crypto parameters for the handshake.
         QuicCryptoServerConfig crypto_config_;
         // crypto_config_options_ contains crypto parameters for the handshake.
@@ -13,6 +13,7 @@
 
 #include <memory>
 
+#include "quiche/quic/core/quic_tag.h"
 #include "quiche/quic/core/quic_types.h"
 #include "quiche/quic/core/web_transport_interface.h"
 #include "quiche/common/http/http_header_block.h"
@@ -65,6 +66,7 @@ namespace quic
     {
       quiche::HttpHeaderBlock response_headers;
       std::unique_ptr<Http3WTSession::Visitor> visitor;
+      QuicTagVector connection_options; // congestion control override for the connection
     };
 
     using WebTransportRespPromise = JSlikePromise<WebTransportResponse>;
@@ -87,10 +89,15 @@ namespace quic
 
     void addPath(std::string path) { paths_.insert(path); }
 
+    // congestion control applied to every new connection
+    void setConnectionOptions(const QuicTagVector &tags) { connection_options_ = tags; }
+    const QuicTagVector &connectionOptions() const { return connection_options_; }
+
   protected:
     Http3Server *server_; // unowned
     bool jshandlerequesthandler_;
     std::set<std::string> paths_;
+    QuicTagVector connection_options_;
   };
 
 } // namespace quic
@@ -43,12 +43,58 @@ namespace quic
   }
 
   Http3ServerSession::~Http3ServerSession() {
+    handshakeDone();
     DeleteConnection();
     for (auto itty = svisitors_.begin(); itty != svisitors_.end(); itty++) {
       (*itty).second->RemoveVisitorRemoveVisitor();
     }
   }
 
+  void Http3ServerSession::trackHandshake(std::shared_ptr<size_t> pending)
+  {
+    pending_handshakes_ = std::move(pending);
+    (*pending_handshakes_)++;
+  }
+
+  void Http3ServerSession::handshakeDone()
+  {
+    if (!pending_handshakes_)
+      return;
+    (*pending_handshakes_)--;
+    pending_handshakes_.reset();
+  }
+
+  void Http3ServerSession::OnTlsHandshakeComplete()
+  {
+    QuicServerSessionBase::OnTlsHandshakeComplete();
+    handshakeDone();
+  }
+
+  void Http3ServerSession::setRetried(const QuicConnectionId &odcid,
+                                      const QuicConnectionId &retry_scid)
+  {
+    retry_validated_ = true;
+    retry_odcid_ = odcid;
+    config()->SetRetrySourceConnectionIdToSend(retry_scid);
+  }
+
+  bool Http3ServerSession::FillTransportParameters(TransportParameters *params)
+  {
+    if (!QuicServerSessionBase::FillTransportParameters(params))
+      return false;
+    if (retry_validated_)
+      params->original_destination_connection_id = retry_odcid_;
+    return true;
+  }
+
+  bool Http3ServerSession::ValidateToken(absl::string_view token)
+  {
+    // checked by the dispatcher, the Retry validated the address
+    if (retry_validated_ && !token.empty() && token[0] == kRetryTokenPrefix)
+      return true;
+    return QuicServerSessionBase::ValidateToken(token);
+  }
+
   std::unique_ptr<QuicCryptoServerStreamBase>
   Http3ServerSession::CreateQuicCryptoServerStream(
       const QuicCryptoServerConfig *crypto_config,
@@ -118,4 +164,13 @@ namespace quic
       }
     }
   }
+
+  void Http3ServerSession::OnCanWrite() {
+    QuicServerSessionBase::OnCanWrite();
+    if (SupportsWebTransport()) {
+      for (auto itty = svisitors_.begin(); itty != svisitors_.end(); itty++) {
+        (*itty).second->OnCanWriteDatagrams();
+      }
+    }
+  }
 } // namespace quic
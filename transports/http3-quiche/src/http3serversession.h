@@ -34,6 +34,9 @@
 namespace quic
 {
 
+  // first byte of the tokens in Retry packets, NEW_TOKEN tokens start with 0
+  constexpr char kRetryTokenPrefix = 1;
+
   class Http3ServerSession : public QuicServerSessionBase, public Http3WTSession::VisitorRemoveVisitor 
   {
   public:
@@ -55,6 +58,8 @@ namespace quic
     void OnStreamFrame(const QuicStreamFrame &frame) override;
 
    void OnCanCreateNewOutgoingStream(bool unidirectional) override;
+   // also drains the datagram queues of the webtransport sessions
+   void OnCanWrite() override;
    void AddVisitor(const WebTransportSessionId id, Http3WTSession::Visitor *visitor) {
       svisitors_.try_emplace(id, visitor);
     }
@@ -64,6 +69,23 @@ namespace quic
                      [&](const auto& pair) { return pair.second == visitor; });
     }
 
+    bool DatagramQueueEmpty() override { return datagram_queue()->empty(); }
+
+    // counts the session in pending, until the handshake is done
+    void trackHandshake(std::shared_ptr<size_t> pending);
+
+    // the dispatcher validated the retry token of the client, odcid is the
+    // connection id of its first Initial, retry_scid the one of the Retry
+    void setRetried(const QuicConnectionId &odcid, const QuicConnectionId &retry_scid);
+
+    bool ValidateToken(absl::string_view token) override;
+
+    // the dispatcher names the connection id of the Retry as original one,
+    // if it replaced it, so the transport parameter is set here
+    bool FillTransportParameters(TransportParameters *params) override;
+
+    void OnTlsHandshakeComplete() override;
+
   protected:
     // QuicSession methods:
     QuicSpdyStream *CreateIncomingStream(QuicStreamId id) override;
@@ -96,7 +118,12 @@ namespace quic
       return QuicServerSessionBase::LocalHttpDatagramSupport();
     }
 
+    void handshakeDone();
+
     Http3ServerBackend *http3_server_backend_; // Not owned.
+    std::shared_ptr<size_t> pending_handshakes_;
+    bool retry_validated_ = false;
+    QuicConnectionId retry_odcid_;
     absl::flat_hash_map<QuicStreamId, Http3WTSession::Visitor *> svisitors_;
   };
 
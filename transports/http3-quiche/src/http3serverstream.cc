@@ -213,6 +213,9 @@ namespace quic
         if (resp->visitor != nullptr)
         {
           resp->visitor->AddVisitorRemoveVisitor(static_cast<Http3ServerSession *>(session()));
+          resp->visitor->setConnection(spdy_session()->connection());
+          if (!resp->connection_options.empty())
+            spdy_session()->connection()->ApplyConnectionOptions(resp->connection_options);
           static_cast<Http3ServerSession *>(session())->AddVisitor(id(), resp->visitor.get());
           web_transport()->SetVisitor(std::move(resp->visitor)); 
         }
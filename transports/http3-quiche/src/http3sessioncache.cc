@@ -10,46 +10,402 @@
 
 #include "src/http3sessioncache.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
 #include <memory>
+#include <vector>
 
 #include "quiche/quic/core/crypto/quic_crypto_client_config.h"
+#include "quiche/quic/core/quic_default_clock.h"
+#include "quiche/common/quiche_data_reader.h"
 
 namespace quic {
 
+namespace {
+
+// identifies the file format, changes with incompatible layouts
+constexpr absl::string_view kSessionCacheMagic("WTSCACHE2");
+
+void PutUInt32(std::string& out, uint32_t value) {
+  for (int i = 0; i < 4; i++) out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+void PutUInt64(std::string& out, uint64_t value) {
+  for (int i = 0; i < 8; i++) out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+void PutBytes(std::string& out, absl::string_view bytes) {
+  PutUInt32(out, bytes.size());
+  out.append(bytes.data(), bytes.size());
+}
+
+// the counterparts of the Put functions, little endian
+bool GetUInt32(quiche::QuicheDataReader& reader, uint32_t& value) {
+  absl::string_view bytes;
+  if (!reader.ReadStringPiece(&bytes, 4)) return false;
+  value = 0;
+  for (int i = 0; i < 4; i++)
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(bytes[i])) << (8 * i);
+  return true;
+}
+
+bool GetUInt64(quiche::QuicheDataReader& reader, uint64_t& value) {
+  absl::string_view bytes;
+  if (!reader.ReadStringPiece(&bytes, 8)) return false;
+  value = 0;
+  for (int i = 0; i < 8; i++)
+    value |= static_cast<uint64_t>(static_cast<uint8_t>(bytes[i])) << (8 * i);
+  return true;
+}
+
+bool GetBytes(quiche::QuicheDataReader& reader, absl::string_view& bytes) {
+  uint32_t len;
+  return GetUInt32(reader, len) && reader.ReadStringPiece(&bytes, len);
+}
+
+// the tickets resume sessions without a certificate check,
+// so only the owner may read the file
+bool WriteToFile(const std::string& path, absl::string_view data,
+                 bool truncate) {
+#ifdef _WIN32
+  int fd = _open(path.c_str(),
+                 _O_WRONLY | _O_CREAT | _O_BINARY | (truncate ? _O_TRUNC : _O_APPEND),
+                 _S_IREAD | _S_IWRITE);
+  if (fd < 0) return false;
+  bool ok = data.empty() ||
+            _write(fd, data.data(), static_cast<unsigned int>(data.size())) ==
+                static_cast<int>(data.size());
+  _close(fd);
+  return ok;
+#else
+  int fd = open(path.c_str(),
+                O_WRONLY | O_CREAT | (truncate ? O_TRUNC : O_APPEND), 0600);
+  if (fd < 0) return false;
+  // the mode only applies to new files, best effort for older ones
+  fchmod(fd, 0600);
+  bool ok = true;
+  size_t done = 0;
+  while (ok && done < data.size()) {
+    ssize_t written = write(fd, data.data() + done, data.size() - done);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      ok = false;
+      break;
+    }
+    done += written;
+  }
+  close(fd);
+  return ok;
+#endif
+}
+
+// replaces to atomically, so that a crash leaves either the old or the new file,
+// std::rename does not replace an existing file on windows
+bool RenameOver(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+  auto widen = [](const std::string& str) {
+    int len = MultiByteToWideChar(CP_UTF8, 0, str.data(),
+                                  static_cast<int>(str.size()), nullptr, 0);
+    std::wstring wide(len, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, str.data(), static_cast<int>(str.size()),
+                        &wide[0], len);
+    return wide;
+  };
+  return MoveFileExW(widen(from).c_str(), widen(to).c_str(),
+                     MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+int ProcessId() {
+#ifdef _WIN32
+  return _getpid();
+#else
+  return getpid();
+#endif
+}
+
+}  // namespace
+
+bool Http3SessionCache::IsValid(const Entry& entry, QuicWallTime now) {
+  if (!HasSession(entry)) return false;
+  uint64_t now_secs = now.ToUNIXSeconds();
+  // one second of wiggle room for the different clocks of quic and BoringSSL
+  return !(now_secs + 1 < entry.issued || now_secs >= entry.expires);
+}
+
+void Http3SessionCache::EvictIfFull() {
+  if (cache_entries_.size() >= max_entries_) {
+    RemoveExpiredEntries(QuicDefaultClock::Get()->WallNow());
+  }
+  if (cache_entries_.size() >= max_entries_) {
+    auto oldest = std::min_element(
+        cache_entries_.begin(), cache_entries_.end(),
+        [](const auto& a, const auto& b) {
+          return a.second.inserted < b.second.inserted;
+        });
+    cache_entries_.erase(oldest);
+  }
+}
+
+bool Http3SessionCache::OpenFile(const std::string& path, std::string& error) {
+  path_ = path;
+  std::ifstream in(path, std::ios::binary);
+  if (in) {
+    std::string content((std::istreambuf_iterator<char>(in)),
+                        std::istreambuf_iterator<char>());
+    if (absl::string_view(content).substr(0, kSessionCacheMagic.size()) ==
+        kSessionCacheMagic) {
+      quiche::QuicheDataReader reader(
+          absl::string_view(content).substr(kSessionCacheMagic.size()));
+      absl::string_view record;
+      // a record cut off by a crash ends the log
+      while (GetBytes(reader, record)) {
+        ApplyRecord(record);
+      }
+    }
+  }
+  RemoveExpiredEntries(QuicDefaultClock::Get()->WallNow());
+  Compact();
+  if (!WriteToFile(path_, absl::string_view(), false)) {
+    error = "can not write session cache file " + path;
+    path_.clear();
+    return false;
+  }
+  return true;
+}
+
+void Http3SessionCache::AppendRecord(RecordType type, const Key& key,
+                                     const Entry* entry) {
+  if (path_.empty()) return;
+  const auto& [partition, server_id] = key;
+  std::string record;
+  record.push_back(static_cast<char>(type));
+  PutBytes(record, partition);
+  PutBytes(record, server_id.host());
+  PutUInt32(record, server_id.port());
+  if (type == kRecordEntry) {
+    PutUInt64(record, entry->issued);
+    PutUInt64(record, entry->expires);
+    PutBytes(record, entry->session_bytes);
+    PutBytes(record, entry->params_bytes);
+    record.push_back(entry->application_state != nullptr ? 1 : 0);
+    if (entry->application_state != nullptr) {
+      PutBytes(record,
+               absl::string_view(reinterpret_cast<const char*>(
+                                     entry->application_state->data()),
+                                 entry->application_state->size()));
+    }
+    PutBytes(record, entry->token);
+  } else if (type == kRecordToken) {
+    PutBytes(record, entry->token);
+  }
+  std::string framed;
+  PutBytes(framed, record);
+  WriteToFile(path_, framed, false);
+  records_in_file_++;
+  // superseded records are dropped, once they dominate the log
+  if (records_in_file_ > 2 * cache_entries_.size() + 64) {
+    Compact();
+  }
+}
+
+void Http3SessionCache::ApplyRecord(absl::string_view record) {
+  quiche::QuicheDataReader reader(record);
+  uint8_t type;
+  absl::string_view partition;
+  absl::string_view host;
+  uint32_t port;
+  if (!reader.ReadUInt8(&type) || !GetBytes(reader, partition) ||
+      !GetBytes(reader, host) || !GetUInt32(reader, port) || port > 0xffff) {
+    return;
+  }
+  Key key(std::string(partition),
+          QuicServerId(std::string(host), static_cast<uint16_t>(port)));
+  auto it = cache_entries_.find(key);
+  switch (type) {
+    case kRecordEntry: {
+      Entry entry;
+      absl::string_view session_bytes, params_bytes, app_state, token;
+      uint8_t has_app_state;
+      if (!GetUInt64(reader, entry.issued) ||
+          !GetUInt64(reader, entry.expires) ||
+          !GetBytes(reader, session_bytes) || !GetBytes(reader, params_bytes) ||
+          !reader.ReadUInt8(&has_app_state) ||
+          (has_app_state && !GetBytes(reader, app_state)) ||
+          !GetBytes(reader, token)) {
+        return;
+      }
+      entry.params = std::make_unique<TransportParameters>();
+      std::string error_details;
+      if (!ParseTransportParameters(
+              ParsedQuicVersion::RFCv1(), Perspective::IS_SERVER,
+              reinterpret_cast<const uint8_t*>(params_bytes.data()),
+              params_bytes.size(), entry.params.get(), &error_details)) {
+        return;
+      }
+      entry.session_bytes = std::string(session_bytes);
+      entry.params_bytes = std::string(params_bytes);
+      if (has_app_state) {
+        entry.application_state = std::make_unique<ApplicationState>(
+            app_state.begin(), app_state.end());
+      }
+      entry.token = std::string(token);
+      entry.inserted = ++insert_count_;
+      if (it == cache_entries_.end()) {
+        EvictIfFull();
+        cache_entries_.insert(std::make_pair(key, std::move(entry)));
+      } else {
+        it->second = std::move(entry);
+      }
+      break;
+    }
+    case kRecordToken: {
+      absl::string_view token;
+      if (!GetBytes(reader, token)) {
+        return;
+      }
+      if (it == cache_entries_.end()) {
+        EvictIfFull();
+        it = cache_entries_.insert(std::make_pair(key, Entry())).first;
+        it->second.inserted = ++insert_count_;
+      }
+      it->second.token = std::string(token);
+      break;
+    }
+    case kRecordConsumed:
+      if (it != cache_entries_.end()) {
+        it->second.session.reset();
+        it->second.session_bytes.clear();
+      }
+      break;
+  }
+}
+
+void Http3SessionCache::Compact() {
+  if (path_.empty()) return;
+  // written aside and renamed, so that a crash leaves a complete log,
+  // the name is per process, but the file is still for one process only
+  std::string temp = path_ + "." + std::to_string(ProcessId()) + ".tmp";
+  if (!WriteToFile(temp, kSessionCacheMagic, true)) return;
+  std::string path = path_;
+  path_ = temp;
+  records_in_file_ = 0;
+  for (const auto& [key, entry] : cache_entries_) {
+    if (!entry.session_bytes.empty()) {
+      AppendRecord(kRecordEntry, key, &entry);
+    } else if (!entry.token.empty()) {
+      // the address validation token outlives the ticket
+      AppendRecord(kRecordToken, key, &entry);
+    }
+  }
+  path_ = path;
+  if (!RenameOver(temp, path_)) {
+    std::remove(temp.c_str());
+  }
+}
 
-void Http3SessionCache::Insert(const QuicServerId& server_id,
-                                bssl::UniquePtr<SSL_SESSION> session,
-                                const TransportParameters& params,
-                                const ApplicationState* application_state) {
-  auto it = cache_entries_.find(server_id);
+void Http3SessionCache::Insert(const std::string& partition,
+                               const QuicServerId& server_id,
+                               bssl::UniquePtr<SSL_SESSION> session,
+                               const TransportParameters& params,
+                               const ApplicationState* application_state) {
+  Key key(partition, server_id);
+  auto it = cache_entries_.find(key);
   if (it == cache_entries_.end()) {
-    it = cache_entries_.insert(std::make_pair(server_id, Entry())).first;
+    EvictIfFull();
+    it = cache_entries_.insert(std::make_pair(key, Entry())).first;
   }
+  Entry& entry = it->second;
+  entry.inserted = ++insert_count_;
   if (session != nullptr) {
-    it->second.session = std::move(session);
+    entry.issued = SSL_SESSION_get_time(session.get());
+    entry.expires = entry.issued + SSL_SESSION_get_timeout(session.get());
+    entry.session = std::move(session);
+    entry.session_bytes.clear();
   }
   if (application_state != nullptr) {
-    it->second.application_state =
+    entry.application_state =
         std::make_unique<ApplicationState>(*application_state);
   }
-  it->second.params = std::make_unique<TransportParameters>(params);
+  entry.params = std::make_unique<TransportParameters>(params);
+  if (path_.empty() || !entry.session) return;
+
+  uint8_t* session_data;
+  size_t session_len;
+  std::vector<uint8_t> params_data;
+  if (!SSL_SESSION_to_bytes(entry.session.get(), &session_data, &session_len)) {
+    return;
+  }
+  entry.session_bytes =
+      std::string(reinterpret_cast<char*>(session_data), session_len);
+  OPENSSL_free(session_data);
+  if (!SerializeTransportParameters(params, &params_data)) {
+    entry.session_bytes.clear();
+    return;
+  }
+  entry.params_bytes = std::string(params_data.begin(), params_data.end());
+  AppendRecord(kRecordEntry, key, &entry);
 }
 
 std::unique_ptr<QuicResumptionState> Http3SessionCache::Lookup(
-    const QuicServerId& server_id, QuicWallTime /*now*/,
-    const SSL_CTX* /*ctx*/) {
-  auto it = cache_entries_.find(server_id);
+    const std::string& partition, const QuicServerId& server_id,
+    QuicWallTime now, const SSL_CTX* ctx) {
+  Key key(partition, server_id);
+  auto it = cache_entries_.find(key);
   if (it == cache_entries_.end()) {
     return nullptr;
   }
 
-  if (!it->second.session) {
-    cache_entries_.erase(it);
+  if (!IsValid(it->second, now)) {
+    // quiche only sends a token together with a ticket, so a token only
+    // entry waits for the next ticket
+    if (it->second.token.empty()) {
+      cache_entries_.erase(it);
+    } else {
+      DropSession(it->second);
+    }
     return nullptr;
   }
 
   auto state = std::make_unique<QuicResumptionState>();
-  state->tls_session = std::move(it->second.session);
+  if (it->second.session) {
+    state->tls_session = std::move(it->second.session);
+  } else {
+    // loaded from the file, BoringSSL needs the context to restore it
+    const std::string& bytes = it->second.session_bytes;
+    state->tls_session = bssl::UniquePtr<SSL_SESSION>(SSL_SESSION_from_bytes(
+        reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size(), ctx));
+    if (!state->tls_session) {
+      DropSession(it->second);
+      if (it->second.token.empty()) {
+        cache_entries_.erase(it);
+      }
+      return nullptr;
+    }
+  }
+  if (!it->second.session_bytes.empty()) {
+    it->second.session_bytes.clear();
+    AppendRecord(kRecordConsumed, key, nullptr);
+  }
   if (it->second.application_state != nullptr) {
     state->application_state =
         std::make_unique<ApplicationState>(*it->second.application_state);
@@ -60,26 +416,52 @@ std::unique_ptr<QuicResumptionState> Http3SessionCache::Lookup(
   return state;
 }
 
-void Http3SessionCache::ClearEarlyData(const QuicServerId& /*server_id*/) {
-  // The simple session cache only stores 1 SSL ticket per entry, so no need to
-  // do anything here.
-}
-
-void Http3SessionCache::OnNewTokenReceived(const QuicServerId& server_id,
-                                            absl::string_view token) {
-  auto it = cache_entries_.find(server_id);
-  if (it == cache_entries_.end()) {
+void Http3SessionCache::OnNewTokenReceived(const std::string& partition,
+                                           const QuicServerId& server_id,
+                                           absl::string_view token) {
+  if (token.empty()) {
     return;
   }
+  Key key(partition, server_id);
+  auto it = cache_entries_.find(key);
+  if (it == cache_entries_.end()) {
+    // NEW_TOKEN may arrive before the ticket
+    EvictIfFull();
+    it = cache_entries_.insert(std::make_pair(key, Entry())).first;
+    it->second.inserted = ++insert_count_;
+  }
   it->second.token = std::string(token);
+  AppendRecord(kRecordToken, key, &it->second);
+}
+
+void Http3SessionCache::RemoveExpiredEntries(QuicWallTime now) {
+  for (auto it = cache_entries_.begin(); it != cache_entries_.end();) {
+    if (!IsValid(it->second, now)) {
+      if (it->second.token.empty()) {
+        it = cache_entries_.erase(it);
+        continue;
+      }
+      DropSession(it->second);
+    }
+    ++it;
+  }
 }
 
-void Http3SessionCache::RemoveExpiredEntries(QuicWallTime /*now*/) {
-  // The simple session cache does not support removing expired entries.
+void Http3SessionCache::DropSession(Entry& entry) {
+  entry.session.reset();
+  entry.session_bytes.clear();
 }
 
-void Http3SessionCache::Clear() { cache_entries_.clear(); }
+void Http3SessionCache::Clear(const std::string& partition) {
+  for (auto it = cache_entries_.begin(); it != cache_entries_.end();) {
+    if (it->first.first == partition) {
+      it = cache_entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  Compact();
+}
 
 
 }  // namespace quic
-
@@ -12,45 +12,139 @@
 #ifndef HTTP3_SESSION_CACHE_H
 #define HTTP3_SESSION_CACHE_H
 
+#include <map>
 #include <memory>
+#include <string>
+#include <utility>
 
 #include "quiche/quic/core/crypto/quic_crypto_client_config.h"
 #include "quiche/quic/core/crypto/transport_parameters.h"
 
 namespace quic {
 
-// Http3SessionCache provides a simple implementation of SessionCache that
-// stores only one QuicResumptionState per QuicServerId. No limit is placed on
-// the total number of entries in the cache. When Lookup is called, if a cache
-// entry exists for the provided QuicServerId, the entry will be removed from
+// upper bound of servers, for which tickets are kept
+constexpr size_t kSessionCacheMaxEntries = 1024;
+
+// Http3SessionCache provides a simple implementation of a session cache that
+// stores only one QuicResumptionState per QuicServerId and partition. Clients
+// verifying the server differently, e.g. pinned certificate hashes versus
+// the PKI, use different partitions, so that none resumes a session, which
+// the other one verified. Entries expire with
+// the lifetime of their ticket, if the cache is full, the least recently
+// inserted entry is evicted. When Lookup is called, if a cache
+// entry exists for the provided QuicServerId, the ticket will be removed from
 // the cached when it is returned.
-// TODO(fayang): Remove Http3SessionCache by using QuicClientSessionCache.
-class Http3SessionCache : public SessionCache {
+// Optionally, the cache is persisted in an append only log, so that tickets
+// and address validation tokens survive a restart of the process. Tokens
+// are kept after their ticket was used. The log is readable by the owner
+// only and must not be shared by several processes.
+class Http3SessionCache {
  public:
-  Http3SessionCache() = default;
-  ~Http3SessionCache() override = default;
+  explicit Http3SessionCache(size_t max_entries = kSessionCacheMaxEntries)
+      : max_entries_(max_entries) {}
 
-  void Insert(const QuicServerId& server_id,
+  // loads the entries stored at path by an earlier process and appends
+  // all changes from now on, returns false and sets error on failure
+  bool OpenFile(const std::string& path, std::string& error);
+
+  // the SessionCache interface, with the partition of the client
+  void Insert(const std::string& partition, const QuicServerId& server_id,
               bssl::UniquePtr<SSL_SESSION> session,
               const TransportParameters& params,
-              const ApplicationState* application_state) override;
-  std::unique_ptr<QuicResumptionState> Lookup(const QuicServerId& server_id,
+              const ApplicationState* application_state);
+  std::unique_ptr<QuicResumptionState> Lookup(const std::string& partition,
+                                              const QuicServerId& server_id,
                                               QuicWallTime now,
-                                              const SSL_CTX* ctx) override;
-  void ClearEarlyData(const QuicServerId& server_id) override;
-  void OnNewTokenReceived(const QuicServerId& server_id,
-                          absl::string_view token) override;
-  void RemoveExpiredEntries(QuicWallTime now) override;
-  void Clear() override;
+                                              const SSL_CTX* ctx);
+  void OnNewTokenReceived(const std::string& partition,
+                          const QuicServerId& server_id,
+                          absl::string_view token);
+  void RemoveExpiredEntries(QuicWallTime now);
+  void Clear(const std::string& partition);
+
+  size_t size() const { return cache_entries_.size(); }
 
  private:
   struct Entry {
     bssl::UniquePtr<SSL_SESSION> session;
+    std::string session_bytes; // serialized session, if persisted or loaded
     std::unique_ptr<TransportParameters> params;
+    std::string params_bytes;
     std::unique_ptr<ApplicationState> application_state;
     std::string token;
+    uint64_t issued = 0; // unix seconds
+    uint64_t expires = 0;
+    uint64_t inserted = 0; // order of insertion, for eviction
   };
-  std::map<QuicServerId, Entry> cache_entries_;
+
+  enum RecordType : uint8_t {
+    kRecordEntry = 1,
+    kRecordToken = 2,
+    kRecordConsumed = 3 // the ticket was used
+  };
+
+  // verification partition and server
+  using Key = std::pair<std::string, QuicServerId>;
+
+  static bool HasSession(const Entry& entry) {
+    return entry.session || !entry.session_bytes.empty();
+  }
+  // true, if the entry holds an unexpired ticket
+  static bool IsValid(const Entry& entry, QuicWallTime now);
+  // keeps the token of the entry
+  static void DropSession(Entry& entry);
+
+  void EvictIfFull();
+
+  // file backing, all no-ops without a file
+  void AppendRecord(RecordType type, const Key& key, const Entry* entry);
+  void ApplyRecord(absl::string_view record);
+  void Compact();
+
+  std::map<Key, Entry> cache_entries_;
+  size_t max_entries_;
+  uint64_t insert_count_ = 0;
+  std::string path_;
+  size_t records_in_file_ = 0;
+};
+
+// QuicCryptoClientConfig owns its cache, this forwards to a cache
+// shared by all clients of a thread, so that a new client resumes the
+// sessions of earlier ones, which verified the server the same way
+class Http3SharedSessionCache : public SessionCache {
+ public:
+  Http3SharedSessionCache(std::shared_ptr<Http3SessionCache> cache,
+                          std::string partition)
+      : cache_(std::move(cache)), partition_(std::move(partition)) {}
+  ~Http3SharedSessionCache() override = default;
+
+  void Insert(const QuicServerId& server_id,
+              bssl::UniquePtr<SSL_SESSION> session,
+              const TransportParameters& params,
+              const ApplicationState* application_state) override {
+    cache_->Insert(partition_, server_id, std::move(session), params,
+                   application_state);
+  }
+  std::unique_ptr<QuicResumptionState> Lookup(const QuicServerId& server_id,
+                                              QuicWallTime now,
+                                              const SSL_CTX* ctx) override {
+    return cache_->Lookup(partition_, server_id, now, ctx);
+  }
+  void ClearEarlyData(const QuicServerId& /*server_id*/) override {
+    // only one ticket per entry, which is removed by Lookup
+  }
+  void OnNewTokenReceived(const QuicServerId& server_id,
+                          absl::string_view token) override {
+    cache_->OnNewTokenReceived(partition_, server_id, token);
+  }
+  void RemoveExpiredEntries(QuicWallTime now) override {
+    cache_->RemoveExpiredEntries(now);
+  }
+  void Clear() override { cache_->Clear(partition_); }
+
+ private:
+  std::shared_ptr<Http3SessionCache> cache_;
+  std::string partition_;
 };
 
 
@@ -0,0 +1,243 @@
+// Copyright (c) 2022 Marten Richter or other contributers (see commit). All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/http3wtbroadcast.h"
+
+#include <algorithm>
+
+namespace quic
+{
+    Http3WTBroadcast::~Http3WTBroadcast()
+    {
+        for (Http3WTStream *stream : members_)
+            stream->leaveBroadcast(this);
+    }
+
+    bool Http3WTBroadcast::addStream(Http3WTStream *stream)
+    {
+        if (!stream || stream->gone())
+            return false;
+        if (std::find(members_.begin(), members_.end(), stream) != members_.end())
+            return true;
+        members_.push_back(stream);
+        stream->joinBroadcast(this);
+        return true;
+    }
+
+    void Http3WTBroadcast::removeStream(Http3WTStream *stream)
+    {
+        auto it = std::find(members_.begin(), members_.end(), stream);
+        if (it == members_.end())
+            return;
+        members_.erase(it);
+        stream->leaveBroadcast(this);
+    }
+
+    void Http3WTBroadcast::streamGone(Http3WTStream *stream)
+    {
+        members_.erase(std::remove(members_.begin(), members_.end(), stream), members_.end());
+    }
+
+    void Http3WTBroadcast::write(const char *data, size_t len, uint32_t &written, uint32_t &dropped)
+    {
+        written = 0;
+        dropped = 0;
+        if (len == 0)
+            return;
+        std::shared_ptr<const std::string> payload = std::make_shared<const std::string>(data, len);
+        std::shared_ptr<const std::string> framed; // for members in message mode, built once
+        for (Http3WTStream *stream : members_)
+        {
+            if (stream->messageMode() && !framed)
+                framed = std::make_shared<const std::string>(Http3WTStream::frameMessage(data, len));
+            if (stream->writeSharedInt(stream->messageMode() ? framed : payload, buffer_))
+                written++;
+            else
+                dropped++;
+        }
+    }
+
+    Http3WTDatagramBroadcast::~Http3WTDatagramBroadcast()
+    {
+        for (Http3WTSession *session : members_)
+            session->leaveBroadcast(this);
+    }
+
+    bool Http3WTDatagramBroadcast::addSession(Http3WTSession *session)
+    {
+        if (!session || !session->session_)
+            return false;
+        if (std::find(members_.begin(), members_.end(), session) != members_.end())
+            return true;
+        members_.push_back(session);
+        session->joinBroadcast(this);
+        return true;
+    }
+
+    void Http3WTDatagramBroadcast::removeSession(Http3WTSession *session)
+    {
+        auto it = std::find(members_.begin(), members_.end(), session);
+        if (it == members_.end())
+            return;
+        members_.erase(it);
+        session->leaveBroadcast(this);
+    }
+
+    void Http3WTDatagramBroadcast::sessionGone(Http3WTSession *session)
+    {
+        members_.erase(std::remove(members_.begin(), members_.end(), session), members_.end());
+    }
+
+    void Http3WTDatagramBroadcast::write(absl::string_view datagram, uint32_t &sent, uint32_t &blocked,
+                                         uint32_t &tooBig, uint32_t &dropped, uint32_t &failed)
+    {
+        sent = 0;
+        blocked = 0;
+        tooBig = 0;
+        dropped = 0;
+        failed = 0;
+        for (Http3WTSession *session : members_)
+        {
+            if (!session->session_)
+            {
+                failed++; // closed, but not yet gone
+                continue;
+            }
+            // quiche copies the datagram for every session
+            switch (session->sendDatagram(datagram))
+            {
+            case kDatagramSuccess:
+                sent++;
+                break;
+            case kDatagramBlocked:
+                blocked++;
+                break;
+            case kDatagramTooBig:
+                tooBig++;
+                break;
+            case kDatagramDropped:
+                dropped++;
+                break;
+            default:
+                failed++;
+                break;
+            };
+        }
+    }
+
+    Http3WTBroadcastJS::Http3WTBroadcastJS(const Napi::CallbackInfo &info)
+        : Napi::ObjectWrap<Http3WTBroadcastJS>(info)
+    {
+        bool buffer = true;
+        if (!info[0].IsUndefined())
+        {
+            Napi::Object lobj = info[0].ToObject();
+            if (lobj.Has("policy") && !(lobj).Get("policy").IsUndefined())
+            {
+                std::string policy = (lobj).Get("policy").ToString().Utf8Value();
+                if (policy == "drop")
+                {
+                    buffer = false;
+                }
+                else if (policy != "buffer")
+                {
+                    Napi::TypeError::New(Env(), "policy must be drop or buffer").ThrowAsJavaScriptException();
+                    return;
+                }
+            }
+        }
+        broadcast_ = std::make_unique<Http3WTBroadcast>(buffer);
+    }
+
+    Http3WTStream *Http3WTBroadcastJS::streamArg(const Napi::CallbackInfo &info)
+    {
+        Http3Constructors *constr = Env().GetInstanceData<Http3Constructors>();
+        if (!info[0].IsObject() || !info[0].As<Napi::Object>().InstanceOf(constr->stream.Value()))
+        {
+            Napi::TypeError::New(Env(), "expects a native stream").ThrowAsJavaScriptException();
+            return nullptr;
+        }
+        return Napi::ObjectWrap<Http3WTStreamJS>::Unwrap(info[0].As<Napi::Object>())->getObj();
+    }
+
+    Napi::Value Http3WTBroadcastJS::add(const Napi::CallbackInfo &info)
+    {
+        Http3WTStream *stream = streamArg(info);
+        return Napi::Value::From(Env(), broadcast_->addStream(stream));
+    }
+
+    void Http3WTBroadcastJS::remove(const Napi::CallbackInfo &info)
+    {
+        Http3WTStream *stream = streamArg(info);
+        if (stream)
+            broadcast_->removeStream(stream);
+    }
+
+    Napi::Value Http3WTBroadcastJS::write(const Napi::CallbackInfo &info)
+    {
+        if (!info[0].IsTypedArray() ||
+            info[0].As<Napi::TypedArray>().TypedArrayType() != napi_uint8_array)
+        {
+            Napi::TypeError::New(Env(), "write expects an Uint8Array").ThrowAsJavaScriptException();
+            return Env().Undefined();
+        }
+        Napi::Uint8Array buffer = info[0].As<Napi::Uint8Array>();
+        uint32_t written;
+        uint32_t dropped;
+        broadcast_->write(reinterpret_cast<const char *>(buffer.Data()), buffer.ByteLength(),
+                          written, dropped);
+
+        Napi::Object retObj = Napi::Object::New(Env());
+        retObj.Set("written", written);
+        retObj.Set("dropped", dropped);
+        return retObj;
+    }
+
+    Http3WTSession *Http3WTDatagramBroadcastJS::sessionArg(const Napi::CallbackInfo &info)
+    {
+        Http3Constructors *constr = Env().GetInstanceData<Http3Constructors>();
+        if (!info[0].IsObject() || !info[0].As<Napi::Object>().InstanceOf(constr->session.Value()))
+            return nullptr; // e.g. a http/2 session
+        return Napi::ObjectWrap<Http3WTSessionJS>::Unwrap(info[0].As<Napi::Object>())->getObj();
+    }
+
+    Napi::Value Http3WTDatagramBroadcastJS::add(const Napi::CallbackInfo &info)
+    {
+        Http3WTSession *session = sessionArg(info);
+        return Napi::Value::From(Env(), broadcast_->addSession(session));
+    }
+
+    void Http3WTDatagramBroadcastJS::remove(const Napi::CallbackInfo &info)
+    {
+        Http3WTSession *session = sessionArg(info);
+        if (session)
+            broadcast_->removeSession(session);
+    }
+
+    Napi::Value Http3WTDatagramBroadcastJS::write(const Napi::CallbackInfo &info)
+    {
+        if (!info[0].IsTypedArray() ||
+            info[0].As<Napi::TypedArray>().TypedArrayType() != napi_uint8_array)
+        {
+            Napi::TypeError::New(Env(), "write expects an Uint8Array").ThrowAsJavaScriptException();
+            return Env().Undefined();
+        }
+        Napi::Uint8Array buffer = info[0].As<Napi::Uint8Array>();
+        uint32_t sent;
+        uint32_t blocked;
+        uint32_t tooBig;
+        uint32_t dropped;
+        uint32_t failed;
+        broadcast_->write(absl::string_view(reinterpret_cast<const char *>(buffer.Data()), buffer.ByteLength()),
+                          sent, blocked, tooBig, dropped, failed);
+
+        Napi::Object retObj = Napi::Object::New(Env());
+        retObj.Set("sent", sent);
+        retObj.Set("blocked", blocked);
+        retObj.Set("tooBig", tooBig);
+        retObj.Set("dropped", dropped);
+        retObj.Set("failed", failed);
+        return retObj;
+    }
+}
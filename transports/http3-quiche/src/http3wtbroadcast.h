@@ -0,0 +1,157 @@
+// Copyright (c) 2022 Marten Richter or other contributers (see commit). All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef HTTP3_WT_BROADCAST_H_
+#define HTTP3_WT_BROADCAST_H_
+
+#include <napi.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/librarymain.h"
+#include "src/http3wtstreamvisitor.h"
+#include "src/http3wtsessionvisitor.h"
+
+namespace quic
+{
+    class Http3WTBroadcastJS;
+
+    // writes one payload to many streams, also of different sessions,
+    // every stream keeps its own send order and send group
+    class Http3WTBroadcast
+    {
+        friend Http3WTBroadcastJS;
+
+    public:
+        Http3WTBroadcast(bool buffer) : buffer_(buffer) {}
+
+        ~Http3WTBroadcast();
+
+        bool addStream(Http3WTStream *stream);
+        void removeStream(Http3WTStream *stream);
+
+        // called by a member stream, when it goes away
+        void streamGone(Http3WTStream *stream);
+
+        // the payload is copied once and referenced by all streams
+        void write(const char *data, size_t len, uint32_t &written, uint32_t &dropped);
+
+        size_t size() const { return members_.size(); }
+
+    protected:
+        // slow streams queue the payload up to their high water marks (buffer)
+        // or drop it (!buffer)
+        bool buffer_;
+        std::vector<Http3WTStream *> members_; // unowned
+    };
+
+    // sends one datagram to many sessions
+    class Http3WTDatagramBroadcast
+    {
+    public:
+        ~Http3WTDatagramBroadcast();
+
+        bool addSession(Http3WTSession *session);
+        void removeSession(Http3WTSession *session);
+
+        // called by a member session, when it goes away
+        void sessionGone(Http3WTSession *session);
+
+        // counts the sessions per outcome, closed sessions count as failed
+        void write(absl::string_view datagram, uint32_t &sent, uint32_t &blocked,
+                   uint32_t &tooBig, uint32_t &dropped, uint32_t &failed);
+
+        size_t size() const { return members_.size(); }
+
+    protected:
+        std::vector<Http3WTSession *> members_; // unowned
+    };
+
+    class Http3WTBroadcastJS : public Napi::ObjectWrap<Http3WTBroadcastJS>
+    {
+    public:
+        Http3WTBroadcastJS(const Napi::CallbackInfo &info);
+
+        Napi::Value add(const Napi::CallbackInfo &info);
+
+        void remove(const Napi::CallbackInfo &info);
+
+        Napi::Value write(const Napi::CallbackInfo &info);
+
+        Napi::Value getSize(const Napi::CallbackInfo &info)
+        {
+            return Napi::Value::From(Env(), broadcast_->size());
+        }
+
+        static void InitExports(Napi::Env env, Napi::Object exports)
+        {
+            Napi::Function tplbc =
+                DefineClass(env, "Http3WTBroadcastGroup",
+                            {
+                                InstanceMethod<&Http3WTBroadcastJS::add>("add",
+                                                                         static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                InstanceMethod<&Http3WTBroadcastJS::remove>("remove",
+                                                                            static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                InstanceMethod<&Http3WTBroadcastJS::write>("write",
+                                                                           static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                InstanceMethod<&Http3WTBroadcastJS::getSize>("getSize",
+                                                                             static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                            });
+            exports.Set("Http3WTBroadcastGroup", tplbc);
+        }
+
+    protected:
+        Http3WTStream *streamArg(const Napi::CallbackInfo &info);
+
+        std::unique_ptr<Http3WTBroadcast> broadcast_;
+    };
+
+    class Http3WTDatagramBroadcastJS : public Napi::ObjectWrap<Http3WTDatagramBroadcastJS>
+    {
+    public:
+        Http3WTDatagramBroadcastJS(const Napi::CallbackInfo &info)
+            : Napi::ObjectWrap<Http3WTDatagramBroadcastJS>(info),
+              broadcast_(std::make_unique<Http3WTDatagramBroadcast>())
+        {
+        }
+
+        Napi::Value add(const Napi::CallbackInfo &info);
+
+        void remove(const Napi::CallbackInfo &info);
+
+        Napi::Value write(const Napi::CallbackInfo &info);
+
+        Napi::Value getSize(const Napi::CallbackInfo &info)
+        {
+            return Napi::Value::From(Env(), broadcast_->size());
+        }
+
+        static void InitExports(Napi::Env env, Napi::Object exports)
+        {
+            Napi::Function tpldbc =
+                DefineClass(env, "Http3WTDatagramBroadcastGroup",
+                            {
+                                InstanceMethod<&Http3WTDatagramBroadcastJS::add>("add",
+                                                                                 static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                InstanceMethod<&Http3WTDatagramBroadcastJS::remove>("remove",
+                                                                                    static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                InstanceMethod<&Http3WTDatagramBroadcastJS::write>("write",
+                                                                                   static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                InstanceMethod<&Http3WTDatagramBroadcastJS::getSize>("getSize",
+                                                                                     static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                            });
+            exports.Set("Http3WTDatagramBroadcastGroup", tpldbc);
+        }
+
+    protected:
+        // returns nullptr for non native sessions
+        Http3WTSession *sessionArg(const Napi::CallbackInfo &info);
+
+        std::unique_ptr<Http3WTDatagramBroadcast> broadcast_;
+    };
+}
+
+#endif
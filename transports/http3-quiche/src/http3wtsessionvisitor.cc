@@ -3,6 +3,13 @@
 // found in the LICENSE file.
 
 #include "src/http3wtsessionvisitor.h"
+#include "src/http3wtbroadcast.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "quiche/quic/core/quic_default_clock.h"
 
 namespace quic
 {
@@ -14,8 +21,13 @@ namespace quic
         if (vrvis_) {
             vrvis_->RemoveVisitor(this);
         }
+        session_->quic_session_ = nullptr;
         if (sessobj) {
-            sessobj->Unref();
+            // js drops the wrapper, when it receives the close
+            if (session_->close_delivered_)
+                sessobj->recycle();
+            else
+                sessobj->Unref();
         } else
             delete session_;
         session_ = nullptr;
@@ -26,7 +38,12 @@ namespace quic
     {
         // printf("OnSessionClosed %d %x %x\n", getpid(), this, session_);
         session_->session_ = nullptr;
+        session_->connection_ = nullptr;
+        session_->quic_session_ = nullptr;
+        if (session_->datagram_ring_)
+            session_->datagram_ring_->flush(); // datagrams go before the close
         session_->getJS()->processSessionClose(error_code, error_message);
+        session_->close_delivered_ = true;
     }
                         
 
@@ -42,12 +59,10 @@ namespace quic
             {
                 return;
             }
-            Http3WTStream *wtstream = new Http3WTStream(stream);
+            Http3WTStream *wtstream = session_->createStream(stream, session_->stream_message_mode_);
             QUIC_DVLOG(1)
                 << "Http3WTSession received a bidirectional stream "
                 << stream->GetStreamId();
-            stream->SetVisitor(
-                std::make_unique<Http3WTStream::Visitor>(wtstream));
             session_->getJS()->processStream(true, true, 0/*sendOrder*/, 0 /*sendGroup*/, static_cast<Http3WTStream *>(wtstream));
             stream->visitor()->OnCanRead();
         }
@@ -65,11 +80,9 @@ namespace quic
             {
                 return;
             }
-            Http3WTStream *wtstream = new Http3WTStream(stream);
+            Http3WTStream *wtstream = session_->createStream(stream, session_->stream_message_mode_);
             QUIC_DVLOG(1)
                 << "Http3WTSession received a unidirectional stream";
-            stream->SetVisitor(
-                std::make_unique<Http3WTStream::Visitor>(wtstream));
             session_->getJS()->processStream(true, false, 0/*sendOrder*/, 0 /*sendGroup*/, static_cast<Http3WTStream *>(wtstream));
             stream->visitor()->OnCanRead();
         }
@@ -78,6 +91,12 @@ namespace quic
     void Http3WTSession::Visitor::OnDatagramReceived(absl::string_view datagram)
     {
         // printf("OnDatagramReceived %d %x %x\n", getpid(), this, session_);
+        if (session_->datagram_ring_)
+        {
+            if (session_->datagram_ring_->push(datagram))
+                return;
+            session_->datagram_ring_->flush(); // keep the order for an oversized datagram
+        }
         session_->getJS()->processDatagramReceived(new std::string(datagram));
         /*auto buffer = MakeUniqueBuffer(&allocator_, datagram.size());
         memcpy(buffer.get(), datagram.data(), datagram.size());
@@ -95,16 +114,142 @@ namespace quic
         }
     }
 
+    Napi::Object Http3WTSessionJS::acquire(Napi::Env env)
+    {
+        Http3Constructors *constr = env.GetInstanceData<Http3Constructors>();
+        if (constr->sessionPool.empty())
+            return constr->session.New({});
+        Http3WTSessionJS *sessjs = constr->sessionPool.back();
+        constr->sessionPool.pop_back();
+        Napi::Object sessobj = sessjs->Value();
+        sessjs->Unref(); // the caller takes its own reference
+        return sessobj;
+    }
+
+    void Http3WTSessionJS::recycle()
+    {
+        Http3Constructors *constr = Env().GetInstanceData<Http3Constructors>();
+        if (constr->sessionPool.size() >= kMaxPooledWrappers)
+        {
+            Unref();
+            return;
+        }
+        {
+            Napi::HandleScope scope(Env());
+            Value().Delete("jsobj");
+        }
+        wtsession_.reset();
+        constr->sessionPool.push_back(this); // keeps the reference
+    }
+
+    Http3WTDatagramRing::Http3WTDatagramRing(Http3WTSession *session, Napi::Uint8Array ring)
+        : session_(session), ring_(Napi::Persistent(ring)), data_(ring.Data()), size_(ring.ByteLength()),
+          alarm_factory_(QuicDefaultClock::Get(), this)
+    {
+    }
+
+    Http3WTDatagramRing::~Http3WTDatagramRing()
+    {
+        if (alarm_)
+            alarm_->PermanentCancel();
+    }
+
+    bool Http3WTDatagramRing::push(absl::string_view datagram)
+    {
+        if (datagram.size() > size_)
+            return false;
+        if (pos_ + datagram.size() > size_)
+        {
+            flush(); // js is done with the batch at the start of the ring
+            pos_ = 0;
+        }
+        memcpy(data_ + pos_, datagram.data(), datagram.size());
+        index_.push_back(static_cast<uint32_t>(pos_));
+        index_.push_back(static_cast<uint32_t>(datagram.size()));
+        pos_ += datagram.size();
+        if (!alarm_)
+        {
+            Napi::HandleScope scope(getEnv());
+            alarm_.reset(alarm_factory_.CreateAlarm(new AlarmDelegate(this)));
+        }
+        if (!alarm_->IsSet())
+            alarm_->Set(QuicDefaultClock::Get()->Now()); // fires after the pending io
+        return true;
+    }
+
+    void Http3WTDatagramRing::flush()
+    {
+        if (alarm_)
+            alarm_->Cancel();
+        if (index_.empty())
+            return;
+        std::vector<uint32_t> index;
+        index.swap(index_); // js may flush again from the callback
+        session_->getJS()->processDatagramsReceived(index);
+    }
+
+    Http3WTStream *Http3WTSession::createStream(WebTransportStream *stream, bool messageMode)
+    {
+        Http3WTStream *wtstream = new Http3WTStream(stream, send_budget_, deadlines_);
+        // set before any data is read, js learns the mode with the stream
+        if (messageMode)
+            wtstream->setMessageMode(true, max_message_size_);
+        stream->SetVisitor(
+            std::make_unique<Http3WTStream::Visitor>(wtstream));
+        return wtstream;
+    }
+
     void Http3WTSession::orderSessionStatsInt()
     {
-        if (session_)
-            getJS()->processSessionStats(session_->GetSessionStats());
+        if (!session_)
+            return;
+        webtransport::SessionStats stats = session_->GetSessionStats();
+        if (datagram_queue_)
+            stats.datagram_stats.expired_outgoing += datagram_queue_->dropped();
+        getJS()->processSessionStats(stats);
     }
 
     void Http3WTSession::orderDatagramStatsInt()
     {
-        if (session_)
-            getJS()->processDatagramStats(session_->GetDatagramStats());
+        if (!session_)
+            return;
+        webtransport::DatagramStats stats = session_->GetDatagramStats();
+        if (datagram_queue_)
+            stats.expired_outgoing += datagram_queue_->dropped(); // dropped before reaching quiche
+        getJS()->processDatagramStats(stats);
+    }
+
+    bool Http3WTSession::fillStatsInt(uint64_t *stats)
+    {
+        if (!session_)
+            return false;
+        webtransport::DatagramStats datagrams = session_->GetDatagramStats();
+        stats[kSessionStatsDatagramsExpiredOutgoing] =
+            datagrams.expired_outgoing + (datagram_queue_ ? datagram_queue_->dropped() : 0);
+        stats[kSessionStatsDatagramsLostOutgoing] = datagrams.lost_outgoing;
+        if (!connection_)
+        {
+            // not yet attached, the connection counters stay zero
+            for (size_t i = kSessionStatsMinRtt; i < kSessionStatsDatagramsExpiredOutgoing; i++)
+                stats[i] = 0;
+            return true;
+        }
+        const QuicSentPacketManager &manager = connection_->sent_packet_manager();
+        const RttStats *rtt = manager.GetRttStats();
+        stats[kSessionStatsMinRtt] = rtt->min_rtt().ToMicroseconds();
+        stats[kSessionStatsSmoothedRtt] = rtt->smoothed_rtt().ToMicroseconds();
+        stats[kSessionStatsRttVariation] = rtt->mean_deviation().ToMicroseconds();
+        stats[kSessionStatsEstimatedSendRate] = manager.BandwidthEstimate().ToBitsPerSecond();
+        stats[kSessionStatsCongestionWindow] = manager.GetCongestionWindowInBytes();
+        stats[kSessionStatsBytesInFlight] = manager.GetBytesInFlight();
+        // the counters are those of the whole connection, which may carry further sessions
+        const QuicConnectionStats &connstats = connection_->GetStats();
+        stats[kSessionStatsPacketsSent] = connstats.packets_sent;
+        stats[kSessionStatsPacketsLost] = connstats.packets_lost;
+        stats[kSessionStatsPacketsReceived] = connstats.packets_received;
+        stats[kSessionStatsBytesSent] = connstats.bytes_sent;
+        stats[kSessionStatsBytesReceived] = connstats.bytes_received;
+        return true;
     }
 
     size_t Http3WTSession::getMaxDatagramSizeInt()
@@ -123,11 +268,13 @@ namespace quic
             QUIC_DVLOG(1)
                 << "Http3WTSessionVisitor opens a bidirectional stream";
             WebTransportStream *stream = session_->OpenOutgoingBidirectionalStream();
-            webtransport::StreamPriority prio = ordBidiStreams.front();
+            OrderedStream ordered = ordBidiStreams.front();
+            webtransport::StreamPriority prio = ordered.priority;
             stream->SetPriority(prio);
-            Http3WTStream *wtstream = new Http3WTStream(stream);
-            stream->SetVisitor(
-                std::make_unique<Http3WTStream::Visitor>(wtstream));
+            Http3WTStream *wtstream = createStream(stream, ordered.message_mode);
+            wtstream->setSendGroup(prio.send_group_id);
+            if (ordered.deadline.IsInitialized())
+                wtstream->setDeadline(ordered.deadline);
             getJS()->processStream(false, true, prio.send_order, prio.send_group_id, static_cast<Http3WTStream *>(wtstream));
             stream->visitor()->OnCanWrite();
             ordBidiStreams.pop();
@@ -161,11 +308,13 @@ namespace quic
             QUIC_DVLOG(1)
                 << "Http3WTSessionVisitor opened a unidirectional stream";
             WebTransportStream *stream = session_->OpenOutgoingUnidirectionalStream();
-            webtransport::StreamPriority prio = ordUnidiStreams.front();
+            OrderedStream ordered = ordUnidiStreams.front();
+            webtransport::StreamPriority prio = ordered.priority;
             stream->SetPriority(prio);
-            Http3WTStream *wtstream = new Http3WTStream(stream);
-            stream->SetVisitor(
-                std::make_unique<Http3WTStream::Visitor>(wtstream));
+            Http3WTStream *wtstream = createStream(stream, ordered.message_mode);
+            wtstream->setSendGroup(prio.send_group_id);
+            if (ordered.deadline.IsInitialized())
+                wtstream->setDeadline(ordered.deadline);
 
             getJS()->processStream(false, false, prio.send_order, prio.send_group_id, static_cast<Http3WTStream *>(wtstream));
             stream->visitor()->OnCanWrite();
@@ -173,7 +322,8 @@ namespace quic
         }
     }
 
-    webtransport::DatagramStatus Http3WTSession::writeDatagramInt(char *buffer, size_t len, Napi::ObjectReference *bufferhandle)
+    Http3DatagramCode Http3WTSession::writeDatagramInt(char *buffer, size_t len, Napi::ObjectReference *bufferhandle,
+                                                       std::string &message)
     {
         // printf("Datagram write %d %x %x\n", getpid(), this, session_ );
         if (!session_)
@@ -181,21 +331,142 @@ namespace quic
             // printf("Datagram session gone %d %x %x\n", getpid(), this, session_);
             bufferhandle->Unref(); // release the outgoing buffer
             delete bufferhandle;   // free the handle object
-            webtransport::DatagramStatus status(webtransport::DatagramStatusCode::kInternalError, "Session not present");
-            return status;
+            message = "Session not present";
+            return kDatagramInternalError;
         }
-        webtransport::DatagramStatus status = session_->SendOrQueueDatagram(absl::string_view(buffer, len));
-        // printf("Datagram status %d %d %s %x %x\n", getpid(), status.code, status.error_message.c_str(), this, session_);
+        Http3DatagramCode code = sendDatagram(absl::string_view(buffer, len), &message);
+        // printf("Datagram status %d %d %s %x %x\n", getpid(), code, message.c_str(), this, session_);
         bufferhandle->Unref(); // release the outgoing buffer
         delete bufferhandle;   // free the handle object
-        return status;
+        return code;
+    }
+
+    void Http3WTSession::leaveBroadcast(Http3WTDatagramBroadcast *broadcast)
+    {
+        broadcasts_.erase(std::remove(broadcasts_.begin(), broadcasts_.end(), broadcast),
+                          broadcasts_.end());
+    }
+
+    void Http3WTSession::leaveBroadcasts()
+    {
+        for (Http3WTDatagramBroadcast *broadcast : broadcasts_)
+            broadcast->sessionGone(this);
+        broadcasts_.clear();
+    }
+
+    Http3DatagramCode Http3WTSession::sendDatagram(absl::string_view datagram, std::string *message)
+    {
+        if (datagram_queue_)
+            return datagram_queue_->send(datagram, message);
+        return sendDatagramToQuiche(datagram, message);
+    }
+
+    Http3DatagramCode Http3WTSession::sendDatagramToQuiche(absl::string_view datagram, std::string *message)
+    {
+        webtransport::DatagramStatus status = session_->SendOrQueueDatagram(datagram);
+        if (message)
+            *message = status.error_message;
+        switch (status.code)
+        {
+        case webtransport::DatagramStatusCode::kSuccess:
+            return kDatagramSuccess;
+        case webtransport::DatagramStatusCode::kBlocked:
+            return kDatagramBlocked;
+        case webtransport::DatagramStatusCode::kTooBig:
+            return kDatagramTooBig;
+        default:
+            return kDatagramInternalError;
+        };
+    }
+
+    void Http3WTSession::setDatagramQueueInt(size_t maxQueue, QuicTime::Delta maxAge, bool dropOldest)
+    {
+        if (!datagram_queue_)
+            datagram_queue_ = std::make_unique<Http3WTDatagramQueue>(this);
+        datagram_queue_->configure(maxQueue, maxAge, dropOldest);
+        // datagrams inside quiche's queue expire after the same time,
+        // zero restores quiche's default
+        if (session_)
+            session_->SetDatagramMaxTimeInQueue(absl::Microseconds(maxAge.ToMicroseconds()));
+    }
+
+    void Http3WTDatagramQueue::configure(size_t maxQueue, QuicTime::Delta maxAge, bool dropOldest)
+    {
+        max_queue_ = maxQueue;
+        max_age_ = maxAge;
+        drop_oldest_ = dropOldest;
+        expire(QuicDefaultClock::Get()->Now());
+        while (max_queue_ > 0 && queue_.size() > max_queue_)
+        {
+            // the oldest go, whatever the policy, they are stale anyway
+            queue_.pop_front();
+            dropped_++;
+        }
+    }
+
+    Http3DatagramCode Http3WTDatagramQueue::send(absl::string_view datagram, std::string *message)
+    {
+        // quiche's queue has no limits, so it only gets a datagram,
+        // if it can send it right away
+        if (queue_.empty() && session_->quic_session_ && session_->quic_session_->DatagramQueueEmpty())
+            return session_->sendDatagramToQuiche(datagram, message);
+        QuicTime now = QuicDefaultClock::Get()->Now();
+        expire(now);
+        if (max_queue_ > 0 && queue_.size() >= max_queue_)
+        {
+            dropped_++;
+            if (!drop_oldest_)
+                return kDatagramDropped;
+            queue_.pop_front();
+        }
+        queue_.push_back(QueuedDatagram{std::string(datagram), now});
+        return kDatagramBlocked;
+    }
+
+    void Http3WTDatagramQueue::drain()
+    {
+        if (!session_->session_ || !session_->quic_session_)
+        {
+            queue_.clear();
+            return;
+        }
+        expire(QuicDefaultClock::Get()->Now());
+        // a datagram quiche could not send, waits for the next call
+        while (!queue_.empty() && session_->quic_session_->DatagramQueueEmpty())
+        {
+            session_->session_->SendOrQueueDatagram(queue_.front().data);
+            queue_.pop_front(); // sent, queued by quiche or failed
+        }
+    }
+
+    void Http3WTDatagramQueue::expire(QuicTime now)
+    {
+        if (max_age_.IsZero())
+            return;
+        while (!queue_.empty() && queue_.front().queued + max_age_ <= now)
+        {
+            queue_.pop_front();
+            dropped_++;
+        }
+    }
+
+    void Http3WTSession::writeDatagramsInt(const std::vector<absl::string_view> &datagrams, uint8_t *codes)
+    {
+        for (size_t i = 0; i < datagrams.size(); i++)
+        {
+            if (!session_)
+            {
+                codes[i] = kDatagramInternalError;
+                continue;
+            }
+            codes[i] = sendDatagram(datagrams[i]);
+        }
     }
 
     void Http3WTSessionJS::processStream(bool incom, bool bidi, uint64_t sendOrder, uint64_t sendGroupId, Http3WTStream *stream)
     {
         Napi::HandleScope scope(Env());
-        Http3Constructors *constr = Env().GetInstanceData<Http3Constructors>();
-        Napi::Object strobj = constr->stream.New({});
+        Napi::Object strobj = Http3WTStreamJS::acquire(Env());
         Http3WTStreamJS *strjs = Napi::ObjectWrap<Http3WTStreamJS>::Unwrap(strobj);
         strjs->setObj(stream);
         if (!stream->gone())
@@ -205,14 +476,19 @@ namespace quic
 
         Napi::Object objVal = Value().Get("jsobj").As<Napi::Object>();
 
-        Napi::Object retObj = Napi::Object::New(Env());
+        // the event object is reused for all streams of the session, js must not keep it
+        if (streamEvent_.IsEmpty())
+            streamEvent_ = Napi::Persistent(Napi::Object::New(Env()));
+        Napi::Object retObj = streamEvent_.Value();
         retObj.Set("stream", strobj);
         retObj.Set("incoming", incom);
         retObj.Set("bidirectional", bidi);
         retObj.Set("sendOrder", sendOrder);
         retObj.Set("sendGroupId", sendGroupId);
+        retObj.Set("messageMode", stream->messageMode());
 
         objVal.Get("onStream").As<Napi::Function>().Call(objVal, {retObj});
+        retObj.Set("stream", Env().Undefined()); // do not pin the stream
     }
 
     void Http3WTSessionJS::processGoawayReceived()
@@ -326,6 +602,23 @@ namespace quic
         objVal.Get("onDatagramReceived").As<Napi::Function>().Call(objVal, {retObj});
     }
 
+    void Http3WTSessionJS::processDatagramsReceived(const std::vector<uint32_t> &index)
+    {
+        Napi::HandleScope scope(Env());
+
+        // offset and length per datagram, the data is inside the ring
+        Napi::Uint32Array indexVal = Napi::Uint32Array::New(Env(), index.size());
+        memcpy(indexVal.Data(), index.data(), index.size() * sizeof(uint32_t));
+
+        Napi::Object objVal = Value().Get("jsobj").As<Napi::Object>();
+
+        Napi::Object retObj = Napi::Object::New(Env());
+        retObj.Set("index", indexVal);
+        retObj.Set("count", static_cast<uint32_t>(index.size() / 2));
+
+        objVal.Get("onDatagramsReceived").As<Napi::Function>().Call(objVal, {retObj});
+    }
+
     void Http3WTSessionJS::freeData(Napi::Env env, void *data, std::string *hint)
     {
         // ok free data is actually using a string object
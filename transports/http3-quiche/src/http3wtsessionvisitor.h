@@ -15,13 +15,17 @@
 
 #include <atomic>
 
+#include <deque>
+#include <optional>
 #include <string>
 #include <queue>
+#include <vector>
 
 #include "src/librarymain.h"
 #include "src/http3wtstreamvisitor.h"
 #include "src/http3wtsessionvisitor.h"
 
+#include "quiche/quic/core/quic_connection.h"
 #include "quiche/quic/core/web_transport_interface.h"
 #include "quiche/quic/platform/api/quic_logging.h"
 #include "quiche/common/quiche_circular_deque.h"
@@ -32,19 +36,137 @@ namespace quic
     // class Http3Server;
     class Http3WTSessionJS;
 
+    // status per datagram returned by writeDatagrams
+    enum Http3DatagramCode : uint8_t
+    {
+        kDatagramSuccess = 0,
+        kDatagramBlocked = 1, // queued by quiche
+        kDatagramTooBig = 2,
+        kDatagramInternalError = 3,
+        kDatagramDropped = 4 // dropped by the limit of our datagram queue
+    };
+
+    // offsets of the counters written by fillStats, rtts are in microseconds
+    enum SessionStatsField
+    {
+        kSessionStatsMinRtt,
+        kSessionStatsSmoothedRtt,
+        kSessionStatsRttVariation,
+        kSessionStatsEstimatedSendRate, // bits per second
+        kSessionStatsCongestionWindow,
+        kSessionStatsBytesInFlight,
+        kSessionStatsPacketsSent,
+        kSessionStatsPacketsLost,
+        kSessionStatsPacketsReceived,
+        kSessionStatsBytesSent,
+        kSessionStatsBytesReceived,
+        kSessionStatsDatagramsExpiredOutgoing,
+        kSessionStatsDatagramsLostOutgoing,
+        kSessionStatsNumFields
+    };
+
+    class Http3WTSession;
+    class Http3WTDatagramBroadcast;
+
+    // receive mode copying incoming datagrams into a buffer owned by js,
+    // js is notified once per event loop turn with the offsets and lengths
+    class Http3WTDatagramRing : public EnvGetter
+    {
+    public:
+        Http3WTDatagramRing(Http3WTSession *session, Napi::Uint8Array ring);
+        ~Http3WTDatagramRing();
+
+        Napi::Env getEnv() override { return ring_.Env(); }
+        Napi::Object getValue() override { return Napi::Object(); }
+
+        // returns false, if the datagram does not fit into the ring
+        bool push(absl::string_view datagram);
+
+        // passes the collected datagrams to js
+        void flush();
+
+    protected:
+        class AlarmDelegate : public QuicAlarm::DelegateWithoutContext
+        {
+        public:
+            AlarmDelegate(Http3WTDatagramRing *ring) : ring_(ring) {}
+
+            void OnAlarm() override { ring_->flush(); }
+
+        protected:
+            Http3WTDatagramRing *ring_;
+        };
+
+        Http3WTSession *session_; // owns us
+        Napi::Reference<Napi::Uint8Array> ring_;
+        uint8_t *data_;
+        size_t size_;
+        size_t pos_ = 0;
+        // offset and length for every datagram of the current batch,
+        // a batch never wraps around the end of the ring
+        std::vector<uint32_t> index_;
+        NapiAlarmFactory alarm_factory_;
+        std::unique_ptr<QuicAlarm> alarm_;
+    };
+
+    // bounded outgoing datagram queue in front of quiche's unbounded one,
+    // datagrams wait here, until quiche's queue is empty, so that the
+    // limits apply to everything not yet sent
+    class Http3WTDatagramQueue
+    {
+    public:
+        Http3WTDatagramQueue(Http3WTSession *session) : session_(session) {}
+
+        // maxQueue of 0 means unlimited, a zero maxAge means no age limit,
+        // a full queue drops either the oldest or the new datagram
+        void configure(size_t maxQueue, QuicTime::Delta maxAge, bool dropOldest);
+
+        // message receives the error message of quiche, if not null
+        Http3DatagramCode send(absl::string_view datagram, std::string *message);
+
+        // hands datagrams to quiche, while quiche's queue is empty,
+        // called whenever the connection can write again
+        void drain();
+
+        // datagrams dropped by age or by the queue limit
+        uint64_t dropped() const { return dropped_; }
+
+    protected:
+        void expire(QuicTime now);
+
+        struct QueuedDatagram
+        {
+            std::string data;
+            QuicTime queued;
+        };
+
+        Http3WTSession *session_; // owns us
+        std::deque<QueuedDatagram> queue_;
+        size_t max_queue_ = 0;
+        QuicTime::Delta max_age_ = QuicTime::Delta::Zero();
+        bool drop_oldest_ = true;
+        uint64_t dropped_ = 0;
+    };
+
     class Http3WTSession
     {
         friend Http3WTSessionJS;
+        friend Http3WTDatagramRing;
+        friend Http3WTDatagramQueue;
+        friend Http3WTDatagramBroadcast;
 
     public:
         Http3WTSession()
-            : session_(nullptr), js_(nullptr)
+            : session_(nullptr), js_(nullptr),
+              send_budget_(std::make_shared<Http3WTSendBudget>()),
+              deadlines_(std::make_shared<Http3WTStreamDeadlines>())
         {
         }
 
         ~Http3WTSession()
         {
             // printf("session destruct %x\n", this);
+            leaveBroadcasts();
         }
 
         // need to be called immediately after new
@@ -55,12 +177,15 @@ namespace quic
         class VisitorRemoveVisitor {
          public:
           virtual void RemoveVisitor(Http3WTSession::Visitor* visitor) = 0;
+          // true, if quiche has no datagram queued for sending
+          virtual bool DatagramQueueEmpty() = 0;
         };
 
         class Visitor : public WebTransportVisitor {
          public:
           Visitor(Http3WTSession* session, VisitorRemoveVisitor* vrvis)
               : session_(session), vrvis_(vrvis) {
+            session_->quic_session_ = vrvis;
             /* printf(
                 "Session created Visitor %d %x %x\n", getpid(), this, session_);*/
           }
@@ -72,10 +197,18 @@ namespace quic
                 vrvis_->RemoveVisitor(this);
             }
             vrvis_ = vrvis;
+            session_->quic_session_ = vrvis;
           }
 
           void RemoveVisitorRemoveVisitor() {
             vrvis_ = nullptr;
+            session_->connection_ = nullptr; // the quic session deletes it
+            session_->quic_session_ = nullptr;
+          }
+
+          // the connection carrying the session, source of the fillStats counters
+          void setConnection(QuicConnection *connection) {
+            session_->connection_ = connection;
           }
 
             void OnSessionReady() override;
@@ -98,20 +231,29 @@ namespace quic
             session_->TrySendingUnidirectionalStreams();
           }
 
+          // the connection is writable, quiche may have sent its datagrams
+          void OnCanWriteDatagrams() {
+            if (session_->datagram_queue_)
+              session_->datagram_queue_->drain();
+          }
+
          protected:
           Http3WTSession* session_;
           VisitorRemoveVisitor* vrvis_;
         };
 
         bool
-        tryOpenBidiStream(bool waitUntilAvailable, uint64_t sendGroupId, uint64_t sendOrder)
+        tryOpenBidiStream(bool waitUntilAvailable, uint64_t sendGroupId, uint64_t sendOrder,
+                          std::optional<bool> messageMode, QuicTime deadline)
         {
             if (session_->CanOpenNextOutgoingBidirectionalStream() 
                 || waitUntilAvailable) {
-                webtransport::StreamPriority priority;
-                priority.send_group_id = sendGroupId;
-                priority.send_order = sendOrder;
-                ordBidiStreams.push(priority);
+                OrderedStream ordered;
+                ordered.priority.send_group_id = sendGroupId;
+                ordered.priority.send_order = sendOrder;
+                ordered.message_mode = messageMode.value_or(stream_message_mode_);
+                ordered.deadline = deadline;
+                ordBidiStreams.push(ordered);
                 TrySendingBidirectionalStreams();
                 return true;
             } else {
@@ -119,14 +261,17 @@ namespace quic
             }
         }
 
-        bool tryOpenUnidiStream(bool waitUntilAvailable, uint64_t sendGroupId, uint64_t sendOrder)
+        bool tryOpenUnidiStream(bool waitUntilAvailable, uint64_t sendGroupId, uint64_t sendOrder,
+                                std::optional<bool> messageMode, QuicTime deadline)
         {
             if (session_->CanOpenNextOutgoingUnidirectionalStream() 
                 || waitUntilAvailable) {
-                webtransport::StreamPriority priority;
-                priority.send_group_id = sendGroupId;
-                priority.send_order = sendOrder;
-                ordUnidiStreams.push(priority);
+                OrderedStream ordered;
+                ordered.priority.send_group_id = sendGroupId;
+                ordered.priority.send_order = sendOrder;
+                ordered.message_mode = messageMode.value_or(stream_message_mode_);
+                ordered.deadline = deadline;
+                ordUnidiStreams.push(ordered);
                 TrySendingUnidirectionalStreams();
                 return true;
             } else {
@@ -138,6 +283,13 @@ namespace quic
 
         void TrySendingUnidirectionalStreams();
 
+        // creates the native stream and attaches its visitor
+        Http3WTStream *createStream(WebTransportStream *stream, bool messageMode);
+
+        void joinBroadcast(Http3WTDatagramBroadcast *broadcast) { broadcasts_.push_back(broadcast); }
+        void leaveBroadcast(Http3WTDatagramBroadcast *broadcast);
+        void leaveBroadcasts();
+
         Http3WTSessionJS *getJS() { return js_; };
         void setJS(Http3WTSessionJS *js)
         {
@@ -157,20 +309,76 @@ namespace quic
 
         void orderDatagramStatsInt();
 
+        // writes kSessionStatsNumFields counters, returns false if the session is closed
+        bool fillStatsInt(uint64_t *stats);
+
         size_t getMaxDatagramSizeInt();
 
+        void setSendHighWaterMarkInt(uint64_t sessionMark, uint64_t streamMark)
+        {
+            send_budget_->setHighWaterMarks(sessionMark, streamMark);
+            send_budget_->notifyWaiting();
+        }
+
+        void setStreamMessageModeInt(bool enabled, uint64_t maxMessageSize)
+        {
+            stream_message_mode_ = enabled;
+            max_message_size_ = maxMessageSize;
+        }
+
+        void setDatagramQueueInt(size_t maxQueue, QuicTime::Delta maxAge, bool dropOldest);
+
+        void setSendGroupWeightInt(uint64_t sendGroupId, double weight)
+        {
+            send_budget_->setGroupWeight(sendGroupId, weight);
+        }
+
         void closeInt(int code, std::string &reason)
         {
             if (session_)
                 session_->CloseSession(code, reason);
         }
 
-        webtransport::DatagramStatus writeDatagramInt(char *buffer, size_t len, Napi::ObjectReference *bufferhandle);
+        Http3DatagramCode writeDatagramInt(char *buffer, size_t len, Napi::ObjectReference *bufferhandle,
+                                           std::string &message);
+
+        // quiche copies the datagrams, so the buffers are not referenced beyond the call
+        void writeDatagramsInt(const std::vector<absl::string_view> &datagrams, uint8_t *codes);
         WebTransportSession *session_;
+        QuicConnection *connection_ = nullptr; // unowned, reset with session_
+        VisitorRemoveVisitor *quic_session_ = nullptr; // unowned, reset with session_
         bool echo_stream_opened_ = false;
+        bool close_delivered_ = false; // js has released the wrapper
 
-        std::queue<webtransport::StreamPriority> ordBidiStreams;
-        std::queue<webtransport::StreamPriority> ordUnidiStreams;
+        struct OrderedStream
+        {
+            webtransport::StreamPriority priority;
+            bool message_mode;
+            QuicTime deadline; // counts from the order
+        };
+
+        std::queue<OrderedStream> ordBidiStreams;
+        std::queue<OrderedStream> ordUnidiStreams;
+
+        // length prefixed message framing for streams opened afterwards
+        bool stream_message_mode_ = false;
+        uint64_t max_message_size_ = kDefaultMaxMessageSize;
+
+        // shared with all streams of the session, streams may outlive the session
+        std::shared_ptr<Http3WTSendBudget> send_budget_;
+        std::shared_ptr<Http3WTStreamDeadlines> deadlines_;
+
+        std::unique_ptr<Http3WTDatagramRing> datagram_ring_; // batched receive, if set
+        std::unique_ptr<Http3WTDatagramQueue> datagram_queue_; // queue limits, if set
+
+        // passes the datagram to quiche or the limited queue,
+        // message receives the error message of quiche, if not null
+        Http3DatagramCode sendDatagram(absl::string_view datagram, std::string *message = nullptr);
+
+        // bypasses the limited queue
+        Http3DatagramCode sendDatagramToQuiche(absl::string_view datagram, std::string *message);
+
+        std::vector<Http3WTDatagramBroadcast *> broadcasts_; // unowned, groups we are member of
     };
 
     class Http3WTSessionJS : public Napi::ObjectWrap<Http3WTSessionJS>
@@ -193,16 +401,36 @@ namespace quic
             return wtsession_.get();
         }
 
+        // takes a wrapper from the free list or creates a new one
+        static Napi::Object acquire(Napi::Env env);
+
+        // called on visitor destruction after the close was delivered,
+        // deletes the native session and returns the wrapper to the free list
+        void recycle();
+
         Napi::Value orderBidiStream(const Napi::CallbackInfo &info)
         {
             bool waitUntilAvailable = false;
             uint64_t sendGroupId = 0;
             uint64_t sendOrder = 0;
+            std::optional<bool> messageMode; // defaults to the session setting
+            QuicTime deadline = QuicTime::Zero();
             if (!info[0].IsUndefined())
             {
                 Napi::Object lobj = info[0].ToObject();
                 if (!lobj.IsEmpty())
                 {
+                    if (lobj.Has("messageMode") && !(lobj).Get("messageMode").IsUndefined())
+                    {
+                        messageMode = (lobj).Get("messageMode").ToBoolean().Value();
+                    }
+                    if (lobj.Has("deadline") && (lobj).Get("deadline").IsNumber())
+                    {
+                        // milliseconds from now
+                        Napi::Value deadlineValue = (lobj).Get("deadline");
+                        deadline = Http3WTStreamDeadlines::fromNow(deadlineValue.As<Napi::Number>().DoubleValue());
+                        wtsession_->deadlines_->setEnv(Env());
+                    }
                     if (lobj.Has("waitUntilAvailable") && !(lobj).Get("waitUntilAvailable").IsEmpty())
                     {
                         Napi::Value waitUntilAvailableValue = (lobj).Get("waitUntilAvailable");
@@ -220,7 +448,7 @@ namespace quic
                     }
                 }
             }
-            if (wtsession_->tryOpenBidiStream(waitUntilAvailable, sendGroupId, sendOrder))
+            if (wtsession_->tryOpenBidiStream(waitUntilAvailable, sendGroupId, sendOrder, messageMode, deadline))
             {
                 return Napi::Value::From(Env(), true);
             }
@@ -235,11 +463,24 @@ namespace quic
             bool waitUntilAvailable = false;
             uint64_t sendGroupId = 0;
             uint64_t sendOrder = 0;
+            std::optional<bool> messageMode; // defaults to the session setting
+            QuicTime deadline = QuicTime::Zero();
             if (!info[0].IsUndefined())
             {
                 Napi::Object lobj = info[0].ToObject();
                 if (!lobj.IsEmpty())
                 {
+                    if (lobj.Has("messageMode") && !(lobj).Get("messageMode").IsUndefined())
+                    {
+                        messageMode = (lobj).Get("messageMode").ToBoolean().Value();
+                    }
+                    if (lobj.Has("deadline") && (lobj).Get("deadline").IsNumber())
+                    {
+                        // milliseconds from now
+                        Napi::Value deadlineValue = (lobj).Get("deadline");
+                        deadline = Http3WTStreamDeadlines::fromNow(deadlineValue.As<Napi::Number>().DoubleValue());
+                        wtsession_->deadlines_->setEnv(Env());
+                    }
                     if (lobj.Has("waitUntilAvailable") && !(lobj).Get("waitUntilAvailable").IsEmpty())
                     {
                         Napi::Value waitUntilAvailableValue = (lobj).Get("waitUntilAvailable");
@@ -257,7 +498,7 @@ namespace quic
                     }
                 }
             }
-            if (wtsession_->tryOpenUnidiStream(waitUntilAvailable, sendGroupId, sendOrder))
+            if (wtsession_->tryOpenUnidiStream(waitUntilAvailable, sendGroupId, sendOrder, messageMode, deadline))
             {
                 return Napi::Value::From(Env(), true);
             }
@@ -276,29 +517,87 @@ namespace quic
                 *bufferhandle = Napi::Persistent(bufferlocal);
                 char *buffer = bufferlocal.As<Napi::Buffer<char>>().Data();
                 size_t len = bufferlocal.As<Napi::Buffer<char>>().Length();
-                webtransport::DatagramStatus status = wtsession_->writeDatagramInt(buffer, len, bufferhandle);
+                std::string message;
+                Http3DatagramCode code = wtsession_->writeDatagramInt(buffer, len, bufferhandle, message);
 
                 Napi::Object retObj = Napi::Object::New(Env());
-                switch (status.code) {
-                case webtransport::DatagramStatusCode::kBlocked:
+                switch (code) {
+                case kDatagramBlocked:
                     retObj.Set("code", "blocked");
                 break;
-                case webtransport::DatagramStatusCode::kInternalError:
+                case kDatagramInternalError:
                     retObj.Set("code", "internalError");
                 break;
-                case webtransport::DatagramStatusCode::kSuccess:
+                case kDatagramSuccess:
                     retObj.Set("code", "success");
                 break;
-                case webtransport::DatagramStatusCode::kTooBig:
+                case kDatagramTooBig:
                     retObj.Set("code", "tooBig");
                 break;
+                case kDatagramDropped:
+                    retObj.Set("code", "dropped");
+                break;
                 };
-                retObj.Set("message", status.error_message);
+                retObj.Set("message", message);
                 return retObj;
             }
             return Napi::Object::New(Env());
         }
 
+        // writes either an array of Uint8Arrays or a packed Uint8Array with an Uint32Array
+        // of the datagram lengths, returns an Uint8Array with a Http3DatagramCode per datagram
+        Napi::Value writeDatagrams(const Napi::CallbackInfo &info)
+        {
+            std::vector<absl::string_view> datagrams;
+            if (info[0].IsArray())
+            {
+                Napi::Array chunks = info[0].As<Napi::Array>();
+                uint32_t count = chunks.Length();
+                datagrams.reserve(count);
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    Napi::Value chunk = chunks.Get(i);
+                    if (!chunk.IsTypedArray() ||
+                        chunk.As<Napi::TypedArray>().TypedArrayType() != napi_uint8_array)
+                    {
+                        Napi::TypeError::New(Env(), "writeDatagrams expects Uint8Arrays").ThrowAsJavaScriptException();
+                        return Env().Undefined();
+                    }
+                    Napi::Uint8Array datagram = chunk.As<Napi::Uint8Array>();
+                    datagrams.emplace_back(reinterpret_cast<const char *>(datagram.Data()), datagram.ByteLength());
+                }
+            }
+            else if (info[0].IsTypedArray() && info[1].IsTypedArray() &&
+                     info[0].As<Napi::TypedArray>().TypedArrayType() == napi_uint8_array &&
+                     info[1].As<Napi::TypedArray>().TypedArrayType() == napi_uint32_array)
+            {
+                Napi::Uint8Array packed = info[0].As<Napi::Uint8Array>();
+                Napi::Uint32Array lengths = info[1].As<Napi::Uint32Array>();
+                const char *data = reinterpret_cast<const char *>(packed.Data());
+                size_t offset = 0;
+                datagrams.reserve(lengths.ElementLength());
+                for (size_t i = 0; i < lengths.ElementLength(); i++)
+                {
+                    size_t len = lengths[i];
+                    if (len > packed.ByteLength() - offset)
+                    {
+                        Napi::RangeError::New(Env(), "writeDatagrams lengths exceed the packed buffer").ThrowAsJavaScriptException();
+                        return Env().Undefined();
+                    }
+                    datagrams.emplace_back(data + offset, len);
+                    offset += len;
+                }
+            }
+            else
+            {
+                Napi::TypeError::New(Env(), "writeDatagrams expects an array of Uint8Arrays or an Uint8Array and an Uint32Array").ThrowAsJavaScriptException();
+                return Env().Undefined();
+            }
+            Napi::Uint8Array codes = Napi::Uint8Array::New(Env(), datagrams.size());
+            wtsession_->writeDatagramsInt(datagrams, codes.Data());
+            return codes;
+        }
+
         void notifySessionDraining(const Napi::CallbackInfo &info)
         {
             wtsession_->notifySessionDrainingInt();
@@ -314,11 +613,181 @@ namespace quic
             wtsession_->orderDatagramStatsInt();
         }
 
+        Napi::Value fillStats(const Napi::CallbackInfo &info)
+        {
+            // fills a preallocated Float64Array or BigUint64Array, so that polling does not allocate
+            if (!info[0].IsTypedArray())
+            {
+                Napi::TypeError::New(Env(), "fillStats expects a Float64Array or a BigUint64Array").ThrowAsJavaScriptException();
+                return Env().Undefined();
+            }
+            Napi::TypedArray array = info[0].As<Napi::TypedArray>();
+            if (array.TypedArrayType() != napi_float64_array && array.TypedArrayType() != napi_biguint64_array)
+            {
+                Napi::TypeError::New(Env(), "fillStats expects a Float64Array or a BigUint64Array").ThrowAsJavaScriptException();
+                return Env().Undefined();
+            }
+            if (array.ElementLength() < kSessionStatsNumFields)
+            {
+                Napi::RangeError::New(Env(), "array passed to fillStats is too small").ThrowAsJavaScriptException();
+                return Env().Undefined();
+            }
+            if (array.TypedArrayType() == napi_biguint64_array)
+                return Napi::Value::From(Env(), wtsession_->fillStatsInt(array.As<Napi::BigUint64Array>().Data()));
+            uint64_t stats[kSessionStatsNumFields];
+            if (!wtsession_->fillStatsInt(stats))
+                return Napi::Value::From(Env(), false);
+            double *data = array.As<Napi::Float64Array>().Data();
+            for (size_t i = 0; i < kSessionStatsNumFields; i++)
+                data[i] = static_cast<double>(stats[i]);
+            return Napi::Value::From(Env(), true);
+        }
+
         Napi::Value getMaxDatagramSize(const Napi::CallbackInfo &info) {
             size_t size = wtsession_->getMaxDatagramSizeInt();
             return Napi::Value::From(Env(), size);
         }
 
+        void setSendHighWaterMark(const Napi::CallbackInfo &info)
+        {
+            uint64_t sessionMark = kDefaultSessionSendHighWaterMark;
+            uint64_t streamMark = kDefaultStreamSendHighWaterMark;
+
+            if (!info[0].IsUndefined())
+            {
+                Napi::Object obj = info[0].ToObject();
+                if (obj.Has("session") && !(obj).Get("session").IsUndefined())
+                {
+                    int64_t value = (obj).Get("session").ToNumber().Int64Value();
+                    if (value < 0)
+                    {
+                        Napi::RangeError::New(Env(), "session high water mark must not be negative").ThrowAsJavaScriptException();
+                        return;
+                    }
+                    sessionMark = value;
+                }
+                if (obj.Has("stream") && !(obj).Get("stream").IsUndefined())
+                {
+                    int64_t value = (obj).Get("stream").ToNumber().Int64Value();
+                    if (value < 0)
+                    {
+                        Napi::RangeError::New(Env(), "stream high water mark must not be negative").ThrowAsJavaScriptException();
+                        return;
+                    }
+                    streamMark = value;
+                }
+            }
+            // new marks apply to streams opened afterwards
+            wtsession_->setSendHighWaterMarkInt(sessionMark, streamMark);
+        }
+
+        void setStreamMessageMode(const Napi::CallbackInfo &info)
+        {
+            bool enabled = false;
+            uint64_t maxMessageSize = kDefaultMaxMessageSize;
+
+            if (!info[0].IsUndefined())
+            {
+                Napi::Object obj = info[0].ToObject();
+                if (obj.Has("enabled") && !(obj).Get("enabled").IsUndefined())
+                {
+                    enabled = (obj).Get("enabled").ToBoolean().Value();
+                }
+                if (obj.Has("maxMessageSize") && !(obj).Get("maxMessageSize").IsUndefined())
+                {
+                    double value = (obj).Get("maxMessageSize").ToNumber().DoubleValue();
+                    if (!(value >= 0 && value < static_cast<double>(kVarintLimit)))
+                    {
+                        Napi::RangeError::New(Env(), "maxMessageSize must be a non negative varint").ThrowAsJavaScriptException();
+                        return;
+                    }
+                    maxMessageSize = static_cast<uint64_t>(value);
+                }
+            }
+            // applies to streams opened afterwards
+            wtsession_->setStreamMessageModeInt(enabled, maxMessageSize);
+        }
+
+        void setDatagramRing(const Napi::CallbackInfo &info)
+        {
+            if (info[0].IsUndefined() || info[0].IsNull())
+            {
+                // back to one event per datagram
+                if (wtsession_->datagram_ring_)
+                    wtsession_->datagram_ring_->flush();
+                wtsession_->datagram_ring_.reset();
+                return;
+            }
+            if (!info[0].IsTypedArray() ||
+                info[0].As<Napi::TypedArray>().TypedArrayType() != napi_uint8_array)
+            {
+                Napi::TypeError::New(Env(), "setDatagramRing expects an Uint8Array").ThrowAsJavaScriptException();
+                return;
+            }
+            if (wtsession_->datagram_ring_)
+                wtsession_->datagram_ring_->flush();
+            wtsession_->datagram_ring_ =
+                std::make_unique<Http3WTDatagramRing>(wtsession_.get(), info[0].As<Napi::Uint8Array>());
+        }
+
+        void setDatagramQueue(const Napi::CallbackInfo &info)
+        {
+            size_t maxQueue = 0;
+            double maxAge = 0;
+            bool dropOldest = true;
+
+            if (!info[0].IsUndefined())
+            {
+                Napi::Object obj = info[0].ToObject();
+                if (obj.Has("maxQueue") && !(obj).Get("maxQueue").IsUndefined())
+                {
+                    int64_t maxQueueValue = (obj).Get("maxQueue").ToNumber().Int64Value();
+                    if (maxQueueValue < 0)
+                    {
+                        Napi::RangeError::New(Env(), "maxQueue must not be negative").ThrowAsJavaScriptException();
+                        return;
+                    }
+                    maxQueue = maxQueueValue;
+                }
+                if (obj.Has("maxAge") && !(obj).Get("maxAge").IsUndefined())
+                {
+                    // milliseconds
+                    Napi::Value maxAgeValue = (obj).Get("maxAge");
+                    maxAge = maxAgeValue.As<Napi::Number>().DoubleValue();
+                }
+                if (obj.Has("dropPolicy") && !(obj).Get("dropPolicy").IsUndefined())
+                {
+                    std::string policy = (obj).Get("dropPolicy").ToString().Utf8Value();
+                    if (policy == "newest")
+                    {
+                        dropOldest = false;
+                    }
+                    else if (policy != "oldest")
+                    {
+                        Napi::TypeError::New(Env(), "dropPolicy must be oldest or newest").ThrowAsJavaScriptException();
+                        return;
+                    }
+                }
+            }
+            wtsession_->setDatagramQueueInt(maxQueue,
+                                            QuicTime::Delta::FromMicroseconds(static_cast<int64_t>(maxAge * 1000)),
+                                            dropOldest);
+        }
+
+        void setSendGroupWeight(const Napi::CallbackInfo &info)
+        {
+            if (!info[0].IsBigInt() || !info[1].IsNumber())
+            {
+                Napi::TypeError::New(Env(), "setSendGroupWeight expects a send group id and a weight").ThrowAsJavaScriptException();
+                return;
+            }
+            bool lossless;
+            uint64_t sendGroupId = info[0].As<Napi::BigInt>().Uint64Value(&lossless);
+            double weight = info[1].As<Napi::Number>().DoubleValue();
+            wtsession_->deadlines_->setEnv(Env()); // for the wakeups of held streams
+            wtsession_->setSendGroupWeightInt(sendGroupId, weight);
+        }
+
         void close(const Napi::CallbackInfo &info)
         {
             int code = 0;
@@ -355,14 +824,28 @@ namespace quic
                                                                                                                static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
                                                            InstanceMethod<&Http3WTSessionJS::writeDatagram>("writeDatagram",
                                                                                                             static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                                           InstanceMethod<&Http3WTSessionJS::writeDatagrams>("writeDatagrams",
+                                                                                                             static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
                                                            InstanceMethod<&Http3WTSessionJS::notifySessionDraining>("notifySessionDraining",
                                                                                                                     static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
                                                            InstanceMethod<&Http3WTSessionJS::orderSessionStats>("orderSessionStats",
                                                                                                                 static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
                                                            InstanceMethod<&Http3WTSessionJS::orderDatagramStats>("orderDatagramStats",
                                                                                                                  static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                                           InstanceMethod<&Http3WTSessionJS::fillStats>("fillStats",
+                                                                                                        static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
                                                            InstanceMethod<&Http3WTSessionJS::getMaxDatagramSize>("getMaxDatagramSize",
                                                                                                                     static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                                           InstanceMethod<&Http3WTSessionJS::setSendHighWaterMark>("setSendHighWaterMark",
+                                                                                                                   static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                                           InstanceMethod<&Http3WTSessionJS::setStreamMessageMode>("setStreamMessageMode",
+                                                                                                                   static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                                           InstanceMethod<&Http3WTSessionJS::setDatagramQueue>("setDatagramQueue",
+                                                                                                               static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                                           InstanceMethod<&Http3WTSessionJS::setDatagramRing>("setDatagramRing",
+                                                                                                              static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                                           InstanceMethod<&Http3WTSessionJS::setSendGroupWeight>("setSendGroupWeight",
+                                                                                                                 static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
                                                            InstanceMethod<&Http3WTSessionJS::close>("close",
                                                                                                     static_cast<napi_property_attributes>(napi_writable | napi_configurable))});
             constr->session = Napi::Persistent(tplwt);
@@ -371,6 +854,7 @@ namespace quic
 
     protected:
         std::unique_ptr<Http3WTSession> wtsession_;
+        Napi::ObjectReference streamEvent_; // reused onStream payload
 
         static void freeData(Napi::Env env, void *data, std::string *hint);
 
@@ -380,6 +864,7 @@ namespace quic
         void processGoawayReceived();
         void processDatagramSend(Napi::ObjectReference *bufferhandle);
         void processDatagramReceived(std::string *datagram);
+        void processDatagramsReceived(const std::vector<uint32_t> &index);
         void processSessionReady(std::optional<std::string> protocol);
         void processSessionClose(uint32_t errorcode, const std::string &error);
     };
@@ -4,10 +4,33 @@
 
 #include "src/http3wtstreamvisitor.h"
 #include "src/http3server.h"
+#include "src/http3wtbroadcast.h"
 #include "quiche/web_transport/stream_helpers.h"
+#include "quiche/common/quiche_mem_slice.h"
+#include "quiche/common/quiche_stream.h"
+#include "quiche/quic/core/quic_default_clock.h"
+
+#include <string.h>
+
+#include <algorithm>
 
 namespace quic
 {
+    // quic variable length integer, the two high bits encode the length of 1, 2, 4 or 8 bytes
+    static bool readVarint(const std::string &buffer, size_t pos, uint64_t &value, size_t &len)
+    {
+        if (pos >= buffer.size())
+            return false;
+        const unsigned char *data = reinterpret_cast<const unsigned char *>(buffer.data()) + pos;
+        len = size_t(1) << (data[0] >> 6);
+        if (buffer.size() - pos < len)
+            return false;
+        value = data[0] & 0x3f;
+        for (size_t i = 1; i < len; i++)
+            value = (value << 8) | data[i];
+        return true;
+    }
+
     void Http3WTStreamJS::init(Http3WTStream *wtstream)
     {
         wtstream_ = std::unique_ptr<Http3WTStream>(wtstream);
@@ -16,15 +39,30 @@ namespace quic
     Http3WTStream::Visitor::~Visitor()
     {
         // printf("stream ~Visitor %d %x %x\n", getpid(), this, stream_);
+        uint32_t canceled = 0;
+        uint64_t canceledbytes = 0;
         while (stream_->chunks_.size() > 0)
         {
             auto cur = stream_->chunks_.front();
-
-            // now we have to inform the server TODO
-            stream_->getJS()->processStreamWrite(cur.bufferhandle, false);
+            canceled++;
+            canceledbytes += cur.len;
+            releaseChunk(cur);
 
             stream_->chunks_.pop_front();
         }
+        stream_->releaseQueued(canceledbytes);
+        stream_->file_source_.reset();
+        stream_->updateBacklog();
+        stream_->budget_->removeHeld(stream_);
+        stream_->held_ = false;
+        if (canceled > 0 || stream_->waiting_ready_)
+        {
+            stream_->waiting_ready_ = false;
+            stream_->budget_->removeWaiting(stream_);
+            stream_->getJS()->processStreamWrite(canceled, canceledbytes, false, true);
+        }
+        // the canceled bytes may unblock other streams of the session
+        stream_->budget_->notifyWaiting();
 
         if (!stream_->stop_sending_received_)
         {
@@ -34,21 +72,52 @@ namespace quic
         {
             stream_->getJS()->processStreamRecvSignal(0, NetworkTask::resetStream);
         }
+        stream_->unsplice();
+        stream_->leaveBroadcasts();
+        stream_->setDeadline(QuicTime::Zero());
         Http3WTStreamJS *strobj = stream_->getJS();
         if (strobj)
         {
             stream_->stream_ = nullptr;
-            strobj->Unref();
+            strobj->recycle();
         }
         else
         {
-            delete stream_;
             stream_->stream_ = nullptr;
+            delete stream_;
         }
+        stream_ = nullptr;
+    }
+
+    Napi::Object Http3WTStreamJS::acquire(Napi::Env env)
+    {
+        Http3Constructors *constr = env.GetInstanceData<Http3Constructors>();
+        if (constr->streamPool.empty())
+            return constr->stream.New({});
+        Http3WTStreamJS *strjs = constr->streamPool.back();
+        constr->streamPool.pop_back();
+        Napi::Object strobj = strjs->Value();
+        strjs->Unref(); // the caller takes its own reference
+        return strobj;
+    }
+
+    void Http3WTStreamJS::recycle()
+    {
+        Http3Constructors *constr = Env().GetInstanceData<Http3Constructors>();
+        // js must have dropped the wrapper, otherwise it is left to the gc
+        if (constr->streamPool.size() >= kMaxPooledWrappers || !processStreamGone())
+        {
+            Unref();
+            return;
+        }
+        wtstream_.reset();
+        constr->streamPool.push_back(this); // keeps the reference
     }
 
     void Http3WTStream::Visitor::OnWriteSideInDataRecvdState() // called if everything is written to the client and it is closed
     {
+        // quiche only reports acknowledgement for the whole write side
+        stream_->bytes_acknowledged_ = stream_->bytes_sent_;
         if (stream_->send_fin_)
             stream_->getJS()->processStreamNetworkFinish(NetworkTask::streamFinal);
     }
@@ -65,12 +134,17 @@ namespace quic
         OnCanWrite();*/
         stream_->stream_was_reset_ = true;
         lasterror = error;
+        if (stream_->splice_target_)
+            stream_->splice_target_->resetStreamInt(error);
         stream_->getJS()->processStreamRecvSignal(error, NetworkTask::resetStream); // may be move below
     }
 
     void Http3WTStream::Visitor::OnStopSendingReceived(WebTransportStreamError error)
     {
         stream_->stop_sending_received_ = true;
+        stream_->file_source_.reset(); // the peer does not want the rest
+        if (stream_->splice_source_)
+            stream_->splice_source_->stopSendingInt(error);
         stream_->getJS()->processStreamRecvSignal(error, NetworkTask::stopSending); // may be move below
         // we should also finallize the stream, so send a fin
         stream_->send_fin_ = true;
@@ -79,12 +153,23 @@ namespace quic
 
     void Http3WTStream::cancelWrite(Napi::ObjectReference *handle)
     {
-        getJS()->processStreamWrite(handle, false);
+        handle->Unref(); // release the outgoing buffer
+        delete handle;   // free the handle object
     }
 
     void Http3WTStream::doCanRead()
     {
         // if (pause_reading_) return ; // back pressure folks!
+        if (splice_target_)
+        {
+            doRelay(); // data is not passed to js
+            return;
+        }
+        if (message_mode_)
+        {
+            doReadMessages();
+            return;
+        }
         WebTransportStream::PeekResult pr;
         pr = stream_->PeekNextReadableRegion();
 
@@ -124,10 +209,75 @@ namespace quic
                     break;
                 }
             }
+            bytes_read_ += writepos;
             rbuf.commitBuffer(writepos, pr.has_data());
         }
     }
 
+    void Http3WTStream::doReadMessages()
+    {
+        if (pause_reading_ && !drain_reads_)
+        {
+            can_read_pending_ = true;
+            return; // back pressure folks!
+        }
+        bool fin = false;
+        while (true)
+        {
+            WebTransportStream::PeekResult pr = stream_->PeekNextReadableRegion();
+            size_t len = pr.peeked_data.size();
+            if (len == 0 && !pr.fin_next)
+                break;
+            if (!message_error_)
+                message_buffer_.append(pr.peeked_data.data(), len);
+            bytes_read_ += len;
+            if (stream_->SkipBytes(len))
+            {
+                fin = true;
+                break;
+            }
+            if (len == 0)
+                break;
+        }
+        if (message_error_)
+            return; // discarded after an oversized message
+
+        std::vector<std::pair<size_t, uint64_t>> messages;
+        size_t pos = 0;
+        const char *error = nullptr;
+        uint64_t msglen;
+        size_t prefixlen;
+        while (readVarint(message_buffer_, pos, msglen, prefixlen))
+        {
+            if (msglen > max_message_size_)
+            {
+                error = "message exceeds maxMessageSize";
+                break;
+            }
+            if (message_buffer_.size() - pos - prefixlen < msglen)
+                break; // partial message, wait for more data
+            messages.emplace_back(pos + prefixlen, msglen);
+            pos += prefixlen + msglen;
+        }
+        if (!error && fin && pos < message_buffer_.size())
+            error = "stream ended inside a message";
+        if (messages.empty() && !fin && !error)
+            return;
+
+        bool more = getJS()->processStreamMessages(message_buffer_, messages, fin && !error, error);
+        message_buffer_.erase(0, pos);
+        if (error)
+        {
+            message_error_ = true;
+            message_buffer_.clear();
+            if (!fin)
+                stopSendingInt(0);
+            return;
+        }
+        if (!more)
+            pause_reading_ = true;
+    }
+
     void Http3WTStream::doCanWrite()
     {
         /* if (/* stop_sending_received_ || * pause_reading_)
@@ -137,24 +287,92 @@ namespace quic
         if (fin_was_sent_)
             return;
 
+        if ((chunks_.size() > 0 || file_source_) && !force_write_ &&
+            !budget_->groupMayWrite(send_group_))
+        {
+            // the group is above its share, other groups go first
+            if (!held_)
+            {
+                held_ = true;
+                budget_->holdStream(this);
+                deadlines_->setWakeup(this, QuicDefaultClock::Get()->Now() +
+                                                QuicTime::Delta::FromMilliseconds(kSendGroupMaxHoldMs));
+            }
+            return;
+        }
+        force_write_ = false;
+        if (held_)
+        {
+            // woken by quiche, while the group is within its share again
+            held_ = false;
+            budget_->removeHeld(this);
+            deadlines_->setWakeup(this, QuicTime::Zero());
+        }
+
+        // completions are reported in one batch per write round
+        uint32_t completed = 0;
+        uint64_t completedbytes = 0;
+        bool blocked = false;
         while (chunks_.size() > 0)
         {
             auto cur = chunks_.front();
-            absl::Status status = 
-                webtransport::WriteIntoStream(*stream_, absl::string_view(cur.buffer, cur.len));
+            absl::Status status = cur.shared
+                ? writeShared(cur.shared)
+                : webtransport::WriteIntoStream(*stream_, absl::string_view(cur.buffer, cur.len));
             QUIC_DVLOG(1) << "Attempted writing on WebTransport bidirectional stream "
                           << ", success: " << status;
             if (!status.ok())
             {
-                return;
+                blocked = true;
+                break;
             }
-            // now we have to inform the server TODO
-            getJS()->processStreamWrite(cur.bufferhandle, true);
+            countSent(cur.len);
+            completed++;
+            completedbytes += cur.len;
+            releaseChunk(cur);
 
             chunks_.pop_front();
         }
+        if (completed > 0)
+        {
+            releaseQueued(completedbytes);
+            if (waiting_ready_ && writableReady())
+            {
+                signalWritableReady(completed, completedbytes);
+            }
+            budget_->notifyWaiting();
+        }
+        if (!blocked && file_source_)
+        {
+            uint64_t written = 0;
+            bool done = file_source_->writeInto(*stream_, written);
+            bytes_written_ += written;
+            countSent(written);
+            if (file_source_->failed())
+            {
+                int error = file_source_->readError();
+                file_source_.reset();
+                updateBacklog();
+                budget_->releaseHeld();
+                // a fin would mark the incomplete region as complete
+                stream_->ResetWithUserCode(0);
+                getJS()->processStreamFileError(error);
+                return;
+            }
+            if (done)
+                file_source_.reset();
+            else
+                blocked = true; // continued by OnCanWrite
+        }
+        updateBacklog();
+        budget_->releaseHeld();
+        if (blocked)
+            return;
 
-        if (send_fin_)
+        if (splice_source_)
+            splice_source_->doRelay(); // we can take relayed data again
+
+        if (send_fin_ && !fin_was_sent_)
         {
             absl::Status status = webtransport::SendFinOnStream(*stream_);
             if (status.ok()) {
@@ -164,6 +382,175 @@ namespace quic
         }
     }
 
+    void Http3WTStream::streamFinalInt()
+    {
+        if (fin_was_sent_)
+        {
+            // e.g. the fin was already sent by a relay
+            getJS()->processStreamNetworkFinish(NetworkTask::streamFinal);
+            return;
+        }
+        send_fin_ = true;
+        tryWrite();
+    }
+
+    bool Http3WTStream::spliceToInt(Http3WTStream *target)
+    {
+        if (!target || !stream_ || !target->stream_ || splice_target_ || target->splice_source_ ||
+            target->send_fin_ || target->fin_was_sent_ || target->file_source_ ||
+            message_mode_ || target->message_mode_)
+            return false;
+        splice_target_ = target;
+        target->splice_source_ = this;
+        pause_reading_ = false;
+        can_read_pending_ = false;
+        doRelay();
+        return true;
+    }
+
+    bool Http3WTStream::sendFileInt(std::unique_ptr<Http3FileSource> source)
+    {
+        if (!stream_ || send_fin_ || fin_was_sent_ || splice_source_ || file_source_ || message_mode_)
+            return false;
+        file_source_ = std::move(source); // counted in bytes_written_, once it is read
+        send_fin_ = true; // the file ends the stream, further chunks are dropped
+        updateBacklog();
+        tryWrite();
+        return true;
+    }
+
+    absl::Status Http3WTStream::writeShared(const std::shared_ptr<const std::string> &payload)
+    {
+        quiche::QuicheMemSlice slice(payload->data(), payload->size(),
+                                     [payload](const char *) {});
+        return stream_->Writev(absl::MakeSpan(&slice, 1), quiche::StreamWriteOptions());
+    }
+
+    bool Http3WTStream::writeSharedInt(const std::shared_ptr<const std::string> &payload, bool buffer)
+    {
+        if (fin_was_sent_ || send_fin_ || !stream_)
+            return false;
+        size_t len = payload->size();
+        if (canWriteDirect() && writeShared(payload).ok())
+        {
+            bytes_written_ += len;
+            countSent(len);
+            return true;
+        }
+        if (!buffer || !writableReady())
+            return false; // a slow subscriber must not stall the others
+        queueShared(payload);
+        return true;
+    }
+
+    void Http3WTStream::queueShared(const std::shared_ptr<const std::string> &payload)
+    {
+        WChunks cur;
+        cur.buffer = const_cast<char *>(payload->data());
+        cur.len = payload->size();
+        cur.bufferhandle = nullptr;
+        cur.shared = payload;
+        chunks_.push_back(cur);
+        bytes_written_ += cur.len;
+        queued_bytes_ += cur.len;
+        budget_->addQueued(cur.len);
+        updateBacklog();
+    }
+
+    std::string Http3WTStream::frameMessage(const char *data, size_t len)
+    {
+        // the inverse of readVarint
+        unsigned int lencode = len < (1ull << 6) ? 0 : len < (1ull << 14) ? 1 : len < (1ull << 30) ? 2 : 3;
+        size_t prefixlen = size_t(1) << lencode;
+        uint64_t prefix = uint64_t(len) | (uint64_t(lencode) << (prefixlen * 8 - 2));
+        std::string framed;
+        framed.reserve(prefixlen + len);
+        for (size_t i = prefixlen; i > 0; i--)
+            framed.push_back(static_cast<char>((prefix >> ((i - 1) * 8)) & 0xff));
+        framed.append(data, len);
+        return framed;
+    }
+
+    void Http3WTStream::writeMessageInt(const char *buffer, size_t len)
+    {
+        if (fin_was_sent_ || send_fin_ || !stream_)
+            return; // dropped
+        std::shared_ptr<const std::string> payload =
+            std::make_shared<const std::string>(frameMessage(buffer, len));
+        if (canWriteDirect() && writeShared(payload).ok())
+        {
+            bytes_written_ += payload->size();
+            countSent(payload->size());
+            return;
+        }
+        queueShared(payload); // OnCanWrite continues
+    }
+
+    void Http3WTStream::leaveBroadcast(Http3WTBroadcast *broadcast)
+    {
+        broadcasts_.erase(std::remove(broadcasts_.begin(), broadcasts_.end(), broadcast),
+                          broadcasts_.end());
+    }
+
+    void Http3WTStream::leaveBroadcasts()
+    {
+        for (Http3WTBroadcast *broadcast : broadcasts_)
+            broadcast->streamGone(this);
+        broadcasts_.clear();
+    }
+
+    void Http3WTStream::doRelay()
+    {
+        // backpressure: unread data stays inside quiche, until the target can write,
+        // the target's OnCanWrite resumes the relay
+        while (stream_ && splice_target_ && !relay_fin_)
+        {
+            WebTransportStream::PeekResult pr = stream_->PeekNextReadableRegion();
+            size_t len = pr.peeked_data.size();
+            if (len == 0 && !pr.fin_next)
+                return;
+            if (len > 0)
+            {
+                if (!splice_target_->canRelay())
+                    return;
+                absl::Status status =
+                    webtransport::WriteIntoStream(*splice_target_->stream_, pr.peeked_data);
+                if (!status.ok())
+                    return;
+                splice_target_->bytes_written_ += len;
+                splice_target_->countSent(len);
+            }
+            bytes_read_ += len;
+            if (stream_->SkipBytes(len))
+            {
+                relay_fin_ = true;
+                splice_target_->streamFinalInt();
+                getJS()->signalFinOnly(); // closes the readable in js
+            }
+        }
+    }
+
+    void Http3WTStream::unsplice()
+    {
+        if (splice_target_)
+        {
+            Http3WTStream *target = splice_target_;
+            splice_target_ = nullptr;
+            target->splice_source_ = nullptr;
+            // the relayed data is incomplete
+            if (target != this && !relay_fin_ && !target->send_fin_)
+                target->resetStreamInt(0);
+        }
+        if (splice_source_)
+        {
+            Http3WTStream *source = splice_source_;
+            splice_source_ = nullptr;
+            source->splice_target_ = nullptr;
+            if (source != this && !source->relay_fin_)
+                source->stopSendingInt(0);
+        }
+    }
+
     void Http3WTStream::stopSendingInt(unsigned int reason)
     {
         if (stream_)
@@ -189,7 +576,276 @@ namespace quic
             prio.send_group_id = sendGroupId;
             prio.send_order = sendOrder;
             stream_->SetPriority(prio);
+            setSendGroup(sendGroupId);
+        }
+    }
+
+    void Http3WTStream::setSendGroup(uint64_t group)
+    {
+        if (group == send_group_)
+            return;
+        if (backlogged_)
+        {
+            budget_->setBacklogged(send_group_, false);
+            budget_->setBacklogged(group, true);
+        }
+        send_group_ = group;
+        if (held_)
+            releaseHold(false); // judged again under the new group
+    }
+
+    void Http3WTStream::updateBacklog()
+    {
+        bool backlogged = stream_ && (chunks_.size() > 0 || file_source_);
+        if (backlogged == backlogged_)
+            return;
+        backlogged_ = backlogged;
+        budget_->setBacklogged(send_group_, backlogged);
+    }
+
+    void Http3WTStream::releaseHold(bool force)
+    {
+        if (!held_)
+            return;
+        held_ = false;
+        budget_->removeHeld(this);
+        deadlines_->setWakeup(this, QuicTime::Zero());
+        if (force)
+            force_write_ = true;
+        tryWrite();
+    }
+
+    void Http3WTStream::signalWritableReady(uint32_t count, uint64_t bytes)
+    {
+        waiting_ready_ = false;
+        budget_->removeWaiting(this);
+        getJS()->processStreamWrite(count, bytes, true, true);
+    }
+
+    void Http3WTStream::expireDeadline()
+    {
+        if (!stream_ || (fin_was_sent_ && bytes_acknowledged_ == bytes_sent_))
+            return; // everything arrived in time
+        uint32_t dropped = 0;
+        uint64_t droppedbytes = 0;
+        while (chunks_.size() > 0)
+        {
+            dropped++;
+            droppedbytes += chunks_.front().len;
+            releaseChunk(chunks_.front());
+            chunks_.pop_front();
+        }
+        releaseQueued(droppedbytes);
+        file_source_.reset();
+        updateBacklog();
+        budget_->removeHeld(this);
+        held_ = false;
+        if (splice_source_)
+        {
+            Http3WTStream *source = splice_source_;
+            splice_source_ = nullptr;
+            source->splice_target_ = nullptr;
+            source->stopSendingInt(0);
+        }
+        waiting_ready_ = false;
+        budget_->removeWaiting(this);
+        send_fin_ = true; // further chunks are dropped
+        stream_->ResetWithUserCode(0);
+        getJS()->processStreamDeadline(dropped, droppedbytes);
+        budget_->notifyWaiting();
+    }
+
+    Http3WTStreamDeadlines::Http3WTStreamDeadlines()
+        : alarm_factory_(QuicDefaultClock::Get(), this)
+    {
+    }
+
+    Http3WTStreamDeadlines::~Http3WTStreamDeadlines()
+    {
+        if (alarm_)
+            alarm_->PermanentCancel();
+    }
+
+    QuicTime Http3WTStreamDeadlines::fromNow(double milliseconds)
+    {
+        if (milliseconds < 0)
+            milliseconds = 0;
+        return QuicDefaultClock::Get()->Now() +
+               QuicTime::Delta::FromMicroseconds(static_cast<int64_t>(milliseconds * 1000));
+    }
+
+    void Http3WTStreamDeadlines::setDeadline(Http3WTStream *stream, QuicTime deadline)
+    {
+        if (stream->deadline_.IsInitialized())
+            deadlines_.erase(std::make_pair(stream->deadline_, stream));
+        stream->deadline_ = deadline;
+        if (deadline.IsInitialized())
+            deadlines_.insert(std::make_pair(deadline, stream));
+        rearm();
+    }
+
+    void Http3WTStreamDeadlines::setWakeup(Http3WTStream *stream, QuicTime wakeup)
+    {
+        if (stream->wakeup_.IsInitialized())
+            wakeups_.erase(std::make_pair(stream->wakeup_, stream));
+        stream->wakeup_ = wakeup;
+        if (wakeup.IsInitialized())
+            wakeups_.insert(std::make_pair(wakeup, stream));
+        rearm();
+    }
+
+    void Http3WTStreamDeadlines::removeStream(Http3WTStream *stream)
+    {
+        if (!stream->deadline_.IsInitialized() && !stream->wakeup_.IsInitialized())
+            return;
+        deadlines_.erase(std::make_pair(stream->deadline_, stream));
+        wakeups_.erase(std::make_pair(stream->wakeup_, stream));
+        stream->deadline_ = QuicTime::Zero();
+        stream->wakeup_ = QuicTime::Zero();
+        rearm();
+    }
+
+    void Http3WTStreamDeadlines::onAlarm()
+    {
+        QuicTime now = QuicDefaultClock::Get()->Now();
+        // expiring calls into js, which may change other deadlines
+        while (!deadlines_.empty() && deadlines_.begin()->first <= now)
+        {
+            Http3WTStream *stream = deadlines_.begin()->second;
+            deadlines_.erase(deadlines_.begin());
+            stream->deadline_ = QuicTime::Zero();
+            stream->expireDeadline();
         }
+        while (!wakeups_.empty() && wakeups_.begin()->first <= now)
+        {
+            Http3WTStream *stream = wakeups_.begin()->second;
+            wakeups_.erase(wakeups_.begin());
+            stream->wakeup_ = QuicTime::Zero();
+            stream->releaseHold(true);
+        }
+        rearm();
+    }
+
+    void Http3WTStreamDeadlines::rearm()
+    {
+        if (deadlines_.empty() && wakeups_.empty())
+        {
+            if (alarm_)
+                alarm_->Cancel();
+            return;
+        }
+        if (!alarm_)
+        {
+            if (!env_)
+                return; // set by the first call out of js
+            Napi::HandleScope scope(getEnv());
+            alarm_.reset(alarm_factory_.CreateAlarm(new AlarmDelegate(this)));
+        }
+        QuicTime next = QuicTime::Infinite();
+        if (!deadlines_.empty())
+            next = deadlines_.begin()->first;
+        if (!wakeups_.empty())
+            next = std::min(next, wakeups_.begin()->first);
+        alarm_->Update(next, QuicTime::Delta::FromMilliseconds(1));
+    }
+
+    void Http3WTSendBudget::setGroupWeight(uint64_t group, double weight)
+    {
+        if (weight > 0)
+            group_weights_[group] = weight;
+        else
+            group_weights_.erase(group);
+        releaseHeld();
+    }
+
+    bool Http3WTSendBudget::groupMayWrite(uint64_t group)
+    {
+        if (group_weights_.empty() || active_groups_.size() < 2)
+            return true; // nothing to share
+        double least = -1;
+        for (auto &active : active_groups_)
+        {
+            if (least < 0 || active.second.virtual_time < least)
+                least = active.second.virtual_time;
+        }
+        virtual_time_ = least;
+        auto it = active_groups_.find(group);
+        if (it == active_groups_.end())
+            return true; // starts at the least served group
+        return it->second.virtual_time <= least + kSendGroupQuantum / groupWeight(group);
+    }
+
+    void Http3WTSendBudget::addGroupSent(uint64_t group, size_t len)
+    {
+        if (group_weights_.empty())
+            return;
+        auto it = active_groups_.find(group);
+        if (it != active_groups_.end())
+            it->second.virtual_time += len / groupWeight(group);
+    }
+
+    void Http3WTSendBudget::setBacklogged(uint64_t group, bool backlogged)
+    {
+        if (backlogged)
+        {
+            auto it = active_groups_.find(group);
+            if (it == active_groups_.end())
+            {
+                // an idle group does not save up a share
+                it = active_groups_.emplace(group, GroupShare()).first;
+                it->second.virtual_time = virtual_time_;
+            }
+            it->second.backlogged++;
+            return;
+        }
+        auto it = active_groups_.find(group);
+        if (it == active_groups_.end())
+            return;
+        if (--it->second.backlogged == 0)
+        {
+            active_groups_.erase(it);
+            releaseHeld(); // the least served group may have changed
+        }
+    }
+
+    void Http3WTSendBudget::releaseHeld()
+    {
+        if (held_.empty() || releasing_)
+            return;
+        releasing_ = true;
+        // copy, as the released streams write and modify the held set
+        std::vector<Http3WTStream *> held(held_.begin(), held_.end());
+        for (Http3WTStream *stream : held)
+        {
+            if (held_.count(stream) > 0 && groupMayWrite(stream->send_group_))
+                stream->releaseHold(false);
+        }
+        releasing_ = false;
+    }
+
+    void Http3WTSendBudget::notifyWaiting()
+    {
+        if (waiting_.empty() || exhausted())
+            return;
+        // copy, as signaling modifies the waiting set
+        std::vector<Http3WTStream *> waiting(waiting_.begin(), waiting_.end());
+        for (Http3WTStream *stream : waiting)
+        {
+            if (waiting_.count(stream) > 0 && stream->writableReady())
+            {
+                stream->signalWritableReady(0, 0);
+            }
+        }
+    }
+
+    void Http3WTStream::fillStats(uint64_t *stats)
+    {
+        stats[kStreamStatsBytesWritten] = bytes_written_;
+        stats[kStreamStatsBytesSent] = bytes_sent_;
+        stats[kStreamStatsBytesAcknowledged] = bytes_acknowledged_;
+        // received includes the bytes still buffered inside quiche
+        stats[kStreamStatsBytesReceived] = bytes_read_ + (stream_ ? stream_->ReadableBytes() : 0);
+        stats[kStreamStatsBytesRead] = bytes_read_;
     }
 
     
@@ -273,20 +929,98 @@ namespace quic
         objVal.Get("onStreamRecvSignal").As<Napi::Function>().Call(objVal, {retObj});
     }
 
-    void Http3WTStreamJS::processStreamWrite(Napi::ObjectReference *bufferhandle, bool success)
+    bool Http3WTStreamJS::processStreamGone()
+    {
+        Napi::HandleScope scope(Env());
+
+        Napi::Value jsobj = Value().Get("jsobj");
+        if (!jsobj.IsObject())
+            return false;
+        Napi::Object objVal = jsobj.As<Napi::Object>();
+        if (!objVal.Get("onStreamGone").IsFunction())
+            return false;
+
+        // js snapshots the final stats and stops using the wrapper
+        objVal.Get("onStreamGone").As<Napi::Function>().Call(objVal, {});
+        Value().Delete("jsobj");
+        return true;
+    }
+
+    void Http3WTStreamJS::processStreamDeadline(uint32_t dropped, uint64_t droppedbytes)
+    {
+        Napi::HandleScope scope(Env());
+
+        Napi::Object objVal = Value().Get("jsobj").As<Napi::Object>();
+
+        Napi::Object retObj = Napi::Object::New(Env());
+        retObj.Set("dropped", dropped);
+        retObj.Set("droppedBytes", static_cast<double>(droppedbytes));
+
+        objVal.Get("onStreamDeadline").As<Napi::Function>().Call(objVal, {retObj});
+    }
+
+    void Http3WTStreamJS::processStreamFileError(int error)
+    {
+        Napi::HandleScope scope(Env());
+
+        Napi::Object objVal = Value().Get("jsobj").As<Napi::Object>();
+
+        Napi::Object retObj = Napi::Object::New(Env());
+        retObj.Set("errno", error);
+        retObj.Set("message", error != 0 ? strerror(error) : "the file was truncated");
+
+        objVal.Get("onStreamFileError").As<Napi::Function>().Call(objVal, {retObj});
+    }
+
+    void Http3WTStreamJS::processStreamWrite(uint32_t count, uint64_t bytes, bool success, bool ready)
     {
         Napi::HandleScope scope(Env());
 
         Napi::Object objVal = Value().Get("jsobj").As<Napi::Object>();
-        bufferhandle->Unref(); // release the outgoing buffer
-        delete bufferhandle;   // free the handle object
 
         Napi::Object retObj = Napi::Object::New(Env());
         retObj.Set("success", success);
+        retObj.Set("count", count);
+        retObj.Set("byteLength", static_cast<double>(bytes));
+        retObj.Set("ready", ready);
 
         objVal.Get("onStreamWrite").As<Napi::Function>().Call(objVal, {retObj});
     }
 
+    bool Http3WTStreamJS::processStreamMessages(const std::string &buffer,
+                                                const std::vector<std::pair<size_t, uint64_t>> &messages,
+                                                bool fin, const char *error)
+    {
+        Napi::HandleScope scope(Env());
+
+        Napi::Object objVal = Value().Get("jsobj").As<Napi::Object>();
+
+        Napi::Array msgarr = Napi::Array::New(Env(), messages.size());
+        if (messages.size() > 0)
+        {
+            // one copy for the whole batch, the messages are views into it
+            size_t base = messages.front().first;
+            size_t end = messages.back().first + messages.back().second;
+            Napi::ArrayBuffer batch = Napi::ArrayBuffer::New(Env(), end - base);
+            if (end > base)
+                memcpy(batch.Data(), buffer.data() + base, end - base);
+            for (size_t i = 0; i < messages.size(); i++)
+            {
+                msgarr.Set(i, Napi::Uint8Array::New(Env(), messages[i].second, batch,
+                                                    messages[i].first - base));
+            }
+        }
+
+        Napi::Object retObj = Napi::Object::New(Env());
+        retObj.Set("messages", msgarr);
+        retObj.Set("fin", fin);
+        if (error)
+            retObj.Set("error", error);
+
+        Napi::Value more = objVal.Get("onStreamMessages").As<Napi::Function>().Call(objVal, {retObj});
+        return !more.IsBoolean() || more.As<Napi::Boolean>().Value();
+    }
+
     void  Http3WTStreamJS::StreamReadBuffer::getBuffer(size_t reqsize) {
         Napi::HandleScope scope(jsobj_->Env());
         Napi::Object objVal = jsobj_->Value().Get("jsobj").As<Napi::Object>();
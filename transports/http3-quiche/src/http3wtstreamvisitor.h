@@ -13,10 +13,21 @@
 
 #include <napi.h>
 
+#include <memory>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "src/librarymain.h"
+#include "src/http3filesource.h"
+#include "src/napialarmfactory.h"
+#include "quiche/quic/core/quic_time.h"
+#include "quiche/quic/core/quic_default_clock.h"
 #include "quiche/common/simple_buffer_allocator.h"
+#include "quiche/web_transport/stream_helpers.h"
 #include "quiche/quic/core/web_transport_interface.h"
 #include "quiche/quic/platform/api/quic_logging.h"
 #include "quiche/common/quiche_circular_deque.h"
@@ -27,17 +38,174 @@ namespace quic
 
     class Http3WTStreamJS;
 
+    class Http3WTStream;
+
+    class Http3WTBroadcast;
+
+    // default high water marks for the bytes queued on the native side,
+    // quiche buffers additionally up to its own threshold before CanWrite() fails
+    constexpr uint64_t kDefaultStreamSendHighWaterMark = 256 * 1024;
+    constexpr uint64_t kDefaultSessionSendHighWaterMark = 4 * 1024 * 1024;
+
+    // bytes a send group may run ahead of its share, before its streams are held
+    constexpr uint64_t kSendGroupQuantum = 16 * 1024;
+    // a held stream writes again after this time, even if its group is above its share,
+    // so that a group blocked e.g. by flow control can not stall the others
+    constexpr int64_t kSendGroupMaxHoldMs = 20;
+
+    // upper bound for a single length prefixed message, if not configured
+    constexpr uint64_t kDefaultMaxMessageSize = 16 * 1024 * 1024;
+    // a configured bound must be below the range of a quic varint (2^62)
+    constexpr uint64_t kVarintLimit = uint64_t(1) << 62;
+
+    // accounting of the bytes queued by all streams of a session,
+    // shared between the session and its streams
+    class Http3WTSendBudget
+    {
+    public:
+        bool exhausted() const
+        {
+            return queued_bytes_ >= session_high_water_mark_;
+        }
+
+        void addQueued(size_t len) { queued_bytes_ += len; }
+        void releaseQueued(size_t len) { queued_bytes_ -= len; }
+
+        void setHighWaterMarks(uint64_t sessionMark, uint64_t streamMark)
+        {
+            session_high_water_mark_ = sessionMark;
+            stream_high_water_mark_ = streamMark;
+        }
+
+        uint64_t streamHighWaterMark() const { return stream_high_water_mark_; }
+
+        void addWaiting(Http3WTStream *stream) { waiting_.insert(stream); }
+        void removeWaiting(Http3WTStream *stream) { waiting_.erase(stream); }
+
+        // signals all waiting streams, which are below their high water marks again
+        void notifyWaiting();
+
+        // weighted send groups, groups without a weight have the weight 1,
+        // a weight of 0 or less removes it
+        void setGroupWeight(uint64_t group, double weight);
+
+        // true, if the group has not used more than its share of the data
+        // handed to quiche by all groups with queued data
+        bool groupMayWrite(uint64_t group);
+
+        void addGroupSent(uint64_t group, size_t len);
+
+        // a group takes part in the sharing, while one of its streams has queued data
+        void setBacklogged(uint64_t group, bool backlogged);
+
+        void holdStream(Http3WTStream *stream) { held_.insert(stream); }
+        void removeHeld(Http3WTStream *stream) { held_.erase(stream); }
+
+        // lets held streams write, whose groups are within their shares again
+        void releaseHeld();
+
+    protected:
+        double groupWeight(uint64_t group)
+        {
+            auto it = group_weights_.find(group);
+            return it != group_weights_.end() ? it->second : 1.;
+        }
+
+        uint64_t queued_bytes_ = 0;
+        uint64_t session_high_water_mark_ = kDefaultSessionSendHighWaterMark;
+        uint64_t stream_high_water_mark_ = kDefaultStreamSendHighWaterMark;
+        std::unordered_set<Http3WTStream *> waiting_; // unowned
+
+        struct GroupShare
+        {
+            uint32_t backlogged = 0; // streams with queued data
+            double virtual_time = 0; // bytes handed to quiche divided by the weight
+        };
+        std::unordered_map<uint64_t, double> group_weights_;
+        std::unordered_map<uint64_t, GroupShare> active_groups_;
+        double virtual_time_ = 0; // of the least served active group
+        std::unordered_set<Http3WTStream *> held_; // unowned
+        bool releasing_ = false;
+    };
+
+    // send deadlines of all streams of a session, served by a single alarm,
+    // shared between the session and its streams
+    class Http3WTStreamDeadlines : public EnvGetter
+    {
+    public:
+        Http3WTStreamDeadlines();
+        ~Http3WTStreamDeadlines();
+
+        // the alarm is created on first use, from a call out of js
+        void setEnv(Napi::Env env) { env_ = env; }
+
+        Napi::Env getEnv() override { return Napi::Env(env_); }
+        Napi::Object getValue() override { return Napi::Object(); }
+
+        // an uninitialized deadline removes the stream
+        void setDeadline(Http3WTStream *stream, QuicTime deadline);
+        void removeStream(Http3WTStream *stream);
+
+        // wakes a stream held by its send group
+        void setWakeup(Http3WTStream *stream, QuicTime wakeup);
+
+        static QuicTime fromNow(double milliseconds);
+
+    protected:
+        class AlarmDelegate : public QuicAlarm::DelegateWithoutContext
+        {
+        public:
+            AlarmDelegate(Http3WTStreamDeadlines *deadlines) : deadlines_(deadlines) {}
+
+            void OnAlarm() override { deadlines_->onAlarm(); }
+
+        protected:
+            Http3WTStreamDeadlines *deadlines_;
+        };
+
+        // resets all streams with expired deadlines
+        void onAlarm();
+        void rearm();
+
+        napi_env env_ = nullptr;
+        NapiAlarmFactory alarm_factory_;
+        std::unique_ptr<QuicAlarm> alarm_;
+        std::set<std::pair<QuicTime, Http3WTStream *>> deadlines_; // unowned streams
+        std::set<std::pair<QuicTime, Http3WTStream *>> wakeups_;   // unowned streams
+    };
+
+    // fixed offsets of the per stream counters inside the array filled by getStats
+    enum StreamStatsField
+    {
+        kStreamStatsBytesWritten,
+        kStreamStatsBytesSent,
+        kStreamStatsBytesAcknowledged,
+        kStreamStatsBytesReceived,
+        kStreamStatsBytesRead,
+        kStreamStatsNumFields
+    };
+
     class Http3WTStream
     {
         friend Http3WTStreamJS;
 
     public:
-        Http3WTStream(WebTransportStream *stream) : stream_(stream),
-                                                    js_(nullptr)
+        Http3WTStream(WebTransportStream *stream, std::shared_ptr<Http3WTSendBudget> budget,
+                      std::shared_ptr<Http3WTStreamDeadlines> deadlines)
+            : stream_(stream), js_(nullptr), budget_(budget),
+              send_high_water_mark_(budget->streamHighWaterMark()), deadlines_(deadlines)
         {
         }
 
-        ~Http3WTStream() { /*printf("stream destruct %x\n", this);*/ };
+        ~Http3WTStream()
+        {
+            /*printf("stream destruct %x\n", this);*/
+            budget_->removeWaiting(this);
+            budget_->removeHeld(this);
+            deadlines_->removeStream(this);
+            unsplice();
+            leaveBroadcasts();
+        };
 
         class Visitor : public WebTransportStreamVisitor
         {
@@ -115,15 +283,72 @@ namespace quic
             return !stream_;
         }
 
-    protected:
-        // internal functions called by js object
+        void fillStats(uint64_t *stats);
 
-        void streamFinalInt()
+        // true, if js may pass further chunks, the stream and the session are below their high water marks
+        bool writableReady()
         {
-            send_fin_ = true;
-            tryWrite();
+            if (!stream_)
+                return true; // chunks are dropped anyway
+            return queued_bytes_ < send_high_water_mark_ && !budget_->exhausted();
         }
 
+        // called, if the writable ready state was reported as false to js
+        void waitWritableReady()
+        {
+            waiting_ready_ = true;
+            budget_->addWaiting(this);
+        }
+
+        void signalWritableReady(uint32_t count, uint64_t bytes);
+
+        // connects the read side of this stream to the write side of target,
+        // the data is relayed without passing js
+        bool spliceToInt(Http3WTStream *target);
+
+        // sends the region of the file and finishes the stream afterwards
+        bool sendFileInt(std::unique_ptr<Http3FileSource> source);
+
+        // writes a payload shared with other streams, queues it only if buffer is set
+        // and the stream is below its high water marks, returns false if it was dropped
+        bool writeSharedInt(const std::shared_ptr<const std::string> &payload, bool buffer);
+
+        // in message mode every chunk is prefixed with its length as a quic varint,
+        // reads are reassembled to whole messages, must be set before the first read
+        void setMessageMode(bool enabled, uint64_t maxMessageSize)
+        {
+            message_mode_ = enabled;
+            max_message_size_ = maxMessageSize;
+        }
+
+        bool messageMode() const { return message_mode_; }
+
+        // returns the payload prefixed with its length
+        static std::string frameMessage(const char *data, size_t len);
+
+        // an uninitialized deadline clears it
+        void setDeadline(QuicTime deadline) { deadlines_->setDeadline(this, deadline); }
+
+        QuicTime deadline() const { return deadline_; }
+
+        // called by the deadlines, resets the stream and drops the queued chunks
+        void expireDeadline();
+
+        void setSendGroup(uint64_t group);
+
+        // called by the budget, if the group is within its share again (force = false)
+        // or by the deadlines after kSendGroupMaxHoldMs (force = true)
+        void releaseHold(bool force);
+
+        void joinBroadcast(Http3WTBroadcast *broadcast) { broadcasts_.push_back(broadcast); }
+        void leaveBroadcast(Http3WTBroadcast *broadcast);
+        void leaveBroadcasts();
+
+    protected:
+        // internal functions called by js object
+
+        void streamFinalInt();
+
         void stopSendingInt(unsigned int reason);
         void resetStreamInt(unsigned int reason);
 
@@ -135,9 +360,60 @@ namespace quic
         {
             char *buffer;
             size_t len;
-            Napi::ObjectReference *bufferhandle;
+            Napi::ObjectReference *bufferhandle; // js buffer, or
+            std::shared_ptr<const std::string> shared; // payload shared between streams
         };
 
+        // quiche references the shared payload without copying it
+        absl::Status writeShared(const std::shared_ptr<const std::string> &payload);
+
+        void queueShared(const std::shared_ptr<const std::string> &payload);
+
+        // frames the chunk as one message, the buffer needs no pinning
+        void writeMessageInt(const char *buffer, size_t len);
+
+        // reassembles the messages and passes them in one batch to js
+        void doReadMessages();
+
+        // accounts bytes handed over to quiche
+        void countSent(uint64_t len)
+        {
+            bytes_sent_ += len;
+            budget_->addGroupSent(send_group_, len);
+        }
+
+        // true, if data may be handed to quiche without queuing
+        bool canWriteDirect()
+        {
+            return chunks_.size() == 0 && stream_->CanWrite() && budget_->groupMayWrite(send_group_);
+        }
+
+        // tracks, if the stream has queued data for the send group sharing
+        void updateBacklog();
+
+        // returns true, if the chunk is finished without queuing
+        bool writeChunkDirectInt(char *buffer, size_t len)
+        {
+            if (fin_was_sent_ || send_fin_ || !stream_)
+            {
+                return true; // dropped
+            }
+            if (!canWriteDirect())
+            {
+                return false;
+            }
+            // quiche copies the data, so the buffer needs no pinning
+            absl::Status status =
+                webtransport::WriteIntoStream(*stream_, absl::string_view(buffer, len));
+            if (!status.ok())
+            {
+                return false;
+            }
+            bytes_written_ += len;
+            countSent(len);
+            return true;
+        }
+
         void writeChunkInt(char *buffer, size_t len, Napi::ObjectReference *bufferhandle)
         {
             if (fin_was_sent_ || send_fin_)
@@ -155,11 +431,38 @@ namespace quic
             cur.len = len;
             cur.bufferhandle = bufferhandle;
             chunks_.push_back(cur);
+            bytes_written_ += len;
+            queued_bytes_ += len;
+            budget_->addQueued(len);
+            updateBacklog();
             tryWrite();
         }
 
         void cancelWrite(Napi::ObjectReference *handle);
 
+        // true, if the relay may write directly to this stream
+        bool canRelay()
+        {
+            return stream_ && !send_fin_ && !fin_was_sent_ && chunks_.size() == 0 && stream_->CanWrite();
+        }
+
+        void doRelay();
+        void unsplice();
+
+        void releaseQueued(size_t len)
+        {
+            queued_bytes_ -= len;
+            budget_->releaseQueued(len);
+        }
+
+        static void releaseChunk(WChunks &chunk)
+        {
+            if (!chunk.bufferhandle)
+                return; // a shared payload is released with the chunk
+            chunk.bufferhandle->Unref(); // release the outgoing buffer
+            delete chunk.bufferhandle;   // free the handle object
+        }
+
     private:
         Http3WTStreamJS *js_;
 
@@ -172,6 +475,48 @@ namespace quic
         bool can_read_pending_ = false;
         bool stream_was_reset_ = false;
         std::deque<WChunks> chunks_;
+
+        // backpressure, bytes pinned in chunks_ against the high water marks
+        std::shared_ptr<Http3WTSendBudget> budget_;
+        uint64_t queued_bytes_ = 0;
+        uint64_t send_high_water_mark_;
+        bool waiting_ready_ = false;
+
+        // relay, the read side of this stream feeds the write side of splice_target_
+        Http3WTStream *splice_target_ = nullptr; // unowned
+        Http3WTStream *splice_source_ = nullptr; // unowned
+        bool relay_fin_ = false;
+
+        // pulled in doCanWrite after the queued chunks
+        std::unique_ptr<Http3FileSource> file_source_;
+
+        std::vector<Http3WTBroadcast *> broadcasts_; // unowned, we are a member of
+
+        // partial reliability, data not sent until the deadline is worthless
+        std::shared_ptr<Http3WTStreamDeadlines> deadlines_;
+        QuicTime deadline_ = QuicTime::Zero(); // maintained by deadlines_
+
+        // weighted sharing between the send groups of the session
+        uint64_t send_group_ = 0;
+        bool backlogged_ = false;
+        bool held_ = false;
+        bool force_write_ = false; // one write round despite the share
+        QuicTime wakeup_ = QuicTime::Zero(); // maintained by deadlines_
+
+        friend Http3WTStreamDeadlines;
+        friend Http3WTSendBudget;
+
+        // length prefixed messages
+        bool message_mode_ = false;
+        bool message_error_ = false; // the rest of the stream is discarded
+        uint64_t max_message_size_ = kDefaultMaxMessageSize;
+        std::string message_buffer_; // unparsed bytes, at most one partial message
+
+        // stream statistics, bytes received is derived from bytes_read_
+        uint64_t bytes_written_ = 0; // accepted from js
+        uint64_t bytes_sent_ = 0; // handed over to quiche
+        uint64_t bytes_acknowledged_ = 0;
+        uint64_t bytes_read_ = 0; // delivered to js
     };
 
     class Http3WTStreamJS : public Napi::ObjectWrap<Http3WTStreamJS>
@@ -216,6 +561,13 @@ namespace quic
 
         void init(Http3WTStream *wtstream);
 
+        // takes a wrapper from the free list or creates a new one
+        static Napi::Object acquire(Napi::Env env);
+
+        // called on visitor destruction, deletes the native stream and
+        // returns the wrapper to the free list, if js has released it
+        void recycle();
+
         // nan stuff
 
         void startReading(const Napi::CallbackInfo &info)
@@ -233,18 +585,32 @@ namespace quic
             wtstream_->doDrainReads();
         }
 
-        void writeChunk(const Napi::CallbackInfo &info)
+        Napi::Value writeChunk(const Napi::CallbackInfo &info)
         {
             // ok we have to get the buffer
 
             const Napi::Object bufferlocal = info[0].ToObject();
-            Napi::ObjectReference *bufferhandle = new Napi::ObjectReference();
-            *bufferhandle = Napi::Persistent(bufferlocal);
 
             char *buffer = bufferlocal.As<Napi::Buffer<char>>().Data();
             size_t len = bufferlocal.As<Napi::Buffer<char>>().Length();
 
-            wtstream_->writeChunkInt(buffer, len, bufferhandle);
+            if (wtstream_->messageMode())
+            {
+                wtstream_->writeMessageInt(buffer, len);
+            }
+            else if (!wtstream_->writeChunkDirectInt(buffer, len))
+            {
+                Napi::ObjectReference *bufferhandle = new Napi::ObjectReference();
+                *bufferhandle = Napi::Persistent(bufferlocal);
+
+                wtstream_->writeChunkInt(buffer, len, bufferhandle);
+            }
+
+            // false means, js has to wait for an onStreamWrite with ready set
+            bool ready = wtstream_->writableReady();
+            if (!ready)
+                wtstream_->waitWritableReady();
+            return Napi::Value::From(Env(), ready);
         }
 
         void streamFinal(const Napi::CallbackInfo &info)
@@ -279,6 +645,71 @@ namespace quic
             wtstream_->resetStreamInt(reason);
         }
 
+        void getStats(const Napi::CallbackInfo &info)
+        {
+            // fills a preallocated BigUint64Array, so that polling does not allocate
+            if (!info[0].IsTypedArray() ||
+                info[0].As<Napi::TypedArray>().TypedArrayType() != napi_biguint64_array)
+            {
+                Napi::TypeError::New(Env(), "getStats expects a BigUint64Array").ThrowAsJavaScriptException();
+                return;
+            }
+            Napi::BigUint64Array stats = info[0].As<Napi::BigUint64Array>();
+            if (stats.ElementLength() < kStreamStatsNumFields)
+            {
+                Napi::RangeError::New(Env(), "BigUint64Array passed to getStats is too small").ThrowAsJavaScriptException();
+                return;
+            }
+            wtstream_->fillStats(stats.Data());
+        }
+
+        Napi::Value spliceTo(const Napi::CallbackInfo &info)
+        {
+            Http3Constructors *constr = Env().GetInstanceData<Http3Constructors>();
+            if (!info[0].IsObject() || !info[0].As<Napi::Object>().InstanceOf(constr->stream.Value()))
+            {
+                Napi::TypeError::New(Env(), "spliceTo expects a native stream").ThrowAsJavaScriptException();
+                return Env().Undefined();
+            }
+            Http3WTStreamJS *target = Napi::ObjectWrap<Http3WTStreamJS>::Unwrap(info[0].As<Napi::Object>());
+            return Napi::Value::From(Env(), wtstream_->spliceToInt(target->getObj()));
+        }
+
+        void sendFile(const Napi::CallbackInfo &info)
+        {
+            uint64_t offset = 0;
+            int64_t length = -1; // up to the end of the file
+            if (info[1].IsNumber())
+                offset = info[1].As<Napi::Number>().Int64Value();
+            if (info[2].IsNumber())
+                length = info[2].As<Napi::Number>().Int64Value();
+
+            std::string error;
+            std::unique_ptr<Http3FileSource> source;
+            if (info[0].IsString())
+            {
+                source = Http3FileSource::open(info[0].As<Napi::String>().Utf8Value(), offset, length, error);
+            }
+            else if (info[0].IsNumber())
+            {
+                source = Http3FileSource::fromFd(info[0].As<Napi::Number>().Int32Value(), offset, length, error);
+            }
+            else
+            {
+                Napi::TypeError::New(Env(), "sendFile expects a path or a file descriptor").ThrowAsJavaScriptException();
+                return;
+            }
+            if (!source)
+            {
+                Napi::Error::New(Env(), "sendFile failed: " + error).ThrowAsJavaScriptException();
+                return;
+            }
+            if (!wtstream_->sendFileInt(std::move(source)))
+            {
+                Napi::Error::New(Env(), "sendFile failed: stream is not writable").ThrowAsJavaScriptException();
+            }
+        }
+
         void updateSendOrderAndGroup(const Napi::CallbackInfo &info)
         {
             if (!info[0].IsUndefined())
@@ -299,9 +730,30 @@ namespace quic
                     sendGroupId = sendGroupIdValue.As<Napi::BigInt>().Uint64Value(&approx);
                 }
                 wtstream_->updateSendOrderAndGroupInt(sendOrder, sendGroupId);
+                // milliseconds from now, null clears the deadline, missing keeps it
+                if (obj.Has("deadline") && !(obj).Get("deadline").IsUndefined())
+                {
+                    Napi::Value deadlineValue = (obj).Get("deadline");
+                    wtstream_->deadlines_->setEnv(Env());
+                    if (deadlineValue.IsNumber())
+                        wtstream_->setDeadline(Http3WTStreamDeadlines::fromNow(deadlineValue.As<Napi::Number>().DoubleValue()));
+                    else
+                        wtstream_->setDeadline(QuicTime::Zero());
+                }
             }
         }
 
+        // milliseconds until the deadline, null without deadline
+        Napi::Value getDeadline(const Napi::CallbackInfo &info)
+        {
+            QuicTime deadline = wtstream_->deadline();
+            if (!deadline.IsInitialized())
+                return Env().Null();
+            QuicTime now = QuicDefaultClock::Get()->Now();
+            double remaining = deadline > now ? (deadline - now).ToMicroseconds() / 1000.0 : 0;
+            return Napi::Number::New(Env(), remaining);
+        }
+
         static void InitExports(Napi::Env env, Napi::Object exports, Http3Constructors *constr)
         {
             Napi::Function tplwtsv =
@@ -321,6 +773,14 @@ namespace quic
                                                                               static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
                                 InstanceMethod<&Http3WTStreamJS::updateSendOrderAndGroup>("updateSendOrderAndGroup",
                                                                                           static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                InstanceMethod<&Http3WTStreamJS::getDeadline>("getDeadline",
+                                                                              static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                InstanceMethod<&Http3WTStreamJS::getStats>("getStats",
+                                                                           static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                InstanceMethod<&Http3WTStreamJS::spliceTo>("spliceTo",
+                                                                           static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+                                InstanceMethod<&Http3WTStreamJS::sendFile>("sendFile",
+                                                                           static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
                             });
             constr->stream = Napi::Persistent(tplwtsv);
             exports.Set("Http3WTStreamVisitor", tplwtsv);
@@ -339,9 +799,17 @@ namespace quic
     protected:
         std::unique_ptr<Http3WTStream> wtstream_;
 
-        void processStreamWrite(Napi::ObjectReference *bufferhandle, bool success);
+        void processStreamWrite(uint32_t count, uint64_t bytes, bool success, bool ready);
+        void processStreamDeadline(uint32_t dropped, uint64_t droppedbytes);
+        // error is the errno of the failed read, 0 for a truncated file
+        void processStreamFileError(int error);
+        // messages are offset and length pairs into buffer, returns false if js wants no more
+        bool processStreamMessages(const std::string &buffer,
+                                   const std::vector<std::pair<size_t, uint64_t>> &messages,
+                                   bool fin, const char *error);
         void processStreamNetworkFinish(NetworkTask task);
         void processStreamRecvSignal(WebTransportStreamError error_code, NetworkTask task);
+        bool processStreamGone();
         void signalFinOnly();
     };
 }
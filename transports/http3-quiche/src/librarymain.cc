@@ -12,10 +12,14 @@
 #include "src/http3client.h"
 #include "src/http3dispatcher.h"
 #include "src/http3wtsessionvisitor.h"
+#include "src/http3wtbroadcast.h"
 #include "src/napialarmfactory.h"
+#include "quiche/quic/core/crypto/crypto_protocol.h"
 #include "quiche/common/platform/api/quiche_command_line_flags.h"
 #include "quiche/common/platform/api/quiche_flags.h"
 
+#include <limits>
+
 #include "absl/log/initialize.h"
 #include "absl/strings/string_view.h"
 
@@ -67,6 +71,84 @@ namespace quic
     }
   }
 
+  bool parseCongestionControl(Napi::Object obj, QuicTagVector &tags)
+  {
+    if (obj.Has("congestionControl") && !(obj).Get("congestionControl").IsUndefined())
+    {
+      std::string cc = (obj).Get("congestionControl").ToString().Utf8Value();
+      // the values of the WebTransport spec map to an algorithm
+      if (cc == "bbrv2" || cc == "low-latency")
+        tags.push_back(kB2ON);
+      else if (cc == "bbr")
+        tags.push_back(kTBBR);
+      else if (cc == "cubic" || cc == "throughput")
+        tags.push_back(kQBIC);
+      else if (cc == "reno")
+        tags.push_back(kRENO);
+      else if (cc != "default")
+      {
+        Napi::TypeError::New(obj.Env(), "congestionControl must be bbrv2, bbr, cubic, reno, default, throughput or low-latency").ThrowAsJavaScriptException();
+        return false;
+      }
+    }
+    if (obj.Has("congestionControlOptions") && !(obj).Get("congestionControlOptions").IsUndefined())
+    {
+      // tunables of the algorithm as connection option tags, e.g. BBR4 or B2HR
+      Napi::Value optionsValue = (obj).Get("congestionControlOptions");
+      if (!optionsValue.IsArray())
+      {
+        Napi::TypeError::New(obj.Env(), "congestionControlOptions is not an array").ThrowAsJavaScriptException();
+        return false;
+      }
+      Napi::Array optionsArray = optionsValue.As<Napi::Array>();
+      for (uint32_t i = 0; i < optionsArray.Length(); i++)
+      {
+        std::string tag = optionsArray.Get(i).ToString().Utf8Value();
+        if (tag.empty() || tag.size() > 4)
+        {
+          Napi::TypeError::New(obj.Env(), "congestionControlOptions must be tags of up to 4 characters").ThrowAsJavaScriptException();
+          return false;
+        }
+        tags.push_back(ParseQuicTag(tag));
+      }
+    }
+    return true;
+  }
+
+  // true, if the member is undefined or a number from 0 to below limit
+  static bool checkOptionRange(Napi::Object obj, const char *name, double limit)
+  {
+    if (!obj.Has(name) || (obj).Get(name).IsUndefined())
+      return true;
+    double value = (obj).Get(name).ToNumber().DoubleValue();
+    if (value >= 0 && value < limit)
+      return true;
+    Napi::RangeError::New(obj.Env(), std::string(name) + " must be a non negative number").ThrowAsJavaScriptException();
+    return false;
+  }
+
+  bool validateSessionOptions(Napi::Object obj)
+  {
+    const double unlimited = std::numeric_limits<double>::infinity();
+    if (!checkOptionRange(obj, "sessionSendHighWaterMark", unlimited) ||
+        !checkOptionRange(obj, "streamSendHighWaterMark", unlimited) ||
+        !checkOptionRange(obj, "maxMessageSize", static_cast<double>(kVarintLimit)) ||
+        !checkOptionRange(obj, "datagramRingSize", unlimited) ||
+        !checkOptionRange(obj, "datagramMaxQueue", unlimited) ||
+        !checkOptionRange(obj, "datagramMaxAge", unlimited))
+      return false;
+    if (obj.Has("datagramDropPolicy") && !(obj).Get("datagramDropPolicy").IsUndefined())
+    {
+      std::string policy = (obj).Get("datagramDropPolicy").ToString().Utf8Value();
+      if (policy != "oldest" && policy != "newest")
+      {
+        Napi::TypeError::New(obj.Env(), "datagramDropPolicy must be oldest or newest").ThrowAsJavaScriptException();
+        return false;
+      }
+    }
+    return true;
+  }
+
   Napi::Object Init(Napi::Env env, Napi::Object exports)
   {
     #ifdef _MSC_VER
@@ -80,6 +162,8 @@ namespace quic
     Http3ClientJS::InitExports(env, exports);
     Http3WTSessionJS::InitExports(env, exports, constr);
     Http3WTStreamJS::InitExports(env, exports, constr);
+    Http3WTBroadcastJS::InitExports(env, exports);
+    Http3WTDatagramBroadcastJS::InitExports(env, exports);
     NapiAlarmJS::InitExports(env, exports, constr);
     Napi::Function qinitna = Function::New<quicheInit>(env);
     constr->quicheInit = Napi::Persistent(qinitna);
@@ -13,8 +13,22 @@
 
 #include <napi.h>
 
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "quiche/quic/core/quic_tag.h"
+
 namespace quic
 {
+  class Http3WTStreamJS;
+  class Http3WTSessionJS;
+  class Http3SessionCache;
+
+  // upper bound of recycled wrapper objects kept per type
+  constexpr size_t kMaxPooledWrappers = 1024;
+
   enum NetworkTask
   {
     resetStream,
@@ -35,8 +49,25 @@ namespace quic
     Napi::FunctionReference session;
     Napi::FunctionReference napialarm;
     Napi::FunctionReference quicheInit;
+    // free lists of wrappers, whose native objects are gone,
+    // every entry holds one reference to keep the wrapper alive
+    std::vector<Http3WTStreamJS *> streamPool;
+    std::vector<Http3WTSessionJS *> sessionPool;
+    // tls tickets shared by all clients, created with the first client,
+    // by file, the empty name is the cache kept only in memory
+    std::map<std::string, std::shared_ptr<Http3SessionCache>> sessionCaches;
   };
 
+  // converts the congestionControl and congestionControlOptions members of obj
+  // to connection option tags for QuicConnection::ApplyConnectionOptions,
+  // throws and returns false on invalid values
+  bool parseCongestionControl(Napi::Object obj, QuicTagVector &tags);
+
+  // checks the options, that are applied to every session of a server or
+  // client, so that invalid values fail at startup and not per session,
+  // throws and returns false on invalid values
+  bool validateSessionOptions(Napi::Object obj);
+
 
 }
 #endif
\ No newline at end of file